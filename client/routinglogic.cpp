@@ -304,20 +304,19 @@ void RoutingLogic::computeRoute()
 		return;
 	}
 
-	QVector< IGPSLookup::Result > gps;
-
-	for ( int i = 0; i < waypoints.size(); i++ ) {
-		Timer time;
-		IGPSLookup::Result result;
-		bool found = gpsLookup->GetNearestEdge( &result, waypoints[i], 1000 );
-		qDebug() << "GPS Lookup:" << time.elapsed() << "ms";
+	QVector< IGPSLookup::Position > positions;
+	for ( int i = 0; i < waypoints.size(); i++ )
+		positions.push_back( waypoints[i] );
 
-		if ( !found ) {
-			clearRoute();
-			return;
-		}
+	QVector< IGPSLookup::Result > gps;
+	QVector< bool > snapped;
+	Timer lookupTime;
+	bool foundAll = gpsLookup->GetNearestEdges( &gps, &snapped, positions, 1000 );
+	qDebug() << "GPS Lookup:" << lookupTime.elapsed() << "ms";
 
-		gps.push_back( result );
+	if ( !foundAll ) {
+		clearRoute();
+		return;
 	}
 
 	d->pathNodes.clear();
@@ -404,36 +403,24 @@ void RoutingLogic::computeRoundtrip()
 	waypoints.push_back( d->source );
 	waypoints += d->waypoints;
 
-	for ( int i = 0; i < waypoints.size(); i++ ) {
-		IGPSLookup::Result result;
-		bool found = gpsLookup->GetNearestEdge( &result, waypoints[i], 1000 );
+	QVector< IGPSLookup::Position > positions;
+	for ( int i = 0; i < waypoints.size(); i++ )
+		positions.push_back( waypoints[i] );
 
-		if ( !found ) {
-			clearRoute();
-			return;
-		}
-
-		gps.push_back( result );
+	QVector< bool > snapped;
+	if ( !gpsLookup->GetNearestEdges( &gps, &snapped, positions, 1000 ) ) {
+		clearRoute();
+		return;
 	}
 
 	qDebug() << "GPS Mass Lookup:" << time.restart() << "ms";
 
 	// compute all pair shortest paths
-	QVector< int > distMatrix( num * num, 0 );
-	for ( int from = 0; from < num; from++ ) {
-		for ( int to = 0; to < num; to++ ) {
-			// skip source == target
-			if ( from == to )
-				continue;
-
-			double travelTime = 0;
-			// lookup distance only
-			bool found = router->GetRoute( &travelTime, NULL, NULL, gps[from], gps[to] );
-			if ( !found )
-				travelTime = std::numeric_limits< double >::max();
-
-			distMatrix[from * num + to] = travelTime;
-		}
+	QVector< double > distMatrix;
+	if ( !router->GetDistanceTable( NULL, &distMatrix, gps, gps ) ) {
+		qWarning() << "Failed to compute distance table";
+		clearRoute();
+		return;
 	}
 
 	qDebug() << "Routing Mass Computation:" << time.restart() << "ms";
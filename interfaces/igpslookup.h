@@ -46,6 +46,25 @@ public:
 
 	};
 
+	// a coordinate to snap, see GetNearestEdge for the heading penalty
+	struct Position {
+		Position()
+		{
+			headingPenalty = 0;
+			heading = 0;
+		}
+		Position( UnsignedCoordinate coordinate_, double headingPenalty_ = 0, double heading_ = 0 )
+		{
+			coordinate = coordinate_;
+			headingPenalty = headingPenalty_;
+			heading = heading_;
+		}
+
+		UnsignedCoordinate coordinate;
+		double headingPenalty;
+		double heading;
+	};
+
 	virtual ~IGPSLookup() {}
 
 	virtual QString GetName() = 0;
@@ -57,8 +76,14 @@ public:
 	// gets the nearest routing edge; a heading penalty can be applied if the way's orientation differs greatly from the current heading.
 	// heading: degrees from North. headingPenalty: penalty in meters for edge with direction opposite of heading.
 	virtual bool GetNearestEdge( Result* result, const UnsignedCoordinate& coordinate, double radius, double headingPenalty = 0, double heading = 0 ) = 0;
+	// gets up to k distinct routing edges within the radius, sorted by increasing distance including the heading penalty
+	// each edge is reported once with its nearest point, fewer edges are returned if there are no more within the radius
+	virtual bool GetNearestEdges( QVector< Result >* result, const UnsignedCoordinate& coordinate, double radius, unsigned k, double headingPenalty = 0, double heading = 0 ) = 0;
+	// gets the nearest routing edge of every position, considerably faster than one lookup per position for large batches
+	// result[i] and found[i] belong to positions[i], returns whether an edge was found for every position
+	virtual bool GetNearestEdges( QVector< Result >* result, QVector< bool >* found, const QVector< Position >& positions, double radius ) = 0;
 };
 
-Q_DECLARE_INTERFACE( IGPSLookup, "monav.IGPSLookup/1.2" )
+Q_DECLARE_INTERFACE( IGPSLookup, "monav.IGPSLookup/1.4" )
 
 #endif // IGPSLOOKUP_H
@@ -57,6 +57,62 @@ public:
 		unsigned seconds;
 	};
 
+	// counters describing the work done by queries
+	struct Statistics {
+		Statistics()
+		{
+			queries = 0;
+			settledNodesForward = settledNodesBackward = 0;
+			stalledNodes = 0;
+			relaxedEdges = 0;
+			blockCacheHits = blockCacheMisses = 0;
+			pathCacheHits = pathCacheMisses = 0;
+			maxUnpackDepth = 0;
+			searchMilliseconds = unpackMilliseconds = 0;
+		}
+
+		Statistics& operator+=( const Statistics& right )
+		{
+			queries += right.queries;
+			settledNodesForward += right.settledNodesForward;
+			settledNodesBackward += right.settledNodesBackward;
+			stalledNodes += right.stalledNodes;
+			relaxedEdges += right.relaxedEdges;
+			blockCacheHits += right.blockCacheHits;
+			blockCacheMisses += right.blockCacheMisses;
+			pathCacheHits += right.pathCacheHits;
+			pathCacheMisses += right.pathCacheMisses;
+			if ( right.maxUnpackDepth > maxUnpackDepth )
+				maxUnpackDepth = right.maxUnpackDepth;
+			searchMilliseconds += right.searchMilliseconds;
+			unpackMilliseconds += right.unpackMilliseconds;
+			return *this;
+		}
+
+		unsigned long long queries;
+		unsigned long long settledNodesForward;
+		unsigned long long settledNodesBackward;
+		unsigned long long stalledNodes;
+		unsigned long long relaxedEdges;
+		unsigned long long blockCacheHits;
+		unsigned long long blockCacheMisses;
+		unsigned long long pathCacheHits;
+		unsigned long long pathCacheMisses;
+		// deepest nesting of shortcuts unpacked
+		unsigned maxUnpackDepth;
+		// wall time spent searching and unpacking the path
+		double searchMilliseconds;
+		double unpackMilliseconds;
+	};
+
+	// per-query state ( heaps, caches, ... ) of a router
+	// a context may only be used by one thread at a time, but different contexts can be used concurrently
+	// contexts have to be deleted before the data is unloaded
+	class Context {
+	public:
+		virtual ~Context() {}
+	};
+
 	virtual ~IRouter() {}
 
 	virtual QString GetName() = 0;
@@ -68,7 +124,37 @@ public:
 	// computes the route between source and target and returns the distance in second
 	// leaving pathNodes and pathEdges to NULL is supported and should result in significantly better performance
 	// this allows for computing shortest path distance only in a short amount of time
+	// uses the router's default context and therefore must not be called concurrently
 	virtual bool GetRoute( double* distance, QVector< Node>* pathNodes, QVector< Edge >* pathEdges, const IGPSLookup::Result& source, const IGPSLookup::Result& target ) = 0;
+	// creates a new search context for the currently loaded data, returns NULL on failure
+	// the caller takes ownership
+	virtual Context* CreateContext() = 0;
+	// same as above, but uses the search context provided
+	// passing NULL selects the default context
+	virtual bool GetRoute( Context* context, double* distance, QVector< Node>* pathNodes, QVector< Edge >* pathEdges, const IGPSLookup::Result& source, const IGPSLookup::Result& target ) = 0;
+	// same as above, but the road edges in blockedEdges are not traversed in either direction, e.g., closed roads
+	// the edges are identified by GPS lookup results, the route may still start and end on a blocked edge
+	// the route avoiding the edges is not guaranteed to be the shortest one
+	// passing NULL selects the default context
+	virtual bool GetRoute( Context* context, double* distance, QVector< Node>* pathNodes, QVector< Edge >* pathEdges, const IGPSLookup::Result& source, const IGPSLookup::Result& target, const QVector< IGPSLookup::Result >& blockedEdges ) = 0;
+	// computes the shortest route and up to maxAlternatives reasonable alternatives, sorted by their travel times in seconds
+	// alternatives differ substantially from the other routes, take not much longer than the shortest route
+	// and contain no obvious detours, fewer alternatives are returned if there are no more such routes
+	// leaving pathNodes and pathEdges to NULL is supported
+	// passing NULL selects the default context
+	virtual bool GetAlternativeRoutes( Context* context, QVector< double >* distances, QVector< QVector< Node > >* pathNodes, QVector< QVector< Edge > >* pathEdges, const IGPSLookup::Result& source, const IGPSLookup::Result& target, unsigned maxAlternatives ) = 0;
+	// computes the travel times in seconds from all sources to all targets
+	// the result is stored row by row: result[source * targets.size() + target]
+	// unreachable pairs are set to std::numeric_limits< double >::max()
+	// passing NULL selects the default context
+	virtual bool GetDistanceTable( Context* context, QVector< double >* result, const QVector< IGPSLookup::Result >& sources, const QVector< IGPSLookup::Result >& targets ) = 0;
+	// computes all nodes reachable from source within maxSeconds and their travel times in seconds
+	// passing NULL selects the default context
+	virtual bool GetReachableNodes( Context* context, QVector< Node >* nodes, QVector< double >* seconds, const IGPSLookup::Result& source, double maxSeconds ) = 0;
+	// returns the statistics of the last query and the sum over all queries since the last reset
+	// either pointer may be NULL, passing NULL as context selects the default context
+	virtual bool GetStatistics( Context* context, Statistics* lastQuery, Statistics* total ) = 0;
+	virtual bool ResetStatistics( Context* context ) = 0;
 	// translate a name ID into the corresponding string
 	virtual bool GetName( QString* result, unsigned name ) = 0;
 	// translate a list of name IDs into the corresponding strings
@@ -79,6 +165,6 @@ public:
 	virtual bool GetTypes( QVector< QString >* result, QVector< unsigned > types ) = 0;
 };
 
-Q_DECLARE_INTERFACE( IRouter, "monav.IRouter/1.1" )
+Q_DECLARE_INTERFACE( IRouter, "monav.IRouter/1.7" )
 
 #endif // IROUTER_H
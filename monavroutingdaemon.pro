@@ -1,6 +1,8 @@
 TEMPLATE = subdirs
-SUBDIRS = routingdaemon plugins daemontest routingserver
+SUBDIRS = routingdaemon plugins daemontest routingserver benchrouter
 routingdaemon.depends = plugins
 plugins.file = plugins/routingdaemon_plugins.pro
 daemontest.file = routingdaemon/daemontest.pro
 routingserver.file = routingdaemon/routingserver.pro
+benchrouter.depends = plugins
+benchrouter.file = tools/monav-bench-router/monav-bench-router.pro
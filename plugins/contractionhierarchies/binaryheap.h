@@ -23,6 +23,7 @@ along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
 //Not compatible with non contiguous node ids
 
 #include <cassert>
+#include <cstddef>
 #include <vector>
 #include <QHash>
 
@@ -74,6 +75,72 @@ class MapStorage {
 
 };
 
+// dense index that can be cleared in constant time:
+// each entry remembers the generation it was written in, clear() just starts a new generation
+// falls back to a sparse hash if the id range is unknown ( size == 0 ), e.g., to save memory on small devices
+template< typename NodeID, typename Key >
+class GenerationStorage {
+	public:
+
+		GenerationStorage( size_t size ) :
+				entries( NULL ), entryCount( size ), generation( 1 )
+		{
+			if ( size == 0 )
+				return;
+			entries = new Entry[size];
+			resetGenerations();
+		}
+
+		~GenerationStorage()
+		{
+			delete[] entries;
+		}
+
+		Key &operator[]( NodeID node )
+		{
+			if ( entries == NULL )
+				return nodes[node];
+			assert( ( size_t ) node < entryCount );
+			Entry& entry = entries[node];
+			// stale entries behave like fresh entries of a sparse storage
+			if ( entry.generation != generation ) {
+				entry.generation = generation;
+				entry.key = Key();
+			}
+			return entry.key;
+		}
+
+		void clear()
+		{
+			if ( entries == NULL ) {
+				nodes.clear();
+				return;
+			}
+			generation++;
+			// the counter wrapped around => old stamps could become valid again
+			if ( generation == 0 )
+				resetGenerations();
+		}
+
+	private:
+		struct Entry {
+			Key key;
+			unsigned generation;
+		};
+
+		void resetGenerations()
+		{
+			for ( size_t i = 0; i < entryCount; i++ )
+				entries[i].generation = 0;
+			generation = 1;
+		}
+
+		Entry* entries;
+		size_t entryCount;
+		unsigned generation;
+		QHash< NodeID, Key > nodes;
+};
+
 template < typename NodeID, typename Key, typename Weight, typename Data, typename IndexStorage = ArrayStorage< NodeID, Key > >
 class BinaryHeap {
 	private:
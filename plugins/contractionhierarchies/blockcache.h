@@ -22,12 +22,317 @@ along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <QFile>
 #include <QHash>
+#include <QSet>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QThread>
 #include <limits>
+#include <algorithm>
+#include <vector>
 #include <QtDebug>
+#ifdef Q_OS_LINUX
+	#include <fcntl.h>
+#endif
+
+// the first blocks of a file, loaded once and never evicted
+// blocks are loaded in ascending order and become visible one by one,
+// so that read() can run in a background thread while other threads already use the loaded blocks
+template< class Block >
+class PinnedBlocks {
+
+public:
+
+	PinnedBlocks()
+	{
+		m_buffer = NULL;
+		m_blocks = NULL;
+		m_count = 0;
+		m_blockSize = 0;
+	}
+
+	~PinnedBlocks()
+	{
+		unload();
+	}
+
+	bool load( const QString& filename, unsigned blockSize, unsigned count )
+	{
+		unload();
+		m_blockSize = blockSize;
+		m_inputFile.setFileName( filename );
+		if ( !m_inputFile.open( QIODevice::ReadOnly | QIODevice::Unbuffered ) ) {
+			qCritical() << "failed to open file:" << m_inputFile.fileName();
+			return false;
+		}
+		m_count = std::min( count, ( unsigned ) ( ( m_inputFile.size() + m_blockSize - 1 ) / m_blockSize ) );
+		// the bit readers may read a few bytes beyond the last block
+		m_buffer = new unsigned char[( size_t ) m_count * m_blockSize + 8];
+		m_blocks = new Block[m_count];
+		return true;
+	}
+
+	void unload()
+	{
+		m_inputFile.close();
+		if ( m_buffer != NULL )
+			delete[] m_buffer;
+		if ( m_blocks != NULL )
+			delete[] m_blocks;
+		m_buffer = NULL;
+		m_blocks = NULL;
+		m_count = 0;
+		m_loaded = 0;
+		m_abort = 0;
+	}
+
+	// reads all blocks, returns early if abort() is called
+	void read()
+	{
+		for ( unsigned block = m_loaded; block < m_count; block++ ) {
+			if ( m_abort != 0 )
+				return;
+			m_inputFile.seek( ( long long ) block * m_blockSize );
+			m_inputFile.read( ( char* ) m_buffer + ( size_t ) block * m_blockSize, m_blockSize );
+			m_blocks[block].load( block, m_buffer + ( size_t ) block * m_blockSize );
+			m_loaded.fetchAndStoreRelease( block + 1 );
+		}
+	}
+
+	void abort()
+	{
+		m_abort = 1;
+	}
+
+	// returns NULL if the block is not pinned ( yet )
+	const Block* getBlock( unsigned block ) const
+	{
+		if ( block >= m_count )
+			return NULL;
+		if ( block >= ( unsigned ) const_cast< QAtomicInt& >( m_loaded ).fetchAndAddAcquire( 0 ) )
+			return NULL;
+		return m_blocks + block;
+	}
+
+	bool contains( unsigned block ) const
+	{
+		return block < m_count;
+	}
+
+	size_t size() const
+	{
+		return ( size_t ) m_count * m_blockSize;
+	}
+
+private:
+
+	unsigned char* m_buffer;
+	Block* m_blocks;
+	unsigned m_count;
+	unsigned m_blockSize;
+	QAtomicInt m_loaded;
+	QAtomicInt m_abort;
+	QFile m_inputFile;
+};
+
+// a block cache shared by several BlockCache instances, e.g., one per query thread
+// the index is split into shards with a lock each, so that threads rarely contend on hits,
+// and blocks are evicted by the CLOCK algorithm instead of maintaining a strict LRU list
+// the blocks are read by the BlockCache instances using their own file handles
+// every user keeps its most recently accessed blocks pinned, pinned blocks are never evicted
+template< class Block >
+class SharedBlockCache {
+
+public:
+
+	enum { PinnedPerUser = 32, Shards = 16 };
+
+	SharedBlockCache()
+	{
+		m_slots = NULL;
+		m_buffer = NULL;
+		m_numberOfSlots = 0;
+		m_blockSize = 0;
+	}
+
+	~SharedBlockCache()
+	{
+		unload();
+	}
+
+	bool load( unsigned cacheBlocks, unsigned blockSize )
+	{
+		unload();
+		// every user pins up to PinnedPerUser blocks, at least one user has to fit
+		m_numberOfSlots = std::max( cacheBlocks, ( unsigned ) PinnedPerUser * 2 );
+		m_blockSize = blockSize;
+		m_buffer = new unsigned char[( size_t ) m_numberOfSlots * m_blockSize + 8];
+		m_slots = new Slot[m_numberOfSlots];
+		for ( unsigned slot = 0; slot < m_numberOfSlots; slot++ )
+			m_slots[slot].id = noBlock;
+		m_hand = 0;
+		m_users = 0;
+		return true;
+	}
+
+	void unload()
+	{
+		if ( m_buffer != NULL )
+			delete[] m_buffer;
+		if ( m_slots != NULL )
+			delete[] m_slots;
+		m_buffer = NULL;
+		m_slots = NULL;
+		m_numberOfSlots = 0;
+		for ( int shard = 0; shard < Shards; shard++ )
+			m_shards[shard].index.clear();
+	}
+
+	// reserves the pins of a new user, returns false if pinned blocks could fill more than half of the cache
+	bool attach()
+	{
+		int users = m_users.fetchAndAddOrdered( 1 ) + 1;
+		if ( ( unsigned ) users * PinnedPerUser * 2 > m_numberOfSlots ) {
+			m_users.fetchAndAddOrdered( -1 );
+			return false;
+		}
+		return true;
+	}
+
+	void detach()
+	{
+		m_users.fetchAndAddOrdered( -1 );
+	}
+
+	// returns the slot holding the block and pins it, -1 if the block is not cached
+	int find( unsigned block )
+	{
+		Shard& shard = m_shards[block % Shards];
+		QMutexLocker locker( &shard.mutex );
+		int slot = shard.index.value( block, -1 );
+		if ( slot != -1 ) {
+			m_slots[slot].pins.fetchAndAddOrdered( 1 );
+			m_slots[slot].referenced = 1;
+		}
+		return slot;
+	}
+
+	bool contains( unsigned block )
+	{
+		Shard& shard = m_shards[block % Shards];
+		QMutexLocker locker( &shard.mutex );
+		return shard.index.contains( block );
+	}
+
+	// evicts a block and returns its slot pinned by the caller, who has to fill it and call insert
+	int allocate()
+	{
+		unsigned steps = 0;
+		while ( true ) {
+			if ( ++steps % ( 4 * m_numberOfSlots ) == 0 )
+				QThread::yieldCurrentThread();
+			const int slot = ( unsigned ) m_hand.fetchAndAddRelaxed( 1 ) % m_numberOfSlots;
+			Slot& candidate = m_slots[slot];
+			if ( candidate.pins != 0 )
+				continue;
+			// recently used blocks get a second chance
+			if ( candidate.referenced.fetchAndStoreRelaxed( 0 ) != 0 )
+				continue;
+
+			const unsigned block = candidate.id;
+			if ( block == noBlock ) {
+				if ( !candidate.pins.testAndSetOrdered( 0, 1 ) )
+					continue;
+				if ( candidate.id == noBlock )
+					return slot;
+				release( slot );
+				continue;
+			}
+
+			// users only pin blocks while holding the lock of their shard
+			Shard& shard = m_shards[block % Shards];
+			QMutexLocker locker( &shard.mutex );
+			if ( !candidate.pins.testAndSetOrdered( 0, 1 ) )
+				continue;
+			if ( candidate.id != block ) {
+				release( slot );
+				continue;
+			}
+			shard.index.remove( block );
+			candidate.id = noBlock;
+			return slot;
+		}
+	}
+
+	// makes a filled slot visible, returns the slot holding the block afterwards and pinned by the caller
+	// the slot differs if another user loaded the block in the meantime
+	int insert( unsigned block, int slot )
+	{
+		Shard& shard = m_shards[block % Shards];
+		QMutexLocker locker( &shard.mutex );
+		int existing = shard.index.value( block, -1 );
+		if ( existing != -1 ) {
+			m_slots[existing].pins.fetchAndAddOrdered( 1 );
+			m_slots[existing].referenced = 1;
+			locker.unlock();
+			release( slot );
+			return existing;
+		}
+		m_slots[slot].id = block;
+		m_slots[slot].referenced = 1;
+		shard.index.insert( block, slot );
+		return slot;
+	}
+
+	void release( int slot )
+	{
+		m_slots[slot].pins.fetchAndAddOrdered( -1 );
+	}
+
+	unsigned char* buffer( int slot )
+	{
+		return m_buffer + ( size_t ) slot * m_blockSize;
+	}
+
+	Block* block( int slot )
+	{
+		return &m_slots[slot].block;
+	}
+
+private:
+
+	static const unsigned noBlock = ~0u;
+
+	struct Slot {
+		Block block;
+		// the block's id, noBlock for free slots, only changed by the user that pinned the slot in allocate
+		unsigned id;
+		QAtomicInt pins;
+		// CLOCK reference bit
+		QAtomicInt referenced;
+	};
+
+	struct Shard {
+		QMutex mutex;
+		QHash< unsigned, int > index;
+	};
+
+	Slot* m_slots;
+	unsigned char* m_buffer;
+	unsigned m_numberOfSlots;
+	unsigned m_blockSize;
+	Shard m_shards[Shards];
+	QAtomicInt m_hand;
+	QAtomicInt m_users;
+};
 
 // Block must have member function / variables:
 // variable id => block id
+// variable buffer => pointer to the block's data, NULL if not loaded
 // function void load( const unsigned char* buffer )
+// function void readAheadBlocks( std::vector< unsigned >* result ) const => blocks likely to be accessed next
+// pinned blocks are served from a shared PinnedBlocks instead of the cache
+// the file can either be read into an LRU cache of cacheBlocks blocks, into a SharedBlockCache
+// or be memory mapped as a whole, which avoids copies and cache maintenance
 template< class Block >
 class BlockCache{
 
@@ -38,9 +343,30 @@ public:
 		m_cache = NULL;
 		m_LRU = NULL;
 		m_blocks = NULL;
+		m_mapped = NULL;
+		m_numberOfBlocks = 0;
+		m_prefetch = false;
+		m_pinned = NULL;
+		m_shared = NULL;
+		m_hits = 0;
+		m_misses = 0;
 	}
 
-	bool load( const QString& filename, int cacheBlocks, unsigned blockSize )
+	// statistics of the read-ahead of adjacent blocks
+	struct PrefetchStatistics {
+		unsigned long long issued;
+		// prefetched blocks that were loaded later on
+		unsigned long long used;
+		// prefetched blocks that were not loaded in time
+		unsigned long long wasted;
+
+		PrefetchStatistics()
+		{
+			issued = used = wasted = 0;
+		}
+	};
+
+	bool load( const QString& filename, int cacheBlocks, unsigned blockSize, bool mapFile = false )
 	{
 		m_cacheBlocks = cacheBlocks;
 		m_blockSize = blockSize;
@@ -50,6 +376,26 @@ public:
 			return false;
 		}
 
+		// the last block may be incomplete
+		m_numberOfBlocks = ( m_inputFile.size() + m_blockSize - 1 ) / m_blockSize;
+
+		if ( mapFile ) {
+			m_mapped = m_inputFile.map( 0, m_inputFile.size() );
+			if ( m_mapped != NULL ) {
+				// blocks are parsed on first access
+				m_blocks = new Block[m_numberOfBlocks]();
+				// the decoder reads ahead, which must not leave the mapping at the end of the last block
+				// it is served from a copy with a block of slack like the cached blocks
+				if ( m_numberOfBlocks > 0 ) {
+					const size_t tailBegin = ( size_t ) ( m_numberOfBlocks - 1 ) * m_blockSize;
+					m_mappedTail.assign( m_mapped + tailBegin, m_mapped + m_inputFile.size() );
+					m_mappedTail.resize( 2 * m_blockSize, 0 );
+				}
+				return true;
+			}
+			qWarning() << "failed to map file, falling back to the block cache:" << m_inputFile.fileName();
+		}
+
 		m_cache = new unsigned char[( m_cacheBlocks + 1 ) * m_blockSize];
 		m_LRU = new LRUEntry[m_cacheBlocks];
 		m_blocks = new Block[m_cacheBlocks];
@@ -63,6 +409,19 @@ public:
 
 	void unload ( )
 	{
+		if ( m_shared != NULL ) {
+			for ( unsigned i = 0; i < m_sharedPins.size(); i++ ) {
+				if ( m_sharedPins[i] != -1 )
+					m_shared->release( m_sharedPins[i] );
+			}
+			m_sharedPins.clear();
+			m_shared->detach();
+		}
+		m_shared = NULL;
+		if ( m_mapped != NULL )
+			m_inputFile.unmap( m_mapped );
+		m_mapped = NULL;
+		std::vector< unsigned char >().swap( m_mappedTail );
 		m_inputFile.close();
 		if ( m_cache != NULL )
 			delete[] m_cache;
@@ -73,21 +432,152 @@ public:
 		m_cache = NULL;
 		m_LRU = NULL;
 		m_blocks = NULL;
+		m_numberOfBlocks = 0;
+		m_index.clear();
+		if ( m_prefetchStatistics.issued > 0 ) {
+			m_prefetchStatistics.wasted += m_prefetched.size();
+			qDebug() << "prefetched blocks:" << m_prefetchStatistics.issued << "used:" << m_prefetchStatistics.used << "wasted:" << m_prefetchStatistics.wasted;
+		}
+		m_prefetched.clear();
+		m_prefetchStatistics = PrefetchStatistics();
+		m_pinned = NULL;
+	}
+
+	// advise the operating system to read the adjacent blocks of each loaded block in the background
+	// only supported on Linux and if the file is not memory mapped
+	void setPrefetch( bool prefetch )
+	{
+		m_prefetch = prefetch;
+	}
+
+	PrefetchStatistics prefetchStatistics() const
+	{
+		return m_prefetchStatistics;
+	}
+
+	// number of getBlock calls that did / did not have to read from the file
+	unsigned long long hits() const
+	{
+		return m_hits;
+	}
+
+	unsigned long long misses() const
+	{
+		return m_misses;
+	}
+
+	// pinned has to stay valid until the cache is unloaded
+	void setPinned( const PinnedBlocks< Block >* pinned )
+	{
+		m_pinned = pinned;
+	}
+
+	// replaces the private cache with a shared one, which has to stay valid until the cache is unloaded
+	// returns false and keeps the private cache if the file is mapped or the shared cache has no room for another user
+	bool setShared( SharedBlockCache< Block >* shared )
+	{
+		if ( m_mapped != NULL || m_shared != NULL )
+			return false;
+		if ( !shared->attach() )
+			return false;
+		m_shared = shared;
+		m_sharedPins.assign( SharedBlockCache< Block >::PinnedPerUser, -1 );
+		m_nextPin = 0;
+		delete[] m_cache;
+		delete[] m_LRU;
+		delete[] m_blocks;
+		m_cache = NULL;
+		m_LRU = NULL;
+		m_blocks = NULL;
 		m_index.clear();
+		return true;
+	}
+
+	unsigned numberOfBlocks() const
+	{
+		return m_numberOfBlocks;
 	}
 
 	const Block* getBlock( unsigned block )
 	{
+		if ( m_pinned != NULL ) {
+			const Block* pinned = m_pinned->getBlock( block );
+			if ( pinned != NULL ) {
+				m_hits++;
+				return pinned;
+			}
+		}
+
+		if ( m_mapped != NULL ) {
+			assert( block < m_numberOfBlocks );
+			Block* result = m_blocks + block;
+			if ( result->buffer == NULL ) {
+				m_misses++;
+				if ( block == m_numberOfBlocks - 1 )
+					result->load( block, &m_mappedTail[0] );
+				else
+					result->load( block, m_mapped + ( size_t ) block * m_blockSize );
+			} else {
+				m_hits++;
+			}
+			return result;
+		}
+
+		if ( m_shared != NULL )
+			return getSharedBlock( block );
+
 		int cacheID = m_index.value( block, -1 );
-		if ( cacheID == -1 )
+		if ( cacheID == -1 ) {
+			m_misses++;
 			return loadBlock( block );
+		}
 
+		m_hits++;
 		useBlock( cacheID );
 		return m_blocks + cacheID;
 	}
 
 private:
 
+	const Block* getSharedBlock( unsigned block )
+	{
+		int slot = m_shared->find( block );
+		if ( slot != -1 ) {
+			m_hits++;
+		} else {
+			m_misses++;
+			slot = m_shared->allocate();
+			unsigned char* buffer = m_shared->buffer( slot );
+			m_inputFile.seek( ( long long ) block * m_blockSize );
+			m_inputFile.read( ( char* ) buffer, m_blockSize );
+			m_shared->block( slot )->load( block, buffer );
+			slot = m_shared->insert( block, slot );
+			if ( m_prefetch ) {
+				if ( m_prefetched.remove( block ) )
+					m_prefetchStatistics.used++;
+				prefetchAdjacent( *m_shared->block( slot ) );
+			}
+		}
+
+		// the returned block stays valid while it is among the most recently accessed ones
+		if ( std::find( m_sharedPins.begin(), m_sharedPins.end(), slot ) != m_sharedPins.end() ) {
+			m_shared->release( slot );
+		} else {
+			if ( m_sharedPins[m_nextPin] != -1 )
+				m_shared->release( m_sharedPins[m_nextPin] );
+			m_sharedPins[m_nextPin] = slot;
+			m_nextPin = ( m_nextPin + 1 ) % m_sharedPins.size();
+		}
+		return m_shared->block( slot );
+	}
+
+	bool isCached( unsigned block )
+	{
+		if ( m_shared != NULL )
+			return m_shared->contains( block );
+		return m_index.contains( block );
+	}
+
 	const Block* loadBlock( unsigned block )
 	{
 		int freeBlock = m_loadedCount;
@@ -115,9 +605,41 @@ private:
 		m_blocks[freeBlock].load( block, m_cache + freeBlock * m_blockSize );
 		m_index[block] = freeBlock;
 
+		if ( m_prefetch ) {
+			if ( m_prefetched.remove( block ) )
+				m_prefetchStatistics.used++;
+			prefetchAdjacent( m_blocks[freeBlock] );
+		}
+
 		return m_blocks + freeBlock;
 	}
 
+	void prefetchAdjacent( const Block& block )
+	{
+#ifdef Q_OS_LINUX
+		m_adjacent.clear();
+		block.readAheadBlocks( &m_adjacent );
+		for ( unsigned i = 0; i < m_adjacent.size(); i++ ) {
+			unsigned adjacent = m_adjacent[i];
+			if ( adjacent >= m_numberOfBlocks || isCached( adjacent ) || m_prefetched.contains( adjacent ) )
+				continue;
+			if ( m_pinned != NULL && m_pinned->contains( adjacent ) )
+				continue;
+			// the kernel reads the range into the page cache asynchronously
+			posix_fadvise( m_inputFile.handle(), ( off_t ) adjacent * m_blockSize, m_blockSize, POSIX_FADV_WILLNEED );
+			m_prefetched.insert( adjacent );
+			m_prefetchStatistics.issued++;
+		}
+		// prefetched blocks that were not used for a long time have most likely been dropped again
+		if ( m_prefetched.size() > m_cacheBlocks ) {
+			m_prefetchStatistics.wasted += m_prefetched.size();
+			m_prefetched.clear();
+		}
+#else
+		Q_UNUSED( block );
+#endif
+	}
+
 	void useBlock( int cacheID )
 	{
 		assert( m_firstLoaded != -1 );
@@ -149,13 +671,28 @@ private:
 	Block* m_blocks;
 	LRUEntry* m_LRU;
 	unsigned char* m_cache;
+	unsigned char* m_mapped;
+	// padded copy of the last block of the mapped file
+	std::vector< unsigned char > m_mappedTail;
 	int m_firstLoaded;
 	int m_lastLoaded;
 	int m_loadedCount;
 	int m_cacheBlocks;
+	unsigned m_numberOfBlocks;
 	unsigned m_blockSize;
 	QFile m_inputFile;
 	QHash< unsigned, int > m_index;
+	bool m_prefetch;
+	QSet< unsigned > m_prefetched;
+	std::vector< unsigned > m_adjacent;
+	PrefetchStatistics m_prefetchStatistics;
+	const PinnedBlocks< Block >* m_pinned;
+	SharedBlockCache< Block >* m_shared;
+	// slots of the shared cache pinned by this user
+	std::vector< int > m_sharedPins;
+	unsigned m_nextPin;
+	unsigned long long m_hits;
+	unsigned long long m_misses;
 
 };
 
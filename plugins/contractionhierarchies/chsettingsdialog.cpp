@@ -16,6 +16,11 @@ CHSettingsDialog::~CHSettingsDialog()
 bool CHSettingsDialog::readSettings( const ContractionHierarchies::Settings& settings )
 {
 	m_ui->blockSize->setValue( settings.blockSize );
+	m_ui->turnCosts->setChecked( settings.turnCosts );
+	m_ui->customizable->setChecked( settings.customizable );
+	m_ui->weightFile->setText( settings.weightFile );
+	m_ui->hubLabels->setChecked( settings.hubLabels );
+	m_ui->serverLayout->setChecked( settings.serverLayout );
 	return true;
 }
 
@@ -24,5 +29,10 @@ bool CHSettingsDialog::fillSettings( ContractionHierarchies::Settings* settings
 	if ( settings == NULL )
 		return false;
 	settings->blockSize = m_ui->blockSize->value();
+	settings->turnCosts = m_ui->turnCosts->isChecked();
+	settings->customizable = m_ui->customizable->isChecked();
+	settings->weightFile = m_ui->weightFile->text();
+	settings->hubLabels = m_ui->hubLabels->isChecked();
+	settings->serverLayout = m_ui->serverLayout->isChecked();
 	return true;
 }
@@ -23,9 +23,12 @@ along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
 #include "interfaces/irouter.h"
 #include "utils/coordinates.h"
 #include "utils/bithelpers.h"
+#include "utils/qthelpers.h"
 #include "blockcache.h"
 #include <QString>
 #include <QFile>
+#include <QCache>
+#include <QSharedPointer>
 #include <algorithm>
 #include <vector>
 
@@ -35,6 +38,10 @@ public :
 
 		typedef unsigned NodeIterator;
 
+		// original edges with this distance belong to closed roads
+		// the file stores them with a direction, they are decoded without one to keep them out of all searches
+		enum { ClosedDistance = 1 << 24 };
+
 protected:
 
 	//TYPES
@@ -84,6 +91,11 @@ protected:
 		{
 			CompressedGraph::loadBlock( this, id, buffer );
 		}
+
+		void readAheadBlocks( std::vector< unsigned >* result ) const
+		{
+			CompressedGraph::readAdjacentBlocks( *this, result );
+		}
 	};
 
 	struct PathBlock {
@@ -155,6 +167,48 @@ protected:
 			CompressedGraph::loadPathBlock( this, id, buffer );
 		}
 
+		void readAheadBlocks( std::vector< unsigned >* /*result*/ ) const
+		{
+		}
+
+	};
+
+	// fully decoded edges of a block, stored as struct of arrays
+	struct DecodedBlock {
+
+		enum Flags {
+			Shortcut = 1, Forward = 2, Backward = 4, Unpacked = 8, Reversed = 16, BranchingPossible = 32
+		};
+
+		// first edge of each internal node, nodeCount + 1 entries
+		std::vector< unsigned > firstEdges;
+		std::vector< NodeIterator > targets;
+		std::vector< unsigned > distances;
+		std::vector< unsigned char > flags;
+		// shortcut middle or name ID
+		std::vector< unsigned > data;
+		std::vector< unsigned > types;
+		std::vector< unsigned > paths;
+
+		int size() const
+		{
+			return sizeof( DecodedBlock ) + firstEdges.size() * sizeof( unsigned ) + targets.size() * ( sizeof( NodeIterator ) + 4 * sizeof( unsigned ) + 1 );
+		}
+	};
+
+	// keeps a decoded block alive after the shared cache evicted it
+	typedef QSharedPointer< const DecodedBlock > DecodedReference;
+
+	// fixed-width edge record of the server layout, four of them fill a cache line
+	struct ServerEdge {
+		NodeIterator target;
+		unsigned distance;
+		// shortcut middle, path or name ID, depending on the flags
+		unsigned data;
+		unsigned short type;
+		// DecodedBlock::Flags
+		unsigned char flags;
+		unsigned char padding;
 	};
 
 public:
@@ -215,16 +269,34 @@ public:
 		NodeIterator middle() const { return m_data.middle; }
 		unsigned distance() const { return m_data.distance; }
 		IRouter::Edge description() const { return IRouter::Edge( m_data.description.nameID, m_data.description.branchingPossible, m_data.description.type, 1, ( m_data.distance + 5 ) / 10 ); }
+		// tells original edges between the same nodes apart: their path, or their name if they have none
+		unsigned originalID() const { return m_data.unpacked ? m_data.path : ( unsigned ) m_data.description.nameID; }
 #ifdef NDEBUG
 	private:
 #endif
 
 		EdgeIterator( unsigned source, const Block& block, unsigned position, unsigned end ) :
-				m_block( &block ), m_source( source ), m_position( position ), m_end( end )
+				m_block( &block ), m_decoded( NULL ), m_server( NULL ), m_source( source ), m_position( position ), m_end( end )
+		{
+		}
+
+		// positions are edge indices instead of bit positions
+		// the iterator holds a reference to the decoded block, which other graphs may evict from the shared cache meanwhile
+		EdgeIterator( unsigned source, const Block& block, const DecodedReference& decoded, unsigned position, unsigned end ) :
+				m_block( &block ), m_decoded( decoded.data() ), m_decodedReference( decoded ), m_server( NULL ), m_source( source ), m_position( position ), m_end( end )
+		{
+		}
+
+		// positions are indices into the server layout's edge records
+		EdgeIterator( unsigned source, const ServerEdge* edges, unsigned position, unsigned end ) :
+				m_block( NULL ), m_decoded( NULL ), m_server( edges ), m_source( source ), m_position( position ), m_end( end )
 		{
 		}
 
 		const Block* m_block;
+		const DecodedBlock* m_decoded;
+		DecodedReference m_decodedReference;
+		const ServerEdge* m_server;
 		NodeIterator m_target;
 		NodeIterator m_source;
 		unsigned m_position;
@@ -249,11 +321,210 @@ public:
 		} m_data;
 	};
 
+	// the first blocks of the graph and its paths, i.e., the top of the hierarchy, kept in memory permanently
+	// can be shared by several graphs loaded from the same files
+	class PinnedData {
+
+		friend class CompressedGraph;
+
+	public:
+
+		// pins up to budget bytes, split between edges and paths according to their file sizes
+		bool load( QString filename, unsigned long long budget )
+		{
+			QFile settingsFile( filename + "_config" );
+			if ( !settingsFile.open( QIODevice::ReadOnly ) ) {
+				qCritical() << "failed to open file:" << settingsFile.fileName();
+				return false;
+			}
+			GlobalSettings settings;
+			settings.read( settingsFile );
+
+			unsigned long long edgesSize = QFile( filename + "_edges" ).size();
+			unsigned long long pathsSize = QFile( filename + "_paths" ).size();
+			unsigned long long edgesBudget = budget;
+			if ( edgesSize + pathsSize > budget )
+				edgesBudget = budget * ( double ) edgesSize / ( edgesSize + pathsSize );
+			unsigned long long pathsBudget = budget - std::min( budget, edgesBudget );
+
+			if ( !m_blocks.load( filename + "_edges", settings.blockSize, edgesBudget / settings.blockSize ) )
+				return false;
+			if ( !m_paths.load( filename + "_paths", settings.blockSize, pathsBudget / settings.blockSize ) )
+				return false;
+			return true;
+		}
+
+		// reads the pinned blocks, can be run in a background thread
+		void read()
+		{
+			m_blocks.read();
+			m_paths.read();
+		}
+
+		// makes a running read() return early
+		void abort()
+		{
+			m_blocks.abort();
+			m_paths.abort();
+		}
+
+		size_t size() const
+		{
+			return m_blocks.size() + m_paths.size();
+		}
+
+	private:
+
+		PinnedBlocks< Block > m_blocks;
+		PinnedBlocks< PathBlock > m_paths;
+	};
+
+	// a block cache for the graph and its paths shared by several graphs loaded from the same files
+	// lets query threads share one memory budget instead of caching the same blocks each
+	class SharedCache {
+
+		friend class CompressedGraph;
+
+	public:
+
+		// caches up to budget bytes, split evenly between edges and paths like the private caches
+		bool load( QString filename, unsigned long long budget )
+		{
+			QFile settingsFile( filename + "_config" );
+			if ( !settingsFile.open( QIODevice::ReadOnly ) ) {
+				qCritical() << "failed to open file:" << settingsFile.fileName();
+				return false;
+			}
+			GlobalSettings settings;
+			settings.read( settingsFile );
+
+			if ( !m_blocks.load( budget / settings.blockSize / 2 + 1, settings.blockSize ) )
+				return false;
+			if ( !m_paths.load( budget / settings.blockSize / 2 + 1, settings.blockSize ) )
+				return false;
+			return true;
+		}
+
+	private:
+
+		SharedBlockCache< Block > m_blocks;
+		SharedBlockCache< PathBlock > m_paths;
+	};
+
+	// frequently accessed blocks in decoded form, shared by several graphs loaded from the same files
+	// so that every hot block is decoded once per process and the budget is not multiplied by the number of query threads
+	// the index is split into shards with a lock each, evicted blocks stay valid while a graph still references them
+	class DecodedCache {
+
+		friend class CompressedGraph;
+
+	public:
+
+		enum { Shards = 16, DecodeThreshold = 8 };
+
+		DecodedCache()
+		{
+			m_accesses = NULL;
+			m_numberOfBlocks = 0;
+		}
+
+		~DecodedCache()
+		{
+			unload();
+		}
+
+		// caches up to budget bytes of decoded blocks
+		bool load( QString filename, unsigned long long budget )
+		{
+			unload();
+			QFile settingsFile( filename + "_config" );
+			if ( !settingsFile.open( QIODevice::ReadOnly ) ) {
+				qCritical() << "failed to open file:" << settingsFile.fileName();
+				return false;
+			}
+			GlobalSettings settings;
+			settings.read( settingsFile );
+			m_numberOfBlocks = ( QFile( filename + "_edges" ).size() + settings.blockSize - 1 ) / settings.blockSize;
+			m_accesses = new QAtomicInt[m_numberOfBlocks];
+			for ( int shard = 0; shard < Shards; shard++ )
+				m_shards[shard].blocks.setMaxCost( std::min( budget / Shards, ( unsigned long long ) std::numeric_limits< int >::max() ) );
+			return true;
+		}
+
+		void unload()
+		{
+			for ( int shard = 0; shard < Shards; shard++ )
+				m_shards[shard].blocks.clear();
+			if ( m_accesses != NULL )
+				delete[] m_accesses;
+			m_accesses = NULL;
+			m_numberOfBlocks = 0;
+		}
+
+	private:
+
+		typedef DecodedReference Reference;
+
+		Reference find( unsigned block )
+		{
+			Shard& shard = m_shards[block % Shards];
+			QMutexLocker locker( &shard.mutex );
+			const Reference* reference = shard.blocks.object( block );
+			if ( reference == NULL )
+				return Reference();
+			return *reference;
+		}
+
+		// counts an access, blocks are only decoded once they were accessed several times
+		bool hot( unsigned block )
+		{
+			if ( block >= m_numberOfBlocks )
+				return false;
+			if ( ( int ) m_accesses[block] >= DecodeThreshold )
+				return true;
+			m_accesses[block].fetchAndAddRelaxed( 1 );
+			return false;
+		}
+
+		// returns the cached block, which differs from the decoded one if another graph inserted it in the meantime
+		// a null reference if the block exceeds the budget
+		Reference insert( unsigned block, DecodedBlock* decoded )
+		{
+			Reference reference( decoded );
+			Shard& shard = m_shards[block % Shards];
+			QMutexLocker locker( &shard.mutex );
+			const Reference* existing = shard.blocks.object( block );
+			if ( existing != NULL )
+				return *existing;
+			// the cache deletes blocks exceeding its budget right away
+			if ( !shard.blocks.insert( block, new Reference( reference ), decoded->size() ) ) {
+				m_accesses[block] = 0;
+				return Reference();
+			}
+			return reference;
+		}
+
+		struct Shard {
+			QMutex mutex;
+			QCache< unsigned, Reference > blocks;
+		};
+
+		Shard m_shards[Shards];
+		// saturating access counters used to find hot blocks
+		QAtomicInt* m_accesses;
+		unsigned m_numberOfBlocks;
+	};
+
 	// FUNCTIONS
 
 	CompressedGraph()
 	{
 		m_loaded = false;
+		m_nextRecentDecoded = 0;
+		setDecodedCache( NULL );
+		m_serverFirstEdges = NULL;
+		m_serverEdges = NULL;
+		m_serverCoordinates = NULL;
 	}
 
 	~CompressedGraph()
@@ -262,7 +533,8 @@ public:
 			unloadGraph();
 	}
 
-	bool loadGraph( QString filename, unsigned cacheSize )
+	// mapFiles memory maps the graph instead of caching cacheSize bytes of it
+	bool loadGraph( QString filename, unsigned cacheSize, bool mapFiles = false )
 	{
 		if ( m_loaded )
 			unloadGraph();
@@ -272,9 +544,9 @@ public:
 			return false;
 		}
 		m_settings.read( settingsFile );
-		if ( !m_blockCache.load( filename + "_edges", cacheSize / m_settings.blockSize / 2 + 1, m_settings.blockSize ) )
+		if ( !m_blockCache.load( filename + "_edges", cacheSize / m_settings.blockSize / 2 + 1, m_settings.blockSize, mapFiles ) )
 			return false;
-		if ( !m_pathCache.load( filename + "_paths", cacheSize / m_settings.blockSize / 2 + 1, m_settings.blockSize ) )
+		if ( !m_pathCache.load( filename + "_paths", cacheSize / m_settings.blockSize / 2 + 1, m_settings.blockSize, mapFiles ) )
 			return false;
 		m_loaded = true;
 		return true;
@@ -282,19 +554,170 @@ public:
 
 	void unloadGraph()
 	{
+		unloadServerLayout();
 		m_blockCache.unload();
 		m_pathCache.unload();
+		setDecodedCache( NULL );
+	}
+
+	// the server layout stores the graph uncompressed: a first edge array indexed by node ID,
+	// fixed-width edge records and plain coordinates. It replaces the blocks for edges() and node()
+	// and needs no bit decoding at all. The graph has to be loaded already.
+	bool loadServerLayout( QString filename )
+	{
+		unloadServerLayout();
+		m_serverFirstEdgesFile.setFileName( filename + "_server_first_edges" );
+		m_serverEdgesFile.setFileName( filename + "_server_edges" );
+		m_serverCoordinatesFile.setFileName( filename + "_server_coordinates" );
+		if ( !openQFile( &m_serverFirstEdgesFile, QIODevice::ReadOnly ) )
+			return false;
+		if ( !openQFile( &m_serverEdgesFile, QIODevice::ReadOnly ) )
+			return false;
+		if ( !openQFile( &m_serverCoordinatesFile, QIODevice::ReadOnly ) )
+			return false;
+		const unsigned long long nodeIDs = numberOfNodeIDs();
+		if ( ( unsigned long long ) m_serverFirstEdgesFile.size() != ( nodeIDs + 1 ) * sizeof( unsigned ) || ( unsigned long long ) m_serverCoordinatesFile.size() != nodeIDs * sizeof( UnsignedCoordinate ) ) {
+			qCritical() << "server layout does not match the graph";
+			unloadServerLayout();
+			return false;
+		}
+		m_serverFirstEdges = ( const unsigned* ) m_serverFirstEdgesFile.map( 0, m_serverFirstEdgesFile.size() );
+		m_serverCoordinates = ( const UnsignedCoordinate* ) m_serverCoordinatesFile.map( 0, m_serverCoordinatesFile.size() );
+		// an empty graph has nothing to map
+		if ( m_serverEdgesFile.size() > 0 )
+			m_serverEdges = ( const ServerEdge* ) m_serverEdgesFile.map( 0, m_serverEdgesFile.size() );
+		if ( m_serverFirstEdges == NULL || m_serverCoordinates == NULL || ( m_serverEdges == NULL && m_serverEdgesFile.size() > 0 ) ) {
+			qCritical() << "failed to map the server layout";
+			unloadServerLayout();
+			return false;
+		}
+		if ( ( unsigned long long ) m_serverEdgesFile.size() != m_serverFirstEdges[nodeIDs] * sizeof( ServerEdge ) ) {
+			qCritical() << "server layout edges do not match the first edge array";
+			unloadServerLayout();
+			return false;
+		}
+		return true;
+	}
+
+	void unloadServerLayout()
+	{
+		if ( m_serverFirstEdges != NULL )
+			m_serverFirstEdgesFile.unmap( ( uchar* ) m_serverFirstEdges );
+		if ( m_serverEdges != NULL )
+			m_serverEdgesFile.unmap( ( uchar* ) m_serverEdges );
+		if ( m_serverCoordinates != NULL )
+			m_serverCoordinatesFile.unmap( ( uchar* ) m_serverCoordinates );
+		m_serverFirstEdges = NULL;
+		m_serverEdges = NULL;
+		m_serverCoordinates = NULL;
+		m_serverFirstEdgesFile.close();
+		m_serverEdgesFile.close();
+		m_serverCoordinatesFile.close();
+	}
+
+	bool hasServerLayout() const
+	{
+		return m_serverFirstEdges != NULL;
+	}
+
+	// writes the server layout of the loaded graph, see loadServerLayout
+	bool writeServerLayout( QString filename )
+	{
+		if ( m_settings.typeBits > 16 ) {
+			qCritical() << "server layout: too many edge types";
+			return false;
+		}
+		QFile firstEdgesFile( filename + "_server_first_edges" );
+		QFile edgesFile( filename + "_server_edges" );
+		QFile coordinatesFile( filename + "_server_coordinates" );
+		if ( !openQFile( &firstEdgesFile, QIODevice::WriteOnly ) )
+			return false;
+		if ( !openQFile( &edgesFile, QIODevice::WriteOnly ) )
+			return false;
+		if ( !openQFile( &coordinatesFile, QIODevice::WriteOnly ) )
+			return false;
+
+		// node IDs are sparse, IDs without a node get an empty edge range
+		std::vector< unsigned > firstEdges;
+		std::vector< UnsignedCoordinate > coordinates;
+		std::vector< ServerEdge > records;
+		unsigned numberOfRecords = 0;
+		for ( unsigned blockID = 0; blockID < numberOfBlocks(); blockID++ ) {
+			const Block& block = *getBlock( blockID );
+			firstEdges.clear();
+			coordinates.clear();
+			records.clear();
+			for ( unsigned internal = 0; internal < ( 1u << m_settings.internalBits ); internal++ ) {
+				firstEdges.push_back( numberOfRecords + records.size() );
+				if ( internal >= block.settings.nodeCount ) {
+					coordinates.push_back( UnsignedCoordinate( 0, 0 ) );
+					continue;
+				}
+				UnsignedCoordinate coordinate;
+				unpackCoordinates( block, internal, &coordinate );
+				coordinates.push_back( coordinate );
+				for ( EdgeIterator edge = unpackFirstEdges( block, internal ); edge.hasEdgesLeft(); ) {
+					unpackNextEdge( &edge );
+					const EdgeIterator::EdgeData& edgeData = edge.m_data;
+					ServerEdge record;
+					record.target = edge.target();
+					record.distance = edgeData.distance;
+					record.data = 0;
+					record.type = 0;
+					record.flags = 0;
+					record.padding = 0;
+					record.flags |= edgeData.shortcut ? DecodedBlock::Shortcut : 0;
+					record.flags |= edgeData.forward ? DecodedBlock::Forward : 0;
+					record.flags |= edgeData.backward ? DecodedBlock::Backward : 0;
+					record.flags |= edgeData.unpacked ? DecodedBlock::Unpacked : 0;
+					record.flags |= edgeData.unpacked && edgeData.reversed ? DecodedBlock::Reversed : 0;
+					if ( edgeData.unpacked ) {
+						record.data = edgeData.path;
+					} else if ( edgeData.shortcut ) {
+						record.data = edgeData.middle;
+					} else {
+						record.data = edgeData.description.nameID;
+						record.type = edgeData.description.type;
+						record.flags |= edgeData.description.branchingPossible ? DecodedBlock::BranchingPossible : 0;
+					}
+					records.push_back( record );
+				}
+			}
+			numberOfRecords += records.size();
+			bool written = firstEdgesFile.write( ( const char* ) &firstEdges[0], firstEdges.size() * sizeof( unsigned ) ) == ( qint64 ) ( firstEdges.size() * sizeof( unsigned ) );
+			written &= coordinatesFile.write( ( const char* ) &coordinates[0], coordinates.size() * sizeof( UnsignedCoordinate ) ) == ( qint64 ) ( coordinates.size() * sizeof( UnsignedCoordinate ) );
+			if ( !records.empty() )
+				written &= edgesFile.write( ( const char* ) &records[0], records.size() * sizeof( ServerEdge ) ) == ( qint64 ) ( records.size() * sizeof( ServerEdge ) );
+			if ( !written ) {
+				qCritical() << "server layout: failed to write the graph";
+				return false;
+			}
+		}
+		if ( firstEdgesFile.write( ( const char* ) &numberOfRecords, sizeof( unsigned ) ) != sizeof( unsigned ) ) {
+			qCritical() << "server layout: failed to write the graph";
+			return false;
+		}
+		qDebug() << "server layout:" << edgesFile.size() / 1024 / 1024 << "MB of edges";
+		return true;
 	}
 
 	EdgeIterator edges( NodeIterator node )
 	{
+		if ( m_serverEdges != NULL )
+			return EdgeIterator( node, m_serverEdges, m_serverFirstEdges[node], m_serverFirstEdges[node + 1] );
 		unsigned blockID = nodeToBlock( node );
 		unsigned internal = nodeToInternal( node );
 		const Block* block = getBlock( blockID );
+		if ( m_decodedCache != NULL ) {
+			DecodedReference decoded = getDecodedBlock( *block );
+			if ( !decoded.isNull() )
+				return EdgeIterator( internal, *block, decoded, decoded->firstEdges[internal], decoded->firstEdges[internal + 1] );
+		}
 		return unpackFirstEdges( *block, internal );
 	}
 
-	EdgeIterator findEdge( NodeIterator source, NodeIterator target, unsigned id )
+	// finds the id-th original edge between source and target, fails for edges the graph does not contain
+	bool findEdge( EdgeIterator* edge, NodeIterator source, NodeIterator target, unsigned id )
 	{
 		if ( source < target )
 			std::swap( source, target );
@@ -310,79 +733,98 @@ public:
 				continue;
 			}
 
-			return e;
+			*edge = e;
+			return true;
 		}
-		assert( false );
-		return e;
+		return false;
 	}
 
 	void unpackNextEdge( EdgeIterator* edge )
 	{
+		if ( edge->m_server != NULL ) {
+			unpackNextServerEdge( edge );
+			return;
+		}
+		if ( edge->m_decoded != NULL ) {
+			unpackNextDecodedEdge( edge );
+			return;
+		}
+
 		const Block& block = *edge->m_block;
 		EdgeIterator::EdgeData& edgeData = edge->m_data;
-		const unsigned char* buffer = block.buffer + ( edge->m_position >> 3 );
-		int offset = edge->m_position & 7;
+		BitReader reader( block.buffer, edge->m_position );
 
 		// forward + backward flag
-		bool forwardAndBackward = read_unaligned_unsigned( &buffer, 1, &offset ) != 0;
+		bool forwardAndBackward = reader.readBit();
 		if ( forwardAndBackward ) {
 			edgeData.forward = true;
 			edgeData.backward = true;
 		} else {
-			edgeData.forward = read_unaligned_unsigned( &buffer, 1, &offset ) != 0;
+			edgeData.forward = reader.readBit();
 			edgeData.backward = !edgeData.forward;
 		}
 
 		// target
-		bool internalTarget = read_unaligned_unsigned( &buffer, 1, &offset ) != 0;
+		bool internalTarget = reader.readBit();
 		if ( internalTarget ) {
-			unsigned target = read_unaligned_unsigned( &buffer, bits_needed( edge->m_source ), &offset );
+			unsigned target = reader.read( bits_needed( edge->m_source ) );
 			edge->m_target = nodeFromDescriptor( block.id, target );
 		} else {
-			unsigned adjacentBlock = read_unaligned_unsigned( &buffer, block.adjacentBlockBits, &offset );
-			unsigned target = read_unaligned_unsigned( &buffer, block.settings.externalBits, &offset );
+			unsigned adjacentBlock = reader.read( block.adjacentBlockBits );
+			unsigned target = reader.read( block.settings.externalBits );
 			unsigned adjacentBlockPosition = block.adjacentBlocks + adjacentBlock * block.settings.blockBits;
-			unsigned targetBlock = read_unaligned_unsigned( block.buffer + ( adjacentBlockPosition >> 3 ), block.settings.blockBits, adjacentBlockPosition & 7 );
+			unsigned targetBlock = BitReader::read( block.buffer, adjacentBlockPosition, block.settings.blockBits );
 			edge->m_target = nodeFromDescriptor( targetBlock, target );
 		}
 
 		// weight
 		bool longWeight = block.settings.shortWeightBits == block.settings.longWeightBits;
 		if ( !longWeight )
-			longWeight = read_unaligned_unsigned( &buffer, 1, &offset ) != 0;
-		edgeData.distance = read_unaligned_unsigned( &buffer, longWeight ? block.settings.longWeightBits : block.settings.shortWeightBits, &offset );
+			longWeight = reader.readBit();
+		edgeData.distance = reader.read( longWeight ? block.settings.longWeightBits : block.settings.shortWeightBits );
+		bool closed = edgeData.distance == ( unsigned ) ClosedDistance;
 
 		// unpacked
-		edgeData.unpacked = read_unaligned_unsigned( &buffer, 1, &offset ) != 0;
+		edgeData.unpacked = reader.readBit();
 		if ( edgeData.unpacked ) {
 			if ( forwardAndBackward )
-				edgeData.reversed = read_unaligned_unsigned( &buffer, 1, &offset ) != 0;
+				edgeData.reversed = reader.readBit();
 			else
 				edgeData.reversed = edgeData.backward;
-			edgeData.path = read_unaligned_unsigned( &buffer, m_settings.pathBits, &offset );
+			edgeData.path = reader.read( m_settings.pathBits );
 		}
 
 		// shortcut
-		edgeData.shortcut = read_unaligned_unsigned( &buffer, 1, &offset ) != 0;
+		edgeData.shortcut = reader.readBit();
 		if ( edgeData.shortcut ) {
+			closed = false;
 			if ( !edgeData.unpacked ) {
-				unsigned middle = read_unaligned_unsigned( &buffer, block.internalBits, &offset );
+				unsigned middle = reader.read( block.internalBits );
 				edgeData.middle = nodeFromDescriptor( block.id, middle );
 			}
 		}
+		if ( closed ) {
+			edgeData.forward = false;
+			edgeData.backward = false;
+		}
 
 		// edge description
 		if ( !edgeData.shortcut && !edgeData.unpacked ) {
-			edgeData.description.type = read_unaligned_unsigned( &buffer, m_settings.typeBits, &offset );
-			edgeData.description.nameID = read_unaligned_unsigned( &buffer, m_settings.nameBits, &offset );
-			edgeData.description.branchingPossible = read_unaligned_unsigned( &buffer, 1, &offset );
+			edgeData.description.type = reader.read( m_settings.typeBits );
+			edgeData.description.nameID = reader.read( m_settings.nameBits );
+			edgeData.description.branchingPossible = reader.readBit();
 		}
 
-		edge->m_position = ( buffer - block.buffer ) * 8 + offset;
+		edge->m_position = reader.position();
 	}
 
 	IRouter::Node node( NodeIterator node )
 	{
+		if ( m_serverCoordinates != NULL ) {
+			IRouter::Node result;
+			result.coordinate = m_serverCoordinates[node];
+			return result;
+		}
 		unsigned blockID = nodeToBlock( node );
 		unsigned internal = nodeToInternal( node );
 		const Block* block = getBlock( blockID );
@@ -401,6 +843,78 @@ public:
 		return m_settings.numberOfEdges;
 	}
 
+	// node ids are not contiguous ( block id + internal id ), this is the size of the id range
+	unsigned numberOfNodeIDs() const
+	{
+		return m_blockCache.numberOfBlocks() << m_settings.internalBits;
+	}
+
+	unsigned numberOfBlocks() const
+	{
+		return m_blockCache.numberOfBlocks();
+	}
+
+	const BlockCache< Block >& blockCache() const
+	{
+		return m_blockCache;
+	}
+
+	const BlockCache< PathBlock >& pathCache() const
+	{
+		return m_pathCache;
+	}
+
+	// pinned blocks are never evicted, NULL disables pinning
+	// the data has to stay valid until the graph is unloaded
+	void setPinnedData( const PinnedData* data )
+	{
+		m_blockCache.setPinned( data != NULL ? &data->m_blocks : NULL );
+		m_pathCache.setPinned( data != NULL ? &data->m_paths : NULL );
+	}
+
+	// replaces the private block caches with shared ones, see BlockCache::setShared
+	// the cache has to stay valid until the graph is unloaded
+	bool setSharedCache( SharedCache* cache )
+	{
+		if ( !m_blockCache.setShared( &cache->m_blocks ) )
+			return false;
+		return m_pathCache.setShared( &cache->m_paths );
+	}
+
+	// keeps frequently accessed blocks in decoded form, NULL disables it
+	// the cache has to stay valid until the graph is unloaded
+	void setDecodedCache( DecodedCache* cache )
+	{
+		m_decodedCache = cache;
+		for ( unsigned i = 0; i < RecentDecoded; i++ ) {
+			m_recentDecoded[i] = DecodedReference();
+			m_recentDecodedIDs[i] = std::numeric_limits< unsigned >::max();
+		}
+	}
+
+	// read-ahead of adjacent blocks, see BlockCache::setPrefetch
+	void setPrefetch( bool prefetch )
+	{
+		m_blockCache.setPrefetch( prefetch );
+	}
+
+	BlockCache< Block >::PrefetchStatistics prefetchStatistics() const
+	{
+		return m_blockCache.prefetchStatistics();
+	}
+
+	// nodes are stored in rank order: iterating over all blocks and their nodes
+	// visits higher ranked nodes first, edges always point to a higher ranked node
+	unsigned blockNodeCount( unsigned block )
+	{
+		return getBlock( block )->settings.nodeCount;
+	}
+
+	NodeIterator blockNode( unsigned block, unsigned internal )
+	{
+		return nodeFromDescriptor( block, internal );
+	}
+
 	template< class T, class S >
 	void path( const EdgeIterator& edge, T path, S edges, bool forward )
 	{
@@ -501,22 +1015,126 @@ protected:
 	void unpackCoordinates( const Block& block, unsigned node, UnsignedCoordinate* result )
 	{
 		unsigned position = block.nodeCoordinates + ( block.settings.xBits + block.settings.yBits ) * node;
-		const unsigned char* buffer = block.buffer + ( position >> 3 );
-		int offset = position & 7;
-		result->x = read_unaligned_unsigned( &buffer, block.settings.xBits, &offset ) + block.settings.minX;
-		result->y = read_unaligned_unsigned( buffer, block.settings.yBits, offset ) + block.settings.minY;
+		BitReader reader( block.buffer, position );
+		result->x = reader.read( block.settings.xBits ) + block.settings.minX;
+		result->y = reader.read( block.settings.yBits ) + block.settings.minY;
 	}
 
 	EdgeIterator unpackFirstEdges( const Block& block, unsigned node )
 	{
 		unsigned position = block.firstEdges + block.settings.firstEdgeBits * node;
-		const unsigned char* buffer = block.buffer + ( position >> 3 );
-		int offset = position & 7;
-		unsigned begin = read_unaligned_unsigned( &buffer, block.settings.firstEdgeBits, &offset );
-		unsigned end = read_unaligned_unsigned( buffer, block.settings.firstEdgeBits, offset );
+		BitReader reader( block.buffer, position );
+		unsigned begin = reader.read( block.settings.firstEdgeBits );
+		unsigned end = reader.read( block.settings.firstEdgeBits );
 		return EdgeIterator( node, block, begin + block.edges, end + block.edges );
 	}
 
+	void unpackNextDecodedEdge( EdgeIterator* edge )
+	{
+		const DecodedBlock& decoded = *edge->m_decoded;
+		EdgeIterator::EdgeData& edgeData = edge->m_data;
+		const unsigned position = edge->m_position++;
+		const unsigned char flags = decoded.flags[position];
+
+		edge->m_target = decoded.targets[position];
+		edgeData.distance = decoded.distances[position];
+		edgeData.shortcut = ( flags & DecodedBlock::Shortcut ) != 0;
+		edgeData.forward = ( flags & DecodedBlock::Forward ) != 0;
+		edgeData.backward = ( flags & DecodedBlock::Backward ) != 0;
+		edgeData.unpacked = ( flags & DecodedBlock::Unpacked ) != 0;
+		edgeData.reversed = ( flags & DecodedBlock::Reversed ) != 0;
+		edgeData.path = decoded.paths[position];
+		if ( edgeData.shortcut ) {
+			edgeData.middle = decoded.data[position];
+		} else {
+			edgeData.description.nameID = decoded.data[position];
+			edgeData.description.branchingPossible = ( flags & DecodedBlock::BranchingPossible ) != 0;
+			edgeData.description.type = decoded.types[position];
+		}
+	}
+
+	void unpackNextServerEdge( EdgeIterator* edge )
+	{
+		const ServerEdge& record = edge->m_server[edge->m_position++];
+		EdgeIterator::EdgeData& edgeData = edge->m_data;
+
+		edge->m_target = record.target;
+		edgeData.distance = record.distance;
+		edgeData.shortcut = ( record.flags & DecodedBlock::Shortcut ) != 0;
+		edgeData.forward = ( record.flags & DecodedBlock::Forward ) != 0;
+		edgeData.backward = ( record.flags & DecodedBlock::Backward ) != 0;
+		edgeData.unpacked = ( record.flags & DecodedBlock::Unpacked ) != 0;
+		edgeData.reversed = ( record.flags & DecodedBlock::Reversed ) != 0;
+		edgeData.path = record.data;
+		if ( edgeData.shortcut ) {
+			edgeData.middle = record.data;
+		} else {
+			edgeData.description.nameID = record.data;
+			edgeData.description.branchingPossible = ( record.flags & DecodedBlock::BranchingPossible ) != 0;
+			edgeData.description.type = record.type;
+		}
+	}
+
+	// returns a null reference if the block is not accessed often enough to be worth decoding
+	DecodedReference getDecodedBlock( const Block& block )
+	{
+		// the recently used blocks are checked first, which needs no locks
+		for ( unsigned i = 0; i < RecentDecoded; i++ ) {
+			if ( m_recentDecodedIDs[i] == block.id )
+				return m_recentDecoded[i];
+		}
+
+		DecodedReference decoded = m_decodedCache->find( block.id );
+		if ( decoded.isNull() ) {
+			if ( !m_decodedCache->hot( block.id ) )
+				return DecodedReference();
+			decoded = m_decodedCache->insert( block.id, decodeBlock( block ) );
+			if ( decoded.isNull() )
+				return decoded;
+		}
+		m_recentDecoded[m_nextRecentDecoded] = decoded;
+		m_recentDecodedIDs[m_nextRecentDecoded] = block.id;
+		m_nextRecentDecoded = ( m_nextRecentDecoded + 1 ) % RecentDecoded;
+		return decoded;
+	}
+
+	DecodedBlock* decodeBlock( const Block& block )
+	{
+		DecodedBlock* result = new DecodedBlock;
+		result->firstEdges.reserve( block.settings.nodeCount + 1 );
+		for ( unsigned node = 0; node < block.settings.nodeCount; node++ ) {
+			result->firstEdges.push_back( result->targets.size() );
+			for ( EdgeIterator edge = unpackFirstEdges( block, node ); edge.hasEdgesLeft(); ) {
+				unpackNextEdge( &edge );
+				const EdgeIterator::EdgeData& edgeData = edge.m_data;
+				unsigned char flags = 0;
+				flags |= edgeData.shortcut ? DecodedBlock::Shortcut : 0;
+				flags |= edgeData.forward ? DecodedBlock::Forward : 0;
+				flags |= edgeData.backward ? DecodedBlock::Backward : 0;
+				flags |= edgeData.unpacked ? DecodedBlock::Unpacked : 0;
+				flags |= edgeData.unpacked && edgeData.reversed ? DecodedBlock::Reversed : 0;
+				unsigned data = 0;
+				unsigned type = 0;
+				if ( edgeData.shortcut ) {
+					if ( !edgeData.unpacked )
+						data = edgeData.middle;
+				} else if ( !edgeData.unpacked ) {
+					data = edgeData.description.nameID;
+					type = edgeData.description.type;
+					flags |= edgeData.description.branchingPossible ? DecodedBlock::BranchingPossible : 0;
+				}
+				result->targets.push_back( edge.target() );
+				result->distances.push_back( edgeData.distance );
+				result->flags.push_back( flags );
+				result->data.push_back( data );
+				result->types.push_back( type );
+				result->paths.push_back( edgeData.unpacked ? edgeData.path : 0 );
+			}
+		}
+		result->firstEdges.push_back( result->targets.size() );
+		return result;
+	}
+
 	const Block* getBlock( unsigned block )
 	{
 		return m_blockCache.getBlock( block );
@@ -555,21 +1173,20 @@ protected:
 
 	static void loadBlock( Block* block, unsigned blockID, const unsigned char* blockBuffer )
 	{
-		const unsigned char* buffer = blockBuffer;
-		int offset = 0;
+		BitReader reader( blockBuffer );
 
 		// read settings
-		block->settings.blockBits = read_unaligned_unsigned( &buffer, 8, &offset );
-		block->settings.externalBits = read_unaligned_unsigned( &buffer, 8, &offset );
-		block->settings.firstEdgeBits = read_unaligned_unsigned( &buffer, 8, &offset );
-		block->settings.shortWeightBits = read_unaligned_unsigned( &buffer, 8, &offset );
-		block->settings.longWeightBits = read_unaligned_unsigned( &buffer, 8, &offset );
-		block->settings.xBits = read_unaligned_unsigned( &buffer, 8, &offset );
-		block->settings.yBits = read_unaligned_unsigned( &buffer, 8, &offset );
-		block->settings.minX = read_unaligned_unsigned( &buffer, 32, &offset );
-		block->settings.minY = read_unaligned_unsigned( &buffer, 32, &offset );
-		block->settings.nodeCount = read_unaligned_unsigned( &buffer, 32, &offset );
-		block->settings.adjacentBlockCount = read_unaligned_unsigned( &buffer, 32, &offset );
+		block->settings.blockBits = reader.read( 8 );
+		block->settings.externalBits = reader.read( 8 );
+		block->settings.firstEdgeBits = reader.read( 8 );
+		block->settings.shortWeightBits = reader.read( 8 );
+		block->settings.longWeightBits = reader.read( 8 );
+		block->settings.xBits = reader.read( 8 );
+		block->settings.yBits = reader.read( 8 );
+		block->settings.minX = reader.read( 32 );
+		block->settings.minY = reader.read( 32 );
+		block->settings.nodeCount = reader.read( 32 );
+		block->settings.adjacentBlockCount = reader.read( 32 );
 
 		// set other values
 		block->internalBits = bits_needed( block->settings.nodeCount - 1 );
@@ -578,13 +1195,22 @@ protected:
 		block->buffer = blockBuffer;
 
 		// compute offsets
-		block->nodeCoordinates = ( buffer - blockBuffer ) * 8 + offset;
+		block->nodeCoordinates = reader.position();
 		block->adjacentBlocks = block->nodeCoordinates + ( block->settings.xBits + block->settings.yBits ) * block->settings.nodeCount;
 		block->firstEdges = block->adjacentBlocks + block->settings.blockBits * block->settings.adjacentBlockCount;
 		block->edges = block->firstEdges + block->settings.firstEdgeBits * ( block->settings.nodeCount + 1 );
 	}
 
-	static void loadPathBlock( PathBlock* block, unsigned blockID, const unsigned char* blockBuffer )
+	static void readAdjacentBlocks( const Block& block, std::vector< unsigned >* result )
+	{
+		unsigned position = block.adjacentBlocks;
+		for ( unsigned i = 0; i < block.settings.adjacentBlockCount; i++ ) {
+			result->push_back( BitReader::read( block.buffer, position, block.settings.blockBits ) );
+			position += block.settings.blockBits;
+		}
+	}
+
+		static void loadPathBlock( PathBlock* block, unsigned blockID, const unsigned char* blockBuffer )
 	{
 		block->id = blockID;
 		block->buffer = blockBuffer;
@@ -595,6 +1221,19 @@ protected:
 	GlobalSettings m_settings;
 	BlockCache< Block > m_blockCache;
 	BlockCache< PathBlock > m_pathCache;
+	DecodedCache* m_decodedCache;
+	// the most recently used decoded blocks, found without locking the shared cache
+	// iterators hold references of their own, the blocks do not have to stay in this list while they are iterated
+	enum { RecentDecoded = 16 };
+	DecodedReference m_recentDecoded[RecentDecoded];
+	unsigned m_recentDecodedIDs[RecentDecoded];
+	unsigned m_nextRecentDecoded;
+	QFile m_serverFirstEdgesFile;
+	QFile m_serverEdgesFile;
+	QFile m_serverCoordinatesFile;
+	const unsigned* m_serverFirstEdges;
+	const ServerEdge* m_serverEdges;
+	const UnsignedCoordinate* m_serverCoordinates;
 	bool m_loaded;
 };
 
@@ -124,6 +124,7 @@ private:
 			qDebug() << "reversed          :" << reversed;
 			qDebug() << "shortcuts         :" << shortcuts;
 			qDebug() << "unpacked edges    :" << unpackedEdges;
+			qDebug() << "cross-block edges :" << 100.0 * externalTarget / std::max< size_t >( graph.m_edges.size(), 1 ) << "%";
 
 			qDebug() << "xSize        :" << xSize / 8 / 1024 / 1024 << "MB /" << graph.m_nodes.size() * 32 / 8 / 1024 / 1024 << "MB";
 			qDebug() << "ySize        :" << ySize / 8 / 1024 / 1024 << "MB /" << graph.m_nodes.size() * 32 / 8 / 1024 / 1024 << "MB";
@@ -491,8 +492,10 @@ private:
 				assert( edge.hasEdgesLeft() );
 				unpackNextEdge( &edge );
 				assert( nodeFromDescriptor( m_nodeIDs[m_edges[e].target] ) == edge.target() );
-				assert( m_edges[e].data.forward == edge.forward() );
-				assert( m_edges[e].data.backward == edge.backward() );
+				// closed road edges are decoded without a direction
+				const bool closed = !m_edges[e].data.shortcut && ( unsigned ) m_edges[e].data.distance == ( unsigned ) ClosedDistance;
+				assert( ( m_edges[e].data.forward && !closed ) == edge.forward() );
+				assert( ( m_edges[e].data.backward && !closed ) == edge.backward() );
 				assert( m_edges[e].data.shortcut == edge.shortcut() );
 				if ( m_edges[e].data.shortcut ) {
 					assert ( mustUnpack( e ) == ( edge.unpacked() ) );
@@ -526,6 +529,51 @@ private:
 			m_firstEdges.push_back( m_edges.size() );
 	}
 
+	// average number of blocks touched by the searches of a query between random nodes
+	// estimated from the complete upward search spaces, i.e., ignoring the pruning of an actual query
+	double blocksPerQuery( unsigned blocks ) const
+	{
+		const unsigned samples = 1000;
+		if ( m_nodes.empty() )
+			return 0;
+		std::vector< unsigned > visited( m_nodes.size(), std::numeric_limits< unsigned >::max() );
+		std::vector< unsigned > touched( blocks, std::numeric_limits< unsigned >::max() );
+		std::vector< unsigned > stack;
+		// deterministic xorshift, the estimate must not vary between runs
+		unsigned random = 2654435761u;
+		unsigned long long result = 0;
+		for ( unsigned sample = 0; sample < samples; sample++ ) {
+			for ( unsigned direction = 0; direction < 2; direction++ ) {
+				random ^= random << 13;
+				random ^= random >> 17;
+				random ^= random << 5;
+				const unsigned stamp = 2 * sample + direction;
+				const unsigned start = random % m_nodes.size();
+				visited[start] = stamp;
+				stack.push_back( start );
+				while ( !stack.empty() ) {
+					const unsigned node = stack.back();
+					stack.pop_back();
+					// blocks touched by both searches are counted once
+					if ( touched[m_nodeIDs[node].block] != sample ) {
+						touched[m_nodeIDs[node].block] = sample;
+						result++;
+					}
+					for ( unsigned e = m_firstEdges[node]; e < m_firstEdges[node + 1]; e++ ) {
+						const Edge& edge = m_edges[e];
+						if ( !( direction == 0 ? edge.data.forward : edge.data.backward ) )
+							continue;
+						if ( visited[edge.target] == stamp )
+							continue;
+						visited[edge.target] = stamp;
+						stack.push_back( edge.target );
+					}
+				}
+			}
+		}
+		return ( double ) result / samples;
+	}
+
 	// unpack all external shortcuts
 	void unpackAllNecessary( QFile* pathFile, bool pretend = false )
 	{
@@ -756,6 +804,7 @@ private:
 		qDebug( "\tmax internal ID: %u", nodeFromDescriptor( m_nodeIDs.back() ) );
 
 		m_statistics.print( *this );
+		qDebug() << "blocks per query  :" << blocksPerQuery( blocks );
 
 		for ( unsigned i = 0; i < m_nodes.size(); i++ )
 			( *remap )[i] = nodeFromDescriptor( m_nodeIDs[( *remap )[i]] );
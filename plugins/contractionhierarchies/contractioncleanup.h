@@ -24,6 +24,7 @@ along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
 #include <queue>
 #include <stack>
 #include "contractor.h"
+#include "utils/coordinates.h"
 
 class ContractionCleanup {
 	private:
@@ -137,11 +138,19 @@ class ContractionCleanup {
 
 		}
 
-		void Run() {
+		// lays out the nodes of each hierarchy band along a Hilbert curve of their coordinates instead of
+		// their depth first order, nearby nodes end up in the same blocks of the compressed graph
+		void SetCoordinates( const std::vector< UnsignedCoordinate >& coordinates ) {
+			assert( coordinates.size() == _numNodes );
+			_coordinates = coordinates;
+		}
+
+		void Run( bool removeUselessShortcuts = true ) {
 
 			double time = _Timestamp();
 
-			RemoveUselessShortcuts();
+			if ( removeUselessShortcuts )
+				RemoveUselessShortcuts();
 
 			ReorderNodes();
 
@@ -378,6 +387,16 @@ class ContractionCleanup {
 				assert( newID == _numNodes );
 			}
 
+			if ( !_coordinates.empty() ) {
+				qDebug( "Order Nodes along a Hilbert Curve" );
+				std::vector< std::pair< unsigned long long, NodeID > > curve( _numNodes );
+				for ( NodeID node = 0; node < _numNodes; ++node )
+					curve[node] = std::make_pair( _HilbertValue( _coordinates[node] ), node );
+				sort( curve.begin(), curve.end() );
+				for ( NodeID i = 0; i < _numNodes; ++i )
+					_remap[curve[i].second].mappedID = i;
+			}
+
 			qDebug( "Sort Nodes into buckets according to hierarchy depths" );
 			{
 				//sort by level
@@ -431,6 +450,27 @@ class ContractionCleanup {
 			std::sort( _remap.begin(), _remap.end(), _Node::CompareByID );
 		}
 
+		// position of the coordinate along a Hilbert curve covering the whole coordinate range
+		static unsigned long long _HilbertValue( UnsignedCoordinate coordinate ) {
+			unsigned x = coordinate.x;
+			unsigned y = coordinate.y;
+			unsigned long long result = 0;
+			for ( unsigned s = 1u << 31; s > 0; s >>= 1 ) {
+				const unsigned rx = ( x & s ) != 0 ? 1 : 0;
+				const unsigned ry = ( y & s ) != 0 ? 1 : 0;
+				result += ( unsigned long long ) s * s * ( ( 3 * rx ) ^ ry );
+				// rotate the quadrant, only the lower bits matter from now on
+				if ( ry == 0 ) {
+					if ( rx == 1 ) {
+						x = ~x;
+						y = ~y;
+					}
+					std::swap( x, y );
+				}
+			}
+			return result;
+		}
+
 		void RemoveDuplicatedWitnesses() {
 			qDebug( "Delete Duplicate Entries to save Memory" );
 			if ( !_distributedWitnessData.empty() ) {
@@ -660,6 +700,7 @@ class ContractionCleanup {
 		std::vector< Contractor::Witness > _witnessList;
 		std::vector< _Witness > _distributedWitnessData;
 		std::vector< unsigned > _witnessIndex;
+		std::vector< UnsignedCoordinate > _coordinates;
 		_Heap* _heapForward;
 		_Heap* _heapBackward;
 };
@@ -21,15 +21,23 @@ along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
 #include "compressedgraphbuilder.h"
 #include "contractor.h"
 #include "contractioncleanup.h"
+#include "edgebasedgraph.h"
+#include "customizablecontractor.h"
+#include "hublabelbuilder.h"
 #include "utils/qthelpers.h"
 #ifndef NOGUI
 #include "chsettingsdialog.h"
 #endif
 
 #include <QSettings>
+#include <cstdlib>
 
 ContractionHierarchies::ContractionHierarchies()
 {
+	m_settings.turnCosts = false;
+	m_settings.customizable = false;
+	m_settings.hubLabels = false;
+	m_settings.serverLayout = false;
 }
 
 ContractionHierarchies::~ContractionHierarchies()
@@ -46,6 +54,11 @@ bool ContractionHierarchies:: LoadSettings( QSettings* settings )
 	settings->beginGroup( "ContractionHierarchies" );
 	bool ok = false;
 	m_settings.blockSize = settings->value( "blockSize", 12 ).toInt( &ok );
+	m_settings.turnCosts = settings->value( "turnCosts", false ).toBool();
+	m_settings.customizable = settings->value( "customizable", false ).toBool();
+	m_settings.weightFile = settings->value( "weightFile", "" ).toString();
+	m_settings.hubLabels = settings->value( "hubLabels", false ).toBool();
+	m_settings.serverLayout = settings->value( "serverLayout", false ).toBool();
 	settings->endGroup();
 	return ok;
 }
@@ -54,12 +67,20 @@ bool ContractionHierarchies::SaveSettings( QSettings* settings )
 {
 	settings->beginGroup( "ContractionHierarchies" );
 	settings->setValue( "blockSize", m_settings.blockSize );
+	settings->setValue( "turnCosts", m_settings.turnCosts );
+	settings->setValue( "customizable", m_settings.customizable );
+	settings->setValue( "weightFile", m_settings.weightFile );
+	settings->setValue( "hubLabels", m_settings.hubLabels );
+	settings->setValue( "serverLayout", m_settings.serverLayout );
 	settings->endGroup();
 	return true;
 }
 
 int ContractionHierarchies::GetFileFormatVersion()
 {
+	// clients that do not know about edge-based graphs must not load them
+	if ( m_settings.turnCosts )
+		return 2;
 	return 1;
 }
 
@@ -72,6 +93,37 @@ bool ContractionHierarchies::Preprocess( IImporter* importer, QString dir )
 {
 	QString filename = fileInDirectory( dir, "Contraction Hierarchies" );
 
+	// running clients keep their mapping of the old files
+	QFile::remove( filename + "_config" );
+	QFile::remove( filename + "_edges" );
+	QFile::remove( filename + "_paths" );
+	QFile::remove( filename + "_names" );
+	QFile::remove( filename + "_types" );
+	QFile::remove( filename + "_labels" );
+	QFile::remove( filename + "_labels_index" );
+	QFile::remove( filename + "_server_first_edges" );
+	QFile::remove( filename + "_server_edges" );
+	QFile::remove( filename + "_server_coordinates" );
+
+	if ( m_settings.turnCosts ) {
+		if ( m_settings.customizable )
+			qDebug() << "customizable contraction does not support turn costs, using the regular contraction";
+		if ( m_settings.hubLabels )
+			qDebug() << "hub labels do not support turn costs, skipping them";
+		if ( !preprocessTurnCosts( importer, filename ) )
+			return false;
+		return writeLayout( dir, filename );
+	}
+	// the client detects edge-based graphs by their road edge index
+	QFile::remove( filename + "_road_edges" );
+	QFile::remove( filename + "_road_edge_paths" );
+
+	if ( m_settings.customizable ) {
+		if ( !preprocessCustomizable( importer, filename ) )
+			return false;
+		return writeLayout( dir, filename );
+	}
+
 	std::vector< IImporter::RoutingNode > inputNodes;
 	std::vector< IImporter::RoutingEdge > inputEdges;
 
@@ -100,6 +152,12 @@ bool ContractionHierarchies::Preprocess( IImporter* importer, QString dir )
 	std::vector< ContractionCleanup::Edge >().swap( contractedEdges );
 	std::vector< ContractionCleanup::Edge >().swap( contractedLoops );
 	std::vector< Contractor::Witness >().swap( witnessList );
+	{
+		std::vector< UnsignedCoordinate > coordinates( inputNodes.size() );
+		for ( unsigned node = 0; node < inputNodes.size(); node++ )
+			coordinates[node] = inputNodes[node].coordinate;
+		cleanup->SetCoordinates( coordinates );
+	}
 	cleanup->Run();
 
 	std::vector< CompressedGraph::Edge > edges;
@@ -107,6 +165,40 @@ bool ContractionHierarchies::Preprocess( IImporter* importer, QString dir )
 	cleanup->GetData( &edges, &map );
 	delete cleanup;
 
+	if ( !buildGraph( importer, filename, &inputNodes, numEdges, &edges, &map ) )
+		return false;
+	return writeLayout( dir, filename );
+}
+
+// records the graph layout clients should load in the module's config and writes the server layout if requested
+bool ContractionHierarchies::writeLayout( QString dir, QString filename )
+{
+	if ( m_settings.serverLayout ) {
+		Timer time;
+		CompressedGraph graph;
+		if ( !graph.loadGraph( filename, 0, true ) )
+			return false;
+		if ( !graph.writeServerLayout( filename ) )
+			return false;
+		qDebug() << "server layout: written in" << time.elapsed() << "ms";
+	}
+
+	QSettings settings( fileInDirectory( dir, "Module.ini" ), QSettings::IniFormat );
+	settings.setValue( "contractionHierarchiesLayout", m_settings.serverLayout ? "server" : "compressed" );
+	settings.sync();
+	if ( settings.status() != QSettings::NoError ) {
+		qCritical() << "Error writing config:" << settings.fileName();
+		return false;
+	}
+	return true;
+}
+
+bool ContractionHierarchies::buildGraph( IImporter* importer, QString filename, std::vector< IImporter::RoutingNode >* inputNodes, unsigned numEdges, std::vector< CompressedGraph::Edge >* contractedEdges, std::vector< NodeID >* idMap, const std::vector< double >* seconds )
+{
+	std::vector< CompressedGraph::Edge >& edges = *contractedEdges;
+	std::vector< NodeID >& map = *idMap;
+	const unsigned numNodes = inputNodes->size();
+
 	{
 		std::vector< unsigned > edgeIDs( numEdges );
 		for ( unsigned edge = 0; edge < edges.size(); edge++ ) {
@@ -132,9 +224,9 @@ bool ContractionHierarchies::Preprocess( IImporter* importer, QString dir )
 	}
 
 	std::vector< IRouter::Node > nodes( numNodes );
-	for ( std::vector< IImporter::RoutingNode >::const_iterator i = inputNodes.begin(), iend = inputNodes.end(); i != iend; i++ )
-		nodes[map[i - inputNodes.begin()]].coordinate = i->coordinate;
-	std::vector< IImporter::RoutingNode >().swap( inputNodes );
+	for ( std::vector< IImporter::RoutingNode >::const_iterator i = inputNodes->begin(), iend = inputNodes->end(); i != iend; i++ )
+		nodes[map[i - inputNodes->begin()]].coordinate = i->coordinate;
+	std::vector< IImporter::RoutingNode >().swap( *inputNodes );
 
 	std::vector< IRouter::Node > pathNodes;
 	{
@@ -146,69 +238,306 @@ bool ContractionHierarchies::Preprocess( IImporter* importer, QString dir )
 			pathNodes[i].coordinate = edgePaths[i].coordinate;
 	}
 
+	std::vector< IImporter::RoutingEdge > inputEdges;
 	if ( !importer->GetRoutingEdges( &inputEdges ) )
 		return false;
 
 	{
-		std::vector< QString > inputNames;
-		if ( !importer->GetRoutingWayNames( &inputNames ) )
+		std::vector< unsigned > nameMap;
+		if ( !writeNames( importer, filename, &nameMap ) )
 			return false;
+		for ( unsigned edge = 0; edge < numEdges; edge++ )
+			inputEdges[edge].nameID = nameMap[inputEdges[edge].nameID];
+	}
 
-		QFile nameFile( filename + "_names" );
-		if ( !openQFile( &nameFile, QIODevice::WriteOnly ) )
-			return false;
+	if ( !writeTypes( importer, filename ) )
+		return false;
 
-		std::vector< unsigned > nameMap( inputNames.size() );
-		for ( unsigned name = 0; name < inputNames.size(); name++ ) {
-			nameMap[name] = nameFile.pos();
-			QByteArray buffer = inputNames[name].toUtf8();
-			buffer.push_back( ( char ) 0 );
-			nameFile.write( buffer );
+	// route descriptions report the travel times of the metric used
+	if ( seconds != NULL ) {
+		for ( unsigned edge = 0; edge < numEdges; edge++ ) {
+			if ( ( *seconds )[edge] >= 0 )
+				inputEdges[edge].distance = ( *seconds )[edge];
 		}
+	}
 
-		nameFile.close();
-		nameFile.open( QIODevice::ReadOnly );
-		const char* test = ( const char* ) nameFile.map( 0, nameFile.size() );
-		for ( unsigned name = 0; name < inputNames.size(); name++ ) {
-			QString testName = QString::fromUtf8( test + nameMap[name] );
-			assert( testName == inputNames[name] );
-		}
+	for ( std::vector< IImporter::RoutingEdge >::iterator i = inputEdges.begin(), iend = inputEdges.end(); i != iend; i++ ) {
+		i->source = map[i->source];
+		i->target = map[i->target];
+	}
 
-		for ( unsigned edge = 0; edge < numEdges; edge++ )
-			inputEdges[edge].nameID = nameMap[inputEdges[edge].nameID];
+	// the labels are computed on the contracted edges, the graph builder consumes them
+	HubLabelBuilder* labels = NULL;
+	std::vector< NodeID > contractedIDs;
+	if ( m_settings.hubLabels ) {
+		labels = new HubLabelBuilder( numNodes, edges );
+		labels->run();
+		contractedIDs = map;
+	}
+
+	CompressedGraphBuilder* builder = new CompressedGraphBuilder( 1u << m_settings.blockSize, nodes, edges, inputEdges, pathNodes );
+	if ( !builder->run( filename, &map ) )
+		return false;
+	delete builder;
+
+	if ( labels != NULL ) {
+		std::vector< NodeID > remap( numNodes );
+		for ( unsigned node = 0; node < numNodes; node++ )
+			remap[contractedIDs[node]] = map[node];
+		bool written = labels->write( filename, remap );
+		delete labels;
+		if ( !written )
+			return false;
 	}
 
+	importer->SetIDMap( map );
+
+	return true;
+}
+
+bool ContractionHierarchies::writeNames( IImporter* importer, QString filename, std::vector< unsigned >* nameMap )
+{
+	std::vector< QString > inputNames;
+	if ( !importer->GetRoutingWayNames( &inputNames ) )
+		return false;
+
+	QFile nameFile( filename + "_names" );
+	if ( !openQFile( &nameFile, QIODevice::WriteOnly ) )
+		return false;
+
+	nameMap->resize( inputNames.size() );
+	for ( unsigned name = 0; name < inputNames.size(); name++ ) {
+		( *nameMap )[name] = nameFile.pos();
+		QByteArray buffer = inputNames[name].toUtf8();
+		buffer.push_back( ( char ) 0 );
+		nameFile.write( buffer );
+	}
+
+	nameFile.close();
+	nameFile.open( QIODevice::ReadOnly );
+	const char* test = ( const char* ) nameFile.map( 0, nameFile.size() );
+	for ( unsigned name = 0; name < inputNames.size(); name++ ) {
+		QString testName = QString::fromUtf8( test + ( *nameMap )[name] );
+		assert( testName == inputNames[name] );
+	}
+
+	return true;
+}
+
+bool ContractionHierarchies::writeTypes( IImporter* importer, QString filename )
+{
+	std::vector< QString > inputTypes;
+	if ( !importer->GetRoutingWayTypes( &inputTypes ) )
+		return false;
+
+	QFile typeFile( filename + "_types" );
+	if ( !openQFile( &typeFile, QIODevice::WriteOnly ) )
+		return false;
+
+	QStringList typeList;
+	for ( unsigned type = 0; type < inputTypes.size(); type++ )
+		typeList.push_back( inputTypes[type] );
+
+	typeFile.write( typeList.join( ";" ).toUtf8() );
+	return true;
+}
+
+bool ContractionHierarchies::preprocessTurnCosts( IImporter* importer, QString filename )
+{
+	std::vector< IImporter::RoutingNode > inputNodes;
+	std::vector< IImporter::RoutingEdge > inputEdges;
+	std::vector< IRouter::Node > inputPaths;
+	std::vector< char > inDegree;
+	std::vector< char > outDegree;
+	std::vector< double > penalties;
+
+	if ( !importer->GetRoutingNodes( &inputNodes ) )
+		return false;
+	if ( !importer->GetRoutingEdges( &inputEdges ) )
+		return false;
 	{
-		std::vector< QString > inputTypes;
-		if ( !importer->GetRoutingWayTypes( &inputTypes ) )
+		std::vector< IImporter::RoutingNode > edgePaths;
+		if ( !importer->GetRoutingEdgePaths( &edgePaths ) )
 			return false;
+		inputPaths.resize( edgePaths.size() );
+		for ( unsigned i = 0; i < edgePaths.size(); i++ )
+			inputPaths[i].coordinate = edgePaths[i].coordinate;
+	}
+	if ( !importer->GetRoutingPenalties( &inDegree, &outDegree, &penalties ) )
+		return false;
 
-		QFile typeFile( filename + "_types" );
-		if ( !openQFile( &typeFile, QIODevice::WriteOnly ) )
+	{
+		std::vector< unsigned > nameMap;
+		if ( !writeNames( importer, filename, &nameMap ) )
 			return false;
+		for ( unsigned edge = 0; edge < inputEdges.size(); edge++ )
+			inputEdges[edge].nameID = nameMap[inputEdges[edge].nameID];
+	}
 
-		QStringList typeList;
-		for ( unsigned type = 0; type < inputTypes.size(); type++ )
-			typeList.push_back( inputTypes[type] );
+	if ( !writeTypes( importer, filename ) )
+		return false;
 
-		typeFile.write( typeList.join( ";" ).toUtf8() );
+	EdgeBasedGraph* edgeBasedGraph = new EdgeBasedGraph( inputNodes, inputEdges, inputPaths );
+	if ( !edgeBasedGraph->run( inDegree, outDegree, penalties ) )
+		return false;
+	std::vector< char >().swap( inDegree );
+	std::vector< char >().swap( outDegree );
+	std::vector< double >().swap( penalties );
+
+	const unsigned numNodes = edgeBasedGraph->numberOfNodes();
+	std::vector< IImporter::RoutingEdge > turns;
+	edgeBasedGraph->GetEdges( &turns );
+
+	Contractor* contractor = new Contractor( numNodes, turns );
+	contractor->Run();
+
+	std::vector< Contractor::Witness > witnessList;
+	contractor->GetWitnessList( witnessList );
+
+	std::vector< ContractionCleanup::Edge > contractedEdges;
+	std::vector< ContractionCleanup::Edge > contractedLoops;
+	contractor->GetEdges( &contractedEdges );
+	contractor->GetLoops( &contractedLoops );
+	delete contractor;
+
+	std::vector< IRouter::Node > arcNodes;
+	edgeBasedGraph->GetNodes( &arcNodes );
+
+	ContractionCleanup* cleanup = new ContractionCleanup( numNodes, contractedEdges, contractedLoops, witnessList );
+	std::vector< ContractionCleanup::Edge >().swap( contractedEdges );
+	std::vector< ContractionCleanup::Edge >().swap( contractedLoops );
+	std::vector< Contractor::Witness >().swap( witnessList );
+	{
+		std::vector< UnsignedCoordinate > coordinates( numNodes );
+		for ( unsigned node = 0; node < numNodes; node++ )
+			coordinates[node] = arcNodes[node].coordinate;
+		cleanup->SetCoordinates( coordinates );
 	}
+	cleanup->Run();
 
-	for ( std::vector< IImporter::RoutingEdge >::iterator i = inputEdges.begin(), iend = inputEdges.end(); i != iend; i++ ) {
+	std::vector< CompressedGraph::Edge > edges;
+	std::vector< NodeID > map;
+	cleanup->GetData( &edges, &map );
+	delete cleanup;
+
+	std::vector< IRouter::Node > nodes( numNodes );
+	for ( unsigned node = 0; node < numNodes; node++ )
+		nodes[map[node]] = arcNodes[node];
+	std::vector< IRouter::Node >().swap( arcNodes );
+
+	for ( std::vector< IImporter::RoutingEdge >::iterator i = turns.begin(), iend = turns.end(); i != iend; i++ ) {
 		i->source = map[i->source];
 		i->target = map[i->target];
 	}
 
-	CompressedGraphBuilder* builder = new CompressedGraphBuilder( 1u << m_settings.blockSize, nodes, edges, inputEdges, pathNodes );
+	std::vector< IRouter::Node > pathNodes;
+	edgeBasedGraph->GetEdgePaths( &pathNodes );
+
+	CompressedGraphBuilder* builder = new CompressedGraphBuilder( 1u << m_settings.blockSize, nodes, edges, turns, pathNodes );
 	if ( !builder->run( filename, &map ) )
 		return false;
 	delete builder;
 
-	importer->SetIDMap( map );
+	if ( !edgeBasedGraph->writeRoadEdges( filename, map ) )
+		return false;
+
+	// the GPS lookup addresses road edges, which keep their original node ids
+	{
+		std::vector< unsigned > edgeIDs;
+		edgeBasedGraph->GetEdgeIDMap( &edgeIDs );
+		importer->SetEdgeIDMap( edgeIDs );
+	}
+	delete edgeBasedGraph;
+
+	std::vector< NodeID > idMap( inputNodes.size() );
+	for ( unsigned node = 0; node < idMap.size(); node++ )
+		idMap[node] = node;
+	importer->SetIDMap( idMap );
+
+	return true;
+}
+
+bool ContractionHierarchies::readWeights( unsigned numEdges, std::vector< double >* seconds )
+{
+	QFile weightFile( m_settings.weightFile );
+	if ( !openQFile( &weightFile, QIODevice::ReadOnly ) )
+		return false;
+
+	char line[256];
+	qint64 length;
+	while ( ( length = weightFile.readLine( line, sizeof( line ) ) ) > 0 ) {
+		char* end = NULL;
+		double value = strtod( line, &end );
+		if ( end == line ) {
+			qCritical() << "invalid weight in line" << seconds->size() + 1 << "of" << m_settings.weightFile;
+			return false;
+		}
+		seconds->push_back( value );
+	}
 
+	if ( seconds->size() != numEdges ) {
+		qCritical() << "weight file has" << seconds->size() << "weights, the routing graph" << numEdges << "edges";
+		return false;
+	}
 	return true;
 }
 
+bool ContractionHierarchies::preprocessCustomizable( IImporter* importer, QString filename )
+{
+	std::vector< IImporter::RoutingNode > inputNodes;
+	std::vector< IImporter::RoutingEdge > inputEdges;
+
+	if ( !importer->GetRoutingNodes( &inputNodes ) )
+		return false;
+	if ( !importer->GetRoutingEdges( &inputEdges ) )
+		return false;
+
+	const unsigned numEdges = inputEdges.size();
+	std::vector< double > seconds;
+	if ( m_settings.weightFile.isEmpty() ) {
+		seconds.resize( numEdges );
+		for ( unsigned edge = 0; edge < numEdges; edge++ )
+			seconds[edge] = inputEdges[edge].distance;
+	} else if ( !readWeights( numEdges, &seconds ) ) {
+		return false;
+	}
+
+	std::vector< ContractionCleanup::Edge > contractedEdges;
+	std::vector< ContractionCleanup::Edge > contractedLoops;
+	{
+		// the topology only depends on the road network and is kept for the next metric
+		CustomizableContractor contractor( inputNodes, inputEdges );
+		if ( !contractor.loadTopology( filename + "_cch_topology" ) ) {
+			contractor.computeTopology();
+			if ( !contractor.saveTopology( filename + "_cch_topology" ) )
+				return false;
+		}
+		contractor.customize( seconds );
+		contractor.GetEdges( &contractedEdges, &contractedLoops );
+	}
+	std::vector< IImporter::RoutingEdge >().swap( inputEdges );
+
+	// the shortcuts are already minimal, only the node order has to be adapted to the compressed graph
+	std::vector< Contractor::Witness > witnessList;
+	ContractionCleanup* cleanup = new ContractionCleanup( inputNodes.size(), contractedEdges, contractedLoops, witnessList );
+	std::vector< ContractionCleanup::Edge >().swap( contractedEdges );
+	std::vector< ContractionCleanup::Edge >().swap( contractedLoops );
+	{
+		std::vector< UnsignedCoordinate > coordinates( inputNodes.size() );
+		for ( unsigned node = 0; node < inputNodes.size(); node++ )
+			coordinates[node] = inputNodes[node].coordinate;
+		cleanup->SetCoordinates( coordinates );
+	}
+	cleanup->Run( false );
+
+	std::vector< CompressedGraph::Edge > edges;
+	std::vector< NodeID > map;
+	cleanup->GetData( &edges, &map );
+	delete cleanup;
+
+	return buildGraph( importer, filename, &inputNodes, numEdges, &edges, &map, &seconds );
+}
+
 #ifndef NOGUI
 bool ContractionHierarchies::GetSettingsWindow( QWidget** window )
 {
@@ -243,6 +572,11 @@ QString ContractionHierarchies::GetModuleName()
 bool ContractionHierarchies::GetSettingsList( QVector< Setting >* settings )
 {
 	settings->push_back( Setting( "", "block-size", "sets block size of compressed graph to 2^x", "integer > 7" ) );
+	settings->push_back( Setting( "", "turn-costs", "builds an edge-based graph that honours turn penalties and restrictions", "" ) );
+	settings->push_back( Setting( "", "customizable", "contracts in a metric-independent order, reruns only reapply the metric", "" ) );
+	settings->push_back( Setting( "", "weight-file", "travel time in seconds per routing edge, one per line, negative closes the edge", "filename" ) );
+	settings->push_back( Setting( "", "hub-labels", "derives hub labels from the contracted graph, answers distance queries faster", "" ) );
+	settings->push_back( Setting( "", "server-layout", "additionally writes an uncompressed, cache-aligned graph that servers load without decoding", "" ) );
 	return true;
 }
 
@@ -253,6 +587,21 @@ bool ContractionHierarchies::SetSetting( int id, QVariant data )
 	case 0:
 		m_settings.blockSize = data.toInt( &ok );
 		break;
+	case 1:
+		m_settings.turnCosts = true;
+		break;
+	case 2:
+		m_settings.customizable = true;
+		break;
+	case 3:
+		m_settings.weightFile = data.toString();
+		break;
+	case 4:
+		m_settings.hubLabels = true;
+		break;
+	case 5:
+		m_settings.serverLayout = true;
+		break;
 	default:
 		return false;
 	}
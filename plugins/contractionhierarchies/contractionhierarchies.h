@@ -22,8 +22,10 @@ along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <QObject>
 #include "interfaces/ipreprocessor.h"
+#include "interfaces/iimporter.h"
 #include "interfaces/iguisettings.h"
 #include "interfaces/iconsolesettings.h"
+#include "compressedgraph.h"
 
 class ContractionHierarchies :
 		public QObject,
@@ -45,6 +47,16 @@ public:
 	struct Settings
 	{
 		int blockSize;
+		// build an edge-based graph that honours the importer's turn penalties
+		bool turnCosts;
+		// contract in a metric-independent order and only customize the shortcut weights
+		bool customizable;
+		// travel times per routing edge replacing the importer's, used by the customizable mode
+		QString weightFile;
+		// derive hub labels from the contracted graph for fast distance queries
+		bool hubLabels;
+		// additionally write an uncompressed, fixed-width copy of the graph for servers with plenty of memory
+		bool serverLayout;
 	};
 
 	ContractionHierarchies();
@@ -71,6 +83,14 @@ public:
 	virtual bool SetSetting( int id, QVariant data );
 
 protected:
+	bool writeNames( IImporter* importer, QString filename, std::vector< unsigned >* nameMap );
+	bool writeTypes( IImporter* importer, QString filename );
+	bool preprocessTurnCosts( IImporter* importer, QString filename );
+	bool preprocessCustomizable( IImporter* importer, QString filename );
+	bool writeLayout( QString dir, QString filename );
+	bool readWeights( unsigned numEdges, std::vector< double >* seconds );
+	bool buildGraph( IImporter* importer, QString filename, std::vector< IImporter::RoutingNode >* inputNodes, unsigned numEdges, std::vector< CompressedGraph::Edge >* contractedEdges, std::vector< NodeID >* idMap, const std::vector< double >* seconds = NULL );
+
 	Settings m_settings;
 };
 
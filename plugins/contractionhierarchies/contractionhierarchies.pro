@@ -24,6 +24,11 @@ HEADERS += contractionhierarchies.h \
 	 ../../utils/config.h \
 	 compressedgraph.h \
 	 compressedgraphbuilder.h \
+	 edgebasedgraph.h \
+	 roadedgeindex.h \
+	 customizablecontractor.h \
+	 hublabels.h \
+	 hublabelbuilder.h \
 	 ../../utils/bithelpers.h \
 	 ../../utils/qthelpers.h \
 	 ../../interfaces/irouter.h
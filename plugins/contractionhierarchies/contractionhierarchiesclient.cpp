@@ -20,19 +20,45 @@ along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
 #include "contractionhierarchiesclient.h"
 #include "utils/qthelpers.h"
 #include <QtDebug>
+#include <QSettings>
 #include <stack>
 #ifndef NOGUI
 	#include <QMessageBox>
+	#include <QInputDialog>
 #endif
 
 ContractionHierarchiesClient::ContractionHierarchiesClient()
 {
-	m_heapForward = NULL;
-	m_heapBackward = NULL;
+	m_defaultContext = NULL;
+	m_pinnedData = NULL;
+	m_sharedCache = NULL;
+	m_decodedCache = NULL;
+	m_warmupThread = NULL;
+	m_serverLayout = false;
+	QSettings settings( "MoNavClient" );
+	settings.beginGroup( "Contraction Hierarchies" );
+	m_denseHeapIndex = settings.value( "denseHeapIndex", true ).toBool();
+	m_mapGraph = settings.value( "mapGraph", false ).toBool();
+	m_decodedCacheSize = settings.value( "decodedCacheSize", 0 ).toInt();
+	m_unpackCacheSize = settings.value( "unpackCacheSize", 4 ).toInt();
+	m_prefetch = settings.value( "prefetch", true ).toBool();
+	m_warmupSize = settings.value( "warmupSize", 0 ).toInt();
+	m_warmupInBackground = settings.value( "warmupInBackground", true ).toBool();
+	m_sharedCacheSize = settings.value( "sharedCacheSize", 0 ).toInt();
 }
 
 ContractionHierarchiesClient::~ContractionHierarchiesClient()
 {
+	QSettings settings( "MoNavClient" );
+	settings.beginGroup( "Contraction Hierarchies" );
+	settings.setValue( "denseHeapIndex", m_denseHeapIndex );
+	settings.setValue( "mapGraph", m_mapGraph );
+	settings.setValue( "decodedCacheSize", m_decodedCacheSize );
+	settings.setValue( "unpackCacheSize", m_unpackCacheSize );
+	settings.setValue( "prefetch", m_prefetch );
+	settings.setValue( "warmupSize", m_warmupSize );
+	settings.setValue( "warmupInBackground", m_warmupInBackground );
+	settings.setValue( "sharedCacheSize", m_sharedCacheSize );
 	UnloadData();
 }
 
@@ -50,27 +76,61 @@ void ContractionHierarchiesClient::SetInputDirectory( const QString& dir )
 void ContractionHierarchiesClient::ShowSettings()
 {
 #ifndef NOGUI
-	QMessageBox::information( NULL, "Settings", "No settings available" );
+	QMessageBox::StandardButton defaultButton = m_denseHeapIndex ? QMessageBox::Yes : QMessageBox::No;
+	QMessageBox::StandardButton result = QMessageBox::question( NULL, "Settings", "Use a dense heap index?\nIt speeds up routing but needs more memory. Takes effect after reloading the map.", QMessageBox::Yes | QMessageBox::No, defaultButton );
+	m_denseHeapIndex = result == QMessageBox::Yes;
+	defaultButton = m_mapGraph ? QMessageBox::Yes : QMessageBox::No;
+	result = QMessageBox::question( NULL, "Settings", "Memory map the routing graph?\nIt speeds up routing if enough memory is available. Takes effect after reloading the map.", QMessageBox::Yes | QMessageBox::No, defaultButton );
+	m_mapGraph = result == QMessageBox::Yes;
+	bool ok = false;
+	int decodedCacheSize = QInputDialog::getInt( NULL, "Settings", "Enter Decoded Block Cache Size [MB] used by all query threads, 0 disables it", m_decodedCacheSize, 0, 1024, 1, &ok );
+	if ( ok )
+		m_decodedCacheSize = decodedCacheSize;
+	int unpackCacheSize = QInputDialog::getInt( NULL, "Settings", "Enter Unpacked Path Cache Size [MB], 0 disables it", m_unpackCacheSize, 0, 1024, 1, &ok );
+	if ( ok )
+		m_unpackCacheSize = unpackCacheSize;
+	int sharedCacheSize = QInputDialog::getInt( NULL, "Settings", "Enter Shared Block Cache Size [MB] used by all query threads, 0 gives each one a private cache", m_sharedCacheSize, 0, 4096, 1, &ok );
+	if ( ok )
+		m_sharedCacheSize = sharedCacheSize;
+	int warmupSize = QInputDialog::getInt( NULL, "Settings", "Enter Warm-Up Size [MB], 0 disables it", m_warmupSize, 0, 1024, 1, &ok );
+	if ( ok )
+		m_warmupSize = warmupSize;
 #endif
 }
 
 bool ContractionHierarchiesClient::UnloadData()
 {
-	if ( m_heapForward != NULL )
-		delete m_heapForward;
-	m_heapForward = NULL;
-	if ( m_heapBackward != NULL )
-		delete m_heapBackward;
-	m_heapBackward = NULL;
+	if ( m_defaultContext != NULL )
+		delete m_defaultContext;
+	m_defaultContext = NULL;
+	if ( m_warmupThread != NULL ) {
+		m_pinnedData->abort();
+		m_warmupThread->wait();
+		delete m_warmupThread;
+	}
+	m_warmupThread = NULL;
+	if ( m_pinnedData != NULL )
+		delete m_pinnedData;
+	m_pinnedData = NULL;
+	if ( m_sharedCache != NULL )
+		delete m_sharedCache;
+	m_sharedCache = NULL;
+	if ( m_decodedCache != NULL )
+		delete m_decodedCache;
+	m_decodedCache = NULL;
+	m_roadEdges.unload();
+	m_hubLabels.unload();
 	m_types.clear();
-	m_graph.unloadGraph();
+	m_graphFilename.clear();
+	m_serverLayout = false;
 
 	return true;
 }
 
 bool ContractionHierarchiesClient::IsCompatible( int fileFormatVersion )
 {
-	if ( fileFormatVersion == 1 )
+	// version 2 stores an edge-based graph
+	if ( fileFormatVersion == 1 || fileFormatVersion == 2 )
 		return true;
 	return false;
 }
@@ -80,8 +140,58 @@ bool ContractionHierarchiesClient::LoadData()
 	QString filename = fileInDirectory( m_directory,"Contraction Hierarchies" );
 	UnloadData();
 
-	if ( !m_graph.loadGraph( filename, 1024 * 1024 * 4 ) )
+	m_graphFilename = filename;
+
+	{
+		QSettings moduleSettings( fileInDirectory( m_directory, "Module.ini" ), QSettings::IniFormat );
+		m_serverLayout = moduleSettings.value( "contractionHierarchiesLayout", "compressed" ).toString() == "server";
+	}
+
+	// the server layout does not touch the blocks while routing, caching them is pointless
+	if ( m_warmupSize > 0 && !m_serverLayout ) {
+		m_pinnedData = new CompressedGraph::PinnedData;
+		if ( !m_pinnedData->load( filename, ( unsigned long long ) 1024 * 1024 * m_warmupSize ) )
+			return false;
+		if ( m_warmupInBackground ) {
+			m_warmupThread = new WarmupThread( m_pinnedData );
+			m_warmupThread->start();
+		} else {
+			Timer time;
+			m_pinnedData->read();
+			qDebug() << "warm-up:" << m_pinnedData->size() / 1024 / 1024 << "MB in" << time.elapsed() << "ms";
+		}
+	}
+
+	if ( m_sharedCacheSize > 0 && !m_mapGraph && !m_serverLayout ) {
+		m_sharedCache = new CompressedGraph::SharedCache;
+		if ( !m_sharedCache->load( filename, ( unsigned long long ) 1024 * 1024 * m_sharedCacheSize ) )
+			return false;
+	}
+
+	// the server layout needs no decoding at all
+	if ( m_decodedCacheSize > 0 && !m_serverLayout ) {
+		m_decodedCache = new CompressedGraph::DecodedCache;
+		if ( !m_decodedCache->load( filename, ( unsigned long long ) 1024 * 1024 * m_decodedCacheSize ) )
+			return false;
+	}
+
+	m_defaultContext = createSearchContext();
+	if ( m_defaultContext == NULL )
 		return false;
+	if ( m_serverLayout )
+		qDebug() << "loaded the server layout";
+
+	if ( RoadEdgeIndex::exists( filename ) ) {
+		if ( !m_roadEdges.load( filename ) )
+			return false;
+		qDebug() << "loaded edge-based graph with turn costs";
+	}
+
+	if ( HubLabels::exists( filename ) ) {
+		if ( !m_hubLabels.load( filename ) )
+			return false;
+		qDebug() << "loaded hub labels";
+	}
 
 	m_namesFile.setFileName( filename + "_names" );
 	if ( !openQFile( &m_namesFile, QIODevice::ReadOnly ) )
@@ -91,9 +201,6 @@ bool ContractionHierarchiesClient::LoadData()
 		return false;
 	m_namesFile.close();
 
-	m_heapForward = new Heap( m_graph.numberOfNodes() );
-	m_heapBackward = new Heap( m_graph.numberOfNodes() );
-
 	QFile typeFile( filename + "_types" );
 	if ( !openQFile( &typeFile, QIODevice::ReadOnly ) )
 		return false;
@@ -105,19 +212,179 @@ bool ContractionHierarchiesClient::LoadData()
 	return true;
 }
 
+ContractionHierarchiesClient::SearchContext* ContractionHierarchiesClient::createSearchContext()
+{
+	SearchContext* context = new SearchContext;
+	if ( !context->graph.loadGraph( m_graphFilename, 1024 * 1024 * 4, m_mapGraph ) ) {
+		delete context;
+		return NULL;
+	}
+	if ( m_serverLayout && !context->graph.loadServerLayout( m_graphFilename ) ) {
+		delete context;
+		return NULL;
+	}
+	context->graph.setPrefetch( m_prefetch );
+	context->graph.setPinnedData( m_pinnedData );
+	context->graph.setDecodedCache( m_decodedCache );
+	if ( m_sharedCache != NULL && !context->graph.setSharedCache( m_sharedCache ) )
+		qDebug() << "shared block cache is too small for another context, using a private cache";
+	context->unpackedPaths.setMaxCost( 1024 * 1024 * m_unpackCacheSize );
+
+	// a heap size of 0 selects the sparse index
+	unsigned heapSize = m_denseHeapIndex ? context->graph.numberOfNodeIDs() : 0;
+	context->heapForward = new Heap( heapSize );
+	context->heapBackward = new Heap( heapSize );
+	return context;
+}
+
+IRouter::Context* ContractionHierarchiesClient::CreateContext()
+{
+	if ( m_defaultContext == NULL ) {
+		qCritical() << "cannot create a search context: no data loaded";
+		return NULL;
+	}
+	return createSearchContext();
+}
+
+ContractionHierarchiesClient::SearchContext* ContractionHierarchiesClient::searchContext( Context* context )
+{
+	if ( context == NULL ) {
+		assert( m_defaultContext != NULL );
+		return m_defaultContext;
+	}
+	return static_cast< SearchContext* >( context );
+}
+
+void ContractionHierarchiesClient::beginQuery( SearchContext* context )
+{
+	context->lastQuery = Statistics();
+	context->lastQuery.queries = 1;
+	context->blockCacheHits = context->graph.blockCache().hits();
+	context->blockCacheMisses = context->graph.blockCache().misses();
+	context->pathCacheHits = context->graph.pathCache().hits();
+	context->pathCacheMisses = context->graph.pathCache().misses();
+	context->timer.start();
+}
+
+void ContractionHierarchiesClient::endQuery( SearchContext* context )
+{
+	Statistics& statistics = context->lastQuery;
+	double milliseconds = context->timer.nsecsElapsed() / 1000000.0;
+	// only point-to-point queries record when the search ends and the unpacking starts
+	if ( statistics.searchMilliseconds == 0 )
+		statistics.searchMilliseconds = milliseconds;
+	else
+		statistics.unpackMilliseconds = milliseconds - statistics.searchMilliseconds;
+	statistics.blockCacheHits = context->graph.blockCache().hits() - context->blockCacheHits;
+	statistics.blockCacheMisses = context->graph.blockCache().misses() - context->blockCacheMisses;
+	statistics.pathCacheHits = context->graph.pathCache().hits() - context->pathCacheHits;
+	statistics.pathCacheMisses = context->graph.pathCache().misses() - context->pathCacheMisses;
+	context->total += statistics;
+}
+
+bool ContractionHierarchiesClient::GetStatistics( Context* routerContext, Statistics* lastQuery, Statistics* total )
+{
+	if ( routerContext == NULL && m_defaultContext == NULL )
+		return false;
+	SearchContext* context = searchContext( routerContext );
+	if ( lastQuery != NULL )
+		*lastQuery = context->lastQuery;
+	if ( total != NULL )
+		*total = context->total;
+	return true;
+}
+
+bool ContractionHierarchiesClient::ResetStatistics( Context* routerContext )
+{
+	if ( routerContext == NULL && m_defaultContext == NULL )
+		return false;
+	SearchContext* context = searchContext( routerContext );
+	context->lastQuery = Statistics();
+	context->total = Statistics();
+	return true;
+}
+
 bool ContractionHierarchiesClient::GetRoute( double* distance, QVector< Node>* pathNodes, QVector< Edge >* pathEdges, const IGPSLookup::Result& source, const IGPSLookup::Result& target )
+{
+	return GetRoute( m_defaultContext, distance, pathNodes, pathEdges, source, target );
+}
+
+bool ContractionHierarchiesClient::GetRoute( Context* routerContext, double* distance, QVector< Node>* pathNodes, QVector< Edge >* pathEdges, const IGPSLookup::Result& source, const IGPSLookup::Result& target )
+{
+	return GetRoute( routerContext, distance, pathNodes, pathEdges, source, target, QVector< IGPSLookup::Result >() );
+}
+
+bool ContractionHierarchiesClient::GetRoute( Context* routerContext, double* distance, QVector< Node>* pathNodes, QVector< Edge >* pathEdges, const IGPSLookup::Result& source, const IGPSLookup::Result& target, const QVector< IGPSLookup::Result >& blockedEdges )
 {
 	assert( distance != NULL );
-	m_heapForward->Clear();
-	m_heapBackward->Clear();
+	SearchContext* context = searchContext( routerContext );
+	beginQuery( context );
+	CompressedGraph& graph = context->graph;
+	context->heapForward->Clear();
+	context->heapBackward->Clear();
+
+	if ( m_roadEdges.isLoaded() ) {
+		if ( !blockedEdges.empty() ) {
+			qCritical() << "blocked edges are not supported by edge-based graphs";
+			endQuery( context );
+			return false;
+		}
+		*distance = computeEdgeBasedRoute( context, source, target, pathNodes, pathEdges );
+		endQuery( context );
+		if ( *distance == std::numeric_limits< int >::max() )
+			return false;
+		*distance /= 10;
+		return true;
+	}
 
-	*distance = computeRoute( source, target, pathNodes, pathEdges );
-	if ( *distance == std::numeric_limits< int >::max() )
+	if ( blockedEdges.empty() ) {
+		// distance queries only merge the labels of the nodes next to source and target
+		if ( m_hubLabels.isLoaded() && ( pathNodes == NULL || pathEdges == NULL ) )
+			*distance = labelRoute( context, source, target );
+		else
+			*distance = computeRoute( context, source, target, pathNodes, pathEdges );
+	} else {
+		std::vector< EdgeKey >& excludedEdges = context->excludedEdges;
+		for ( int i = 0; i < blockedEdges.size(); i++ ) {
+			const IGPSLookup::Result& blocked = blockedEdges[i];
+			EdgeIterator edge;
+			if ( !graph.findEdge( &edge, blocked.source, blocked.target, blocked.edgeID ) ) {
+				qDebug() << "blocked edge not found in the graph:" << blocked.source << blocked.target << blocked.edgeID;
+				continue;
+			}
+			excludedEdges.push_back( edgeKey( std::max( blocked.source, blocked.target ), edge ) );
+		}
+		std::sort( excludedEdges.begin(), excludedEdges.end() );
+		excludedEdges.resize( std::unique( excludedEdges.begin(), excludedEdges.end() ) - excludedEdges.begin() );
+
+		// the hierarchy does not know about the blocked edges: every shortcut found to contain one is excluded
+		// and the search is repeated, replacing the shortcut with the edges it consists of
+		const unsigned maxRounds = 100;
+		bool usesBlockedEdge = true;
+		for ( unsigned round = 0; round < maxRounds && usesBlockedEdge; round++ ) {
+			context->heapForward->Clear();
+			context->heapBackward->Clear();
+			*distance = computeRoute( context, source, target, pathNodes, pathEdges, &usesBlockedEdge );
+		}
+		excludedEdges.clear();
+		if ( usesBlockedEdge ) {
+			qDebug() << "could not find a route avoiding the blocked edges after" << maxRounds << "searches";
+			endQuery( context );
+			return false;
+		}
+	}
+	if ( *distance == std::numeric_limits< int >::max() ) {
+		endQuery( context );
 		return false;
+	}
 
 	// is it shorter to drive along the edge?
 	if ( target.source == source.source && target.target == source.target && source.edgeID == target.edgeID ) {
-		EdgeIterator targetEdge = m_graph.findEdge( target.source, target.target, target.edgeID );
+		EdgeIterator targetEdge;
+		if ( !findRoadEdge( &graph, target, &targetEdge ) ) {
+			endQuery( context );
+			return false;
+		}
 		double onEdgeDistance = fabs( target.percentage - source.percentage ) * targetEdge.distance();
 		if ( onEdgeDistance < *distance ) {
 			if ( ( targetEdge.forward() && targetEdge.backward() ) || source.percentage < target.percentage ) {
@@ -129,7 +396,7 @@ bool ContractionHierarchiesClient::GetRoute( double* distance, QVector< Node>* p
 
 					QVector< Node > tempNodes;
 					if ( targetEdge.unpacked() )
-						m_graph.path( targetEdge, &tempNodes, pathEdges, target.target == targetEdge.target() );
+						graph.path( targetEdge, &tempNodes, pathEdges, target.target == targetEdge.target() );
 					else
 						pathEdges->push_back( targetEdge.description() );
 
@@ -152,6 +419,290 @@ bool ContractionHierarchiesClient::GetRoute( double* distance, QVector< Node>* p
 	}
 
 	*distance /= 10;
+	endQuery( context );
+	return true;
+}
+
+bool ContractionHierarchiesClient::GetAlternativeRoutes( Context* routerContext, QVector< double >* distances, QVector< QVector< Node > >* pathNodes, QVector< QVector< Edge > >* pathEdges, const IGPSLookup::Result& source, const IGPSLookup::Result& target, unsigned maxAlternatives )
+{
+	// alternatives take at most 25% longer than the shortest route
+	const double maxStretch = 0.25;
+	// alternatives share at most 80% of their travel time with any other route
+	const double maxSharing = 0.8;
+	// subpaths of alternatives up to 25% of the shortest travel time have to be shortest paths
+	const double localOptimality = 0.25;
+	// bounds the time spent on candidates that turn out to be unsuitable
+	const unsigned maxCandidates = 64;
+
+	assert( distances != NULL );
+	const bool describe = pathNodes != NULL && pathEdges != NULL;
+	distances->clear();
+	if ( describe ) {
+		pathNodes->clear();
+		pathEdges->clear();
+	}
+
+	// edge-based graphs and routes along a single edge only get the shortest route
+	const bool sameEdge = target.source == source.source && target.target == source.target && source.edgeID == target.edgeID;
+	if ( m_roadEdges.isLoaded() || sameEdge || maxAlternatives == 0 ) {
+		double distance;
+		QVector< Node > nodes;
+		QVector< Edge > edges;
+		if ( !GetRoute( routerContext, &distance, describe ? &nodes : NULL, describe ? &edges : NULL, source, target ) )
+			return false;
+		distances->push_back( distance );
+		if ( describe ) {
+			pathNodes->push_back( nodes );
+			pathEdges->push_back( edges );
+		}
+		return true;
+	}
+
+	SearchContext* context = searchContext( routerContext );
+	beginQuery( context );
+	Heap* heapForward = context->heapForward;
+	Heap* heapBackward = context->heapBackward;
+	heapForward->Clear();
+	heapBackward->Clear();
+
+	// every node both searches settle is the top of a route through it
+	std::vector< NodeIterator > meetings;
+	NodeIterator middle;
+	const int shortest = searchRoute( context, source, target, &middle, maxStretch, &meetings );
+	if ( shortest == std::numeric_limits< int >::max() ) {
+		endQuery( context );
+		return false;
+	}
+
+	std::vector< std::pair< int, NodeIterator > > candidates;
+	std::sort( meetings.begin(), meetings.end() );
+	meetings.resize( std::unique( meetings.begin(), meetings.end() ) - meetings.begin() );
+	for ( unsigned i = 0; i < meetings.size(); i++ ) {
+		const NodeIterator via = meetings[i];
+		if ( via == middle )
+			continue;
+		// the keys of stalled nodes do not belong to their parents' paths
+		if ( heapForward->GetData( via ).stalled || heapBackward->GetData( via ).stalled )
+			continue;
+		const int distance = heapForward->GetKey( via ) + heapBackward->GetKey( via );
+		if ( distance > shortest * ( 1 + maxStretch ) )
+			continue;
+		candidates.push_back( std::make_pair( distance, via ) );
+	}
+	std::sort( candidates.begin(), candidates.end() );
+
+	std::vector< NodeIterator > routes( 1, middle );
+	std::vector< int > routeDistances( 1, shortest );
+	// original edges of the routes sorted by their nodes, and their travel times
+	std::vector< std::vector< PathEdge > > routeEdges( 1 );
+	std::vector< unsigned > routeLengths( 1, 0 );
+	if ( !viaPath( context, middle, &routeEdges.front(), NULL ) ) {
+		qCritical() << "cannot unpack the shortest route";
+		endQuery( context );
+		return false;
+	}
+	for ( unsigned i = 0; i < routeEdges.front().size(); i++ )
+		routeLengths.front() += routeEdges.front()[i].distance;
+	std::sort( routeEdges.front().begin(), routeEdges.front().end() );
+
+	std::vector< PathEdge > path;
+	for ( unsigned candidate = 0; candidate < candidates.size() && candidate < maxCandidates && routes.size() <= maxAlternatives; candidate++ ) {
+		const NodeIterator via = candidates[candidate].second;
+		unsigned viaIndex;
+		// candidates whose shortcuts cannot be unpacked are rejected
+		if ( !viaPath( context, via, &path, &viaIndex ) )
+			continue;
+
+		// limited sharing, which also removes candidates yielding the same route
+		std::vector< PathEdge > sortedPath( path );
+		std::sort( sortedPath.begin(), sortedPath.end() );
+		bool distinct = true;
+		for ( unsigned route = 0; route < routes.size() && distinct; route++ ) {
+			const std::vector< PathEdge >& edges = routeEdges[route];
+			unsigned shared = 0;
+			std::vector< PathEdge >::const_iterator i = sortedPath.begin();
+			std::vector< PathEdge >::const_iterator j = edges.begin();
+			while ( i != sortedPath.end() && j != edges.end() ) {
+				if ( *i < *j ) {
+					i++;
+				} else if ( *j < *i ) {
+					j++;
+				} else {
+					shared += i->distance;
+					i++;
+					j++;
+				}
+			}
+			distinct = shared <= maxSharing * routeLengths[route];
+		}
+		if ( !distinct )
+			continue;
+
+		if ( !locallyOptimal( context, path, viaIndex, shortest * localOptimality ) )
+			continue;
+
+		routes.push_back( via );
+		routeDistances.push_back( candidates[candidate].first );
+		routeLengths.push_back( 0 );
+		for ( unsigned i = 0; i < path.size(); i++ )
+			routeLengths.back() += path[i].distance;
+		routeEdges.push_back( std::vector< PathEdge >() );
+		routeEdges.back().swap( sortedPath );
+	}
+
+	for ( unsigned route = 0; route < routes.size(); route++ ) {
+		distances->push_back( routeDistances[route] / 10.0 );
+		if ( !describe )
+			continue;
+		pathNodes->push_back( QVector< Node >() );
+		pathEdges->push_back( QVector< Edge >() );
+		describeRoute( context, source, target, routes[route], &pathNodes->back(), &pathEdges->back() );
+	}
+
+	endQuery( context );
+	return true;
+}
+
+bool ContractionHierarchiesClient::GetDistanceTable( Context* routerContext, QVector< double >* result, const QVector< IGPSLookup::Result >& sources, const QVector< IGPSLookup::Result >& targets )
+{
+	assert( result != NULL );
+	SearchContext* context = searchContext( routerContext );
+	beginQuery( context );
+	CompressedGraph& graph = context->graph;
+	Heap* heap = context->heapForward;
+	AllowForwardEdge forward;
+	AllowBackwardEdge backward;
+
+	// backward searches from all targets leave their distances in the buckets of the settled nodes
+	std::vector< BucketEntry > buckets;
+	std::vector< SearchSpaceEntry > searchSpace;
+	std::vector< int > offsets( targets.size() );
+	std::vector< const RoadEdgeIndex::Entry* > targetEdges( targets.size(), NULL );
+	for ( int target = 0; target < targets.size(); target++ ) {
+		heap->Clear();
+		offsets[target] = insertTarget( &graph, heap, targets[target] );
+		if ( m_roadEdges.isLoaded() )
+			targetEdges[target] = m_roadEdges.find( targets[target] );
+		searchSpace.clear();
+		computeSearchSpace( context, heap, backward, forward, &searchSpace );
+		context->lastQuery.settledNodesBackward += searchSpace.size();
+		for ( unsigned i = 0; i < searchSpace.size(); i++ ) {
+			BucketEntry entry;
+			entry.node = searchSpace[i].node;
+			entry.target = target;
+			entry.distance = searchSpace[i].distance;
+			buckets.push_back( entry );
+		}
+	}
+	std::sort( buckets.begin(), buckets.end() );
+
+	// forward searches from all sources scan the buckets of their settled nodes
+	std::vector< int > distances( targets.size() );
+	result->resize( sources.size() * targets.size() );
+	for ( int source = 0; source < sources.size(); source++ ) {
+		heap->Clear();
+		insertSource( &graph, heap, sources[source] );
+		searchSpace.clear();
+		computeSearchSpace( context, heap, forward, backward, &searchSpace );
+		context->lastQuery.settledNodesForward += searchSpace.size();
+
+		const RoadEdgeIndex::Entry* sourceEdge = m_roadEdges.isLoaded() ? m_roadEdges.find( sources[source] ) : NULL;
+		std::fill( distances.begin(), distances.end(), std::numeric_limits< int >::max() );
+		for ( unsigned i = 0; i < searchSpace.size(); i++ ) {
+			BucketEntry key;
+			key.node = searchSpace[i].node;
+			std::vector< BucketEntry >::const_iterator bucket = std::lower_bound( buckets.begin(), buckets.end(), key );
+			for ( ; bucket != buckets.end() && bucket->node == key.node; ++bucket ) {
+				if ( sourceEdge != NULL && targetEdges[bucket->target] == sourceEdge ) {
+					if ( key.node == wrongWayNode( *sourceEdge, sources[source], targets[bucket->target] ) )
+						continue;
+				}
+				const int distance = searchSpace[i].distance + bucket->distance - offsets[bucket->target];
+				if ( distance < distances[bucket->target] )
+					distances[bucket->target] = distance;
+			}
+		}
+
+		for ( int target = 0; target < targets.size(); target++ ) {
+			const IGPSLookup::Result& sourcePosition = sources[source];
+			const IGPSLookup::Result& targetPosition = targets[target];
+			double distance = distances[target];
+			// is it shorter to drive along the edge?
+			// edge-based graphs already consider it during the search
+			if ( !m_roadEdges.isLoaded() && targetPosition.source == sourcePosition.source && targetPosition.target == sourcePosition.target && sourcePosition.edgeID == targetPosition.edgeID ) {
+				EdgeIterator edge;
+				if ( findRoadEdge( &graph, targetPosition, &edge ) && ( ( edge.forward() && edge.backward() ) || sourcePosition.percentage < targetPosition.percentage ) )
+					distance = std::min( distance, fabs( targetPosition.percentage - sourcePosition.percentage ) * edge.distance() );
+			}
+			if ( distance == std::numeric_limits< int >::max() )
+				( *result )[source * targets.size() + target] = std::numeric_limits< double >::max();
+			else
+				( *result )[source * targets.size() + target] = distance / 10;
+		}
+	}
+
+	endQuery( context );
+	return true;
+}
+
+bool ContractionHierarchiesClient::GetReachableNodes( Context* routerContext, QVector< Node >* nodes, QVector< double >* seconds, const IGPSLookup::Result& source, double maxSeconds )
+{
+	assert( nodes != NULL );
+	assert( seconds != NULL );
+	SearchContext* context = searchContext( routerContext );
+	beginQuery( context );
+	CompressedGraph& graph = context->graph;
+	Heap* heap = context->heapForward;
+	AllowForwardEdge forward;
+	AllowBackwardEdge backward;
+	// half the range keeps the sums of the search space below the overflow
+	const int maxDistance = std::min( maxSeconds * 10, ( double ) ( std::numeric_limits< int >::max() / 2 ) );
+
+	// upward search from the source
+	std::vector< SearchSpaceEntry > searchSpace;
+	heap->Clear();
+	if ( !insertSource( &graph, heap, source ) ) {
+		endQuery( context );
+		return false;
+	}
+	computeSearchSpace( context, heap, forward, backward, &searchSpace, maxDistance );
+	context->lastQuery.settledNodesForward += searchSpace.size();
+
+	std::vector< int >& distances = context->sweepDistances;
+	distances.assign( graph.numberOfNodeIDs(), std::numeric_limits< int >::max() );
+	for ( unsigned i = 0; i < searchSpace.size(); i++ )
+		distances[searchSpace[i].node] = searchSpace[i].distance;
+
+	// downward sweep in rank order ( PHAST ):
+	// all edges point to higher ranked nodes, which are already final when a node is scanned
+	nodes->clear();
+	seconds->clear();
+	const unsigned numberOfBlocks = graph.numberOfBlocks();
+	for ( unsigned block = 0; block < numberOfBlocks; block++ ) {
+		const unsigned nodeCount = graph.blockNodeCount( block );
+		for ( unsigned internal = 0; internal < nodeCount; internal++ ) {
+			const NodeIterator node = graph.blockNode( block, internal );
+			int distance = distances[node];
+			for ( EdgeIterator edge = graph.edges( node ); edge.hasEdgesLeft(); ) {
+				graph.unpackNextEdge( &edge );
+				if ( !edge.backward() )
+					continue;
+				const int fromDistance = distances[edge.target()];
+				if ( fromDistance > maxDistance )
+					continue;
+				const long long newDistance = ( long long ) fromDistance + edge.distance();
+				if ( newDistance < distance )
+					distance = newDistance;
+			}
+			distances[node] = distance;
+			if ( distance > maxDistance )
+				continue;
+			nodes->push_back( graph.node( node ) );
+			seconds->push_back( distance / 10.0 );
+		}
+	}
+
+	endQuery( context );
 	return true;
 }
 
@@ -184,13 +735,22 @@ bool ContractionHierarchiesClient::GetTypes( QVector< QString >* result, QVector
 }
 
 template< class EdgeAllowed, class StallEdgeAllowed >
-void ContractionHierarchiesClient::computeStep( Heap* heapForward, Heap* heapBackward, const EdgeAllowed& edgeAllowed, const StallEdgeAllowed& stallEdgeAllowed, NodeIterator* middle, int* targetDistance ) {
+void ContractionHierarchiesClient::computeStep( SearchContext* context, Heap* heapForward, Heap* heapBackward, const EdgeAllowed& edgeAllowed, const StallEdgeAllowed& stallEdgeAllowed, NodeIterator* middle, int* targetDistance, double stretch, std::vector< NodeIterator >* meetings ) {
 
+	CompressedGraph& graph = context->graph;
+	std::queue< NodeIterator >& stallQueue = context->stallQueue;
+	Statistics& statistics = context->lastQuery;
 	const NodeIterator node = heapForward->DeleteMin();
 	const int distance = heapForward->GetKey( node );
 
-	if ( heapForward->GetData( node ).stalled )
+	if ( heapForward->GetData( node ).stalled ) {
+		statistics.stalledNodes++;
 		return;
+	}
+	if ( heapForward == context->heapForward )
+		statistics.settledNodesForward++;
+	else
+		statistics.settledNodesBackward++;
 
 	if ( heapBackward->WasInserted( node ) && !heapBackward->GetData( node ).stalled ) {
 		const int newDistance = heapBackward->GetKey( node ) + distance;
@@ -198,14 +758,25 @@ void ContractionHierarchiesClient::computeStep( Heap* heapForward, Heap* heapBac
 			*middle = node;
 			*targetDistance = newDistance;
 		}
+		if ( meetings != NULL )
+			meetings->push_back( node );
 	}
 
-	if ( distance > *targetDistance ) {
+	if ( distance > *targetDistance * ( 1 + stretch ) ) {
 		heapForward->DeleteAll();
 		return;
 	}
-	for ( EdgeIterator edge = m_graph.edges( node ); edge.hasEdgesLeft(); ) {
-		m_graph.unpackNextEdge( &edge );
+	// excluded shortcuts are replaced after the scan: walking their middle nodes accesses other blocks,
+	// which may evict the block the iterator reads from
+	std::vector< NodeIterator >& excludedMiddles = context->excludedMiddles;
+	excludedMiddles.clear();
+	for ( EdgeIterator edge = graph.edges( node ); edge.hasEdgesLeft(); ) {
+		graph.unpackNextEdge( &edge );
+		if ( isExcluded( context, node, edge ) ) {
+			if ( edge.shortcut() && edgeAllowed( edge.forward(), edge.backward() ) )
+				excludedMiddles.push_back( edge.middle() );
+			continue;
+		}
 		const NodeIterator to = edge.target();
 		const int edgeWeight = edge.distance();
 		assert( edgeWeight > 0 );
@@ -219,20 +790,22 @@ void ContractionHierarchiesClient::computeStep( Heap* heapForward, Heap* heapBac
 				//insert node into the stall queue
 				heapForward->GetKey( node ) = shorterDistance;
 				heapForward->GetData( node ).stalled = true;
-				m_stallQueue.push( node );
+				stallQueue.push( node );
 
-				while ( !m_stallQueue.empty() ) {
+				while ( !stallQueue.empty() ) {
 					//get node from the queue
-					const NodeIterator stallNode = m_stallQueue.front();
-					m_stallQueue.pop();
+					const NodeIterator stallNode = stallQueue.front();
+					stallQueue.pop();
 					const int stallDistance = heapForward->GetKey( stallNode );
 
 					//iterate over outgoing edges
-					for ( EdgeIterator stallEdge = m_graph.edges( stallNode ); stallEdge.hasEdgesLeft(); ) {
-						m_graph.unpackNextEdge( &stallEdge );
+					for ( EdgeIterator stallEdge = graph.edges( stallNode ); stallEdge.hasEdgesLeft(); ) {
+						graph.unpackNextEdge( &stallEdge );
 						//is edge outgoing/reached/stalled?
 						if ( !edgeAllowed( stallEdge.forward(), stallEdge.backward() ) )
 							continue;
+						if ( isExcluded( context, stallNode, stallEdge ) )
+							continue;
 						const NodeIterator stallTo = stallEdge.target();
 						if ( !heapForward->WasInserted( stallTo ) )
 							continue;
@@ -247,7 +820,7 @@ void ContractionHierarchiesClient::computeStep( Heap* heapForward, Heap* heapBac
 							else
 								heapForward->DecreaseKey( stallTo, stallToDistance );
 
-							m_stallQueue.push( stallTo );
+							stallQueue.push( stallTo );
 							heapForward->GetData( stallTo ).stalled = true;
 						}
 					}
@@ -257,6 +830,7 @@ void ContractionHierarchiesClient::computeStep( Heap* heapForward, Heap* heapBac
 		}
 
 		if ( edgeAllowed( edge.forward(), edge.backward() ) ) {
+			statistics.relaxedEdges++;
 			//New Node discovered -> Add to Heap + Node Info Storage
 			if ( !heapForward->WasInserted( to ) )
 				heapForward->Insert( to, toDistance, node );
@@ -267,53 +841,245 @@ void ContractionHierarchiesClient::computeStep( Heap* heapForward, Heap* heapBac
 				//new parent + unstall
 				heapForward->GetData( to ).parent = node;
 				heapForward->GetData( to ).stalled = false;
+				heapForward->GetData( to ).descended = false;
+			}
+		}
+	}
+	if ( !excludedMiddles.empty() )
+		relaxExcludedShortcuts( context, heapForward, node, distance, stallEdgeAllowed );
+}
+
+template< class EdgeAllowed, class StallEdgeAllowed >
+void ContractionHierarchiesClient::computeSearchSpace( SearchContext* context, Heap* heap, const EdgeAllowed& edgeAllowed, const StallEdgeAllowed& stallEdgeAllowed, std::vector< SearchSpaceEntry >* searchSpace, int maxDistance )
+{
+	CompressedGraph& graph = context->graph;
+	while ( heap->Size() > 0 ) {
+		const NodeIterator node = heap->DeleteMin();
+		const int distance = heap->GetKey( node );
+		if ( distance > maxDistance ) {
+			heap->DeleteAll();
+			return;
+		}
+
+		// stall-on-demand: a higher node proves that the distance is not optimal
+		bool stalled = false;
+		for ( EdgeIterator edge = graph.edges( node ); edge.hasEdgesLeft(); ) {
+			graph.unpackNextEdge( &edge );
+			if ( !stallEdgeAllowed( edge.forward(), edge.backward() ) )
+				continue;
+			const NodeIterator to = edge.target();
+			if ( heap->WasInserted( to ) && heap->GetKey( to ) + ( int ) edge.distance() < distance ) {
+				stalled = true;
+				break;
+			}
+		}
+		if ( stalled ) {
+			context->lastQuery.stalledNodes++;
+			continue;
+		}
+
+		SearchSpaceEntry entry;
+		entry.node = node;
+		entry.distance = distance;
+		searchSpace->push_back( entry );
+
+		for ( EdgeIterator edge = graph.edges( node ); edge.hasEdgesLeft(); ) {
+			graph.unpackNextEdge( &edge );
+			if ( !edgeAllowed( edge.forward(), edge.backward() ) )
+				continue;
+			context->lastQuery.relaxedEdges++;
+			const NodeIterator to = edge.target();
+			const int toDistance = distance + edge.distance();
+			if ( !heap->WasInserted( to ) )
+				heap->Insert( to, toDistance, node );
+			else if ( !heap->WasRemoved( to ) && toDistance < heap->GetKey( to ) ) {
+				heap->DecreaseKey( to, toDistance );
+				heap->GetData( to ).parent = node;
 			}
 		}
 	}
 }
 
-int ContractionHierarchiesClient::computeRoute( const IGPSLookup::Result& source, const IGPSLookup::Result& target, QVector< Node>* pathNodes, QVector< Edge >* pathEdges ) {
-	EdgeIterator sourceEdge = m_graph.findEdge( source.source, source.target, source.edgeID );
+bool ContractionHierarchiesClient::findRoadEdge( CompressedGraph* graph, const IGPSLookup::Result& position, EdgeIterator* edge )
+{
+	if ( !graph->findEdge( edge, position.source, position.target, position.edgeID ) )
+		return false;
+	// closed roads are kept for the GPS lookup only
+	return edge->forward() || edge->backward();
+}
+
+bool ContractionHierarchiesClient::insertSource( CompressedGraph* graph, Heap* heap, const IGPSLookup::Result& source, NodeIterator excluded )
+{
+	if ( m_roadEdges.isLoaded() ) {
+		const RoadEdgeIndex::Entry* sourceEdge = m_roadEdges.find( source );
+		if ( sourceEdge == NULL )
+			return false;
+		unsigned sourceWeight = sourceEdge->distance;
+		if ( sourceEdge->forwardNode != excluded )
+			heap->Insert( sourceEdge->forwardNode, sourceWeight - sourceWeight * source.percentage, sourceEdge->forwardNode );
+		if ( sourceEdge->backwardNode != RoadEdgeIndex::noNode && sourceEdge->backwardNode != excluded )
+			heap->Insert( sourceEdge->backwardNode, sourceWeight * source.percentage, sourceEdge->backwardNode );
+		return true;
+	}
+
+	EdgeIterator sourceEdge;
+	if ( !findRoadEdge( graph, source, &sourceEdge ) )
+		return false;
+	unsigned sourceWeight = sourceEdge.distance();
+	heap->Insert( source.target, sourceWeight - sourceWeight * source.percentage, source.target );
+	if ( sourceEdge.backward() && sourceEdge.forward() && source.target != source.source )
+		heap->Insert( source.source, sourceWeight * source.percentage, source.source );
+	return true;
+}
+
+int ContractionHierarchiesClient::insertTarget( CompressedGraph* graph, Heap* heap, const IGPSLookup::Result& target )
+{
+	if ( m_roadEdges.isLoaded() ) {
+		const RoadEdgeIndex::Entry* targetEdge = m_roadEdges.find( target );
+		if ( targetEdge == NULL )
+			return 0;
+		// reaching a node includes the whole road edge, the part behind the target has to be subtracted
+		// the edge's weight is added to keep the keys positive
+		unsigned targetWeight = targetEdge->distance;
+		heap->Insert( targetEdge->forwardNode, targetWeight * target.percentage, targetEdge->forwardNode );
+		if ( targetEdge->backwardNode != RoadEdgeIndex::noNode )
+			heap->Insert( targetEdge->backwardNode, targetWeight - targetWeight * target.percentage, targetEdge->backwardNode );
+		return targetWeight;
+	}
+
+	EdgeIterator targetEdge;
+	if ( !findRoadEdge( graph, target, &targetEdge ) )
+		return 0;
+	unsigned targetWeight = targetEdge.distance();
+	heap->Insert( target.source, targetWeight * target.percentage, target.source );
+	if ( targetEdge.backward() && targetEdge.forward() && target.target != target.source )
+		heap->Insert( target.target, targetWeight - targetWeight * target.percentage, target.target );
+	return 0;
+}
+
+int ContractionHierarchiesClient::labelRoute( SearchContext* context, const IGPSLookup::Result& source, const IGPSLookup::Result& target )
+{
+	CompressedGraph& graph = context->graph;
+	// the same nodes and offsets insertSource and insertTarget would insert into the heaps
+	NodeIterator sources[2];
+	int sourceOffsets[2];
+	unsigned numberOfSources = 0;
+	EdgeIterator sourceEdge;
+	if ( !findRoadEdge( &graph, source, &sourceEdge ) )
+		return std::numeric_limits< int >::max();
+	unsigned sourceWeight = sourceEdge.distance();
+	sources[numberOfSources] = source.target;
+	sourceOffsets[numberOfSources++] = sourceWeight - sourceWeight * source.percentage;
+	if ( sourceEdge.backward() && sourceEdge.forward() && source.target != source.source ) {
+		sources[numberOfSources] = source.source;
+		sourceOffsets[numberOfSources++] = sourceWeight * source.percentage;
+	}
+
+	NodeIterator targets[2];
+	int targetOffsets[2];
+	unsigned numberOfTargets = 0;
+	EdgeIterator targetEdge;
+	if ( !findRoadEdge( &graph, target, &targetEdge ) )
+		return std::numeric_limits< int >::max();
+	unsigned targetWeight = targetEdge.distance();
+	targets[numberOfTargets] = target.source;
+	targetOffsets[numberOfTargets++] = targetWeight * target.percentage;
+	if ( targetEdge.backward() && targetEdge.forward() && target.target != target.source ) {
+		targets[numberOfTargets] = target.target;
+		targetOffsets[numberOfTargets++] = targetWeight - targetWeight * target.percentage;
+	}
+
+	int result = std::numeric_limits< int >::max();
+	for ( unsigned i = 0; i < numberOfSources; i++ ) {
+		for ( unsigned j = 0; j < numberOfTargets; j++ ) {
+			unsigned labelDistance = m_hubLabels.distance( sources[i], targets[j] );
+			if ( labelDistance == std::numeric_limits< unsigned >::max() )
+				continue;
+			result = std::min( result, sourceOffsets[i] + targetOffsets[j] + ( int ) labelDistance );
+		}
+	}
+	return result;
+}
+
+int ContractionHierarchiesClient::searchRoute( SearchContext* context, const IGPSLookup::Result& source, const IGPSLookup::Result& target, NodeIterator* middle, double stretch, std::vector< NodeIterator >* meetings ) {
+	CompressedGraph& graph = context->graph;
+	Heap* heapForward = context->heapForward;
+	Heap* heapBackward = context->heapBackward;
+	*middle = ( NodeIterator ) 0;
+	EdgeIterator sourceEdge;
+	EdgeIterator targetEdge;
+	if ( !findRoadEdge( &graph, source, &sourceEdge ) || !findRoadEdge( &graph, target, &targetEdge ) ) {
+		qDebug() << "source or target edge is closed or not part of the graph";
+		return std::numeric_limits< int >::max();
+	}
 	unsigned sourceWeight = sourceEdge.distance();
-	EdgeIterator targetEdge = m_graph.findEdge( target.source, target.target, target.edgeID );
 	unsigned targetWeight = targetEdge.distance();
 
 	//insert source into heap
-	m_heapForward->Insert( source.target, sourceWeight - sourceWeight * source.percentage, source.target );
+	heapForward->Insert( source.target, sourceWeight - sourceWeight * source.percentage, source.target );
 	if ( sourceEdge.backward() && sourceEdge.forward() && source.target != source.source )
-		m_heapForward->Insert( source.source, sourceWeight * source.percentage, source.source );
+		heapForward->Insert( source.source, sourceWeight * source.percentage, source.source );
 
 	//insert target into heap
-	m_heapBackward->Insert( target.source, targetWeight * target.percentage, target.source );
+	heapBackward->Insert( target.source, targetWeight * target.percentage, target.source );
 	if ( targetEdge.backward() && targetEdge.forward() && target.target != target.source )
-		m_heapBackward->Insert( target.target, targetWeight - targetWeight * target.percentage, target.target );
+		heapBackward->Insert( target.target, targetWeight - targetWeight * target.percentage, target.target );
 
 	int targetDistance = std::numeric_limits< int >::max();
-	NodeIterator middle = ( NodeIterator ) 0;
 	AllowForwardEdge forward;
 	AllowBackwardEdge backward;
 
-	while ( m_heapForward->Size() + m_heapBackward->Size() > 0 ) {
+	while ( heapForward->Size() + heapBackward->Size() > 0 ) {
 
-		if ( m_heapForward->Size() > 0 )
-			computeStep( m_heapForward, m_heapBackward, forward, backward, &middle, &targetDistance );
+		if ( heapForward->Size() > 0 )
+			computeStep( context, heapForward, heapBackward, forward, backward, middle, &targetDistance, stretch, meetings );
 
-		if ( m_heapBackward->Size() > 0 )
-			computeStep( m_heapBackward, m_heapForward, backward, forward, &middle, &targetDistance );
+		if ( heapBackward->Size() > 0 )
+			computeStep( context, heapBackward, heapForward, backward, forward, middle, &targetDistance, stretch, meetings );
 
 	}
 
-	if ( targetDistance == std::numeric_limits< int >::max() )
+	context->lastQuery.searchMilliseconds = context->timer.nsecsElapsed() / 1000000.0;
+	return targetDistance;
+}
+
+int ContractionHierarchiesClient::computeRoute( SearchContext* context, const IGPSLookup::Result& source, const IGPSLookup::Result& target, QVector< Node>* pathNodes, QVector< Edge >* pathEdges, bool* usesBlockedEdge ) {
+	NodeIterator middle;
+	const int targetDistance = searchRoute( context, source, target, &middle );
+
+	if ( targetDistance == std::numeric_limits< int >::max() ) {
+		if ( usesBlockedEdge != NULL )
+			*usesBlockedEdge = false;
 		return std::numeric_limits< int >::max();
+	}
+
+	if ( usesBlockedEdge != NULL ) {
+		*usesBlockedEdge = excludeBlockedSearchPath( context, middle );
+		if ( *usesBlockedEdge )
+			return targetDistance;
+	}
 
 	// abort early if the path description is not requested
 	if ( pathNodes == NULL || pathEdges == NULL )
 		return targetDistance;
 
+	describeRoute( context, source, target, middle, pathNodes, pathEdges );
+	return targetDistance;
+}
+
+void ContractionHierarchiesClient::describeRoute( SearchContext* context, const IGPSLookup::Result& source, const IGPSLookup::Result& target, NodeIterator middle, QVector< Node>* pathNodes, QVector< Edge >* pathEdges ) {
+	CompressedGraph& graph = context->graph;
+	Heap* heapForward = context->heapForward;
+	Heap* heapBackward = context->heapBackward;
+	EdgeIterator sourceEdge;
+	EdgeIterator targetEdge;
+	if ( !findRoadEdge( &graph, source, &sourceEdge ) || !findRoadEdge( &graph, target, &targetEdge ) )
+		return;
+
 	std::stack< NodeIterator > stack;
 	NodeIterator pathNode = middle;
 	while ( true ) {
-		NodeIterator parent = m_heapForward->GetData( pathNode ).parent;
+		NodeIterator parent = heapForward->GetData( pathNode ).parent;
 		stack.push( pathNode );
 		if ( parent == pathNode )
 			break;
@@ -326,14 +1092,14 @@ int ContractionHierarchiesClient::computeRoute( const IGPSLookup::Result& source
 		reverseSourceDescription = !reverseSourceDescription;
 	if ( sourceEdge.unpacked() ) {
 		bool unpackSourceForward = source.target != sourceEdge.target() ? reverseSourceDescription : !reverseSourceDescription;
-		m_graph.path( sourceEdge, pathNodes, pathEdges, unpackSourceForward );
+		graph.path( sourceEdge, pathNodes, pathEdges, unpackSourceForward );
 		if ( reverseSourceDescription ) {
 			pathNodes->remove( 1, pathNodes->size() - 1 - source.previousWayCoordinates );
 		} else {
 			pathNodes->remove( 1, source.previousWayCoordinates - 1 );
 		}
 	} else {
-		pathNodes->push_back( m_graph.node( pathNode ) );
+		pathNodes->push_back( graph.node( pathNode ) );
 		pathEdges->push_back( sourceEdge.description() );
 	}
 	pathEdges->front().length = pathNodes->size() - 1;
@@ -342,15 +1108,15 @@ int ContractionHierarchiesClient::computeRoute( const IGPSLookup::Result& source
 	while ( stack.size() > 1 ) {
 		const NodeIterator node = stack.top();
 		stack.pop();
-		unpackEdge( node, stack.top(), true, pathNodes, pathEdges );
+		unpackSearchEdge( context, node, stack.top(), heapForward, true, pathNodes, pathEdges );
 	}
 
 	pathNode = middle;
 	while ( true ) {
-		NodeIterator parent = m_heapBackward->GetData( pathNode ).parent;
+		NodeIterator parent = heapBackward->GetData( pathNode ).parent;
 		if ( parent == pathNode )
 			break;
-		unpackEdge( parent, pathNode, false, pathNodes, pathEdges );
+		unpackSearchEdge( context, parent, pathNode, heapBackward, false, pathNodes, pathEdges );
 		pathNode = parent;
 	}
 
@@ -360,7 +1126,7 @@ int ContractionHierarchiesClient::computeRoute( const IGPSLookup::Result& source
 		reverseTargetDescription = !reverseTargetDescription;
 	if ( targetEdge.unpacked() ) {
 		bool unpackTargetForward = target.target != targetEdge.target() ? reverseTargetDescription : !reverseTargetDescription;
-		m_graph.path( targetEdge, pathNodes, pathEdges, unpackTargetForward );
+		graph.path( targetEdge, pathNodes, pathEdges, unpackTargetForward );
 		if ( reverseTargetDescription ) {
 			pathNodes->resize( pathNodes->size() - target.previousWayCoordinates );
 		} else {
@@ -372,16 +1138,451 @@ int ContractionHierarchiesClient::computeRoute( const IGPSLookup::Result& source
 	pathNodes->push_back( target.nearestPoint );
 	pathEdges->back().length = pathNodes->size() - begin;
 	pathEdges->back().seconds *= reverseTargetDescription ? 1 - target.percentage : target.percentage;
+}
 
-	return targetDistance;
+bool ContractionHierarchiesClient::viaPath( SearchContext* context, NodeIterator via, std::vector< PathEdge >* path, unsigned* viaIndex )
+{
+	path->clear();
+	std::vector< NodeIterator > upward;
+	NodeIterator node = via;
+	while ( true ) {
+		upward.push_back( node );
+		NodeIterator parent = context->heapForward->GetData( node ).parent;
+		if ( parent == node )
+			break;
+		node = parent;
+	}
+	for ( unsigned i = upward.size() - 1; i > 0; i-- ) {
+		if ( !unpackPathEdges( context, upward[i], upward[i - 1], true, path ) )
+			return false;
+	}
+
+	if ( viaIndex != NULL )
+		*viaIndex = path->size();
+
+	node = via;
+	while ( true ) {
+		NodeIterator parent = context->heapBackward->GetData( node ).parent;
+		if ( parent == node )
+			break;
+		if ( !unpackPathEdges( context, parent, node, false, path ) )
+			return false;
+		node = parent;
+	}
+	return true;
+}
+
+// the same traversal as unpackEdge, but only the original edges are recorded
+bool ContractionHierarchiesClient::unpackPathEdges( SearchContext* context, NodeIterator source, NodeIterator target, bool forward, std::vector< PathEdge >* path )
+{
+	std::vector< UnpackEntry >& stack = context->unpackStack;
+	stack.clear();
+	UnpackEntry root;
+	if ( !findShortestEdge( context, source, target, forward, &root.edge ) )
+		return false;
+	root.source = source;
+	root.target = target;
+	root.forward = forward;
+	stack.push_back( root );
+
+	while ( !stack.empty() ) {
+		const UnpackEntry entry = stack.back();
+		stack.pop_back();
+		const EdgeIterator& edge = entry.edge;
+
+		if ( !edge.shortcut() ) {
+			PathEdge pathEdge;
+			pathEdge.from = entry.forward ? entry.source : entry.target;
+			pathEdge.to = entry.forward ? entry.target : entry.source;
+			pathEdge.distance = edge.distance();
+			path->push_back( pathEdge );
+			continue;
+		}
+
+		const NodeIterator middle = edge.middle();
+		UnpackEntry firstHalf;
+		firstHalf.source = middle;
+		firstHalf.target = entry.forward ? entry.source : entry.target;
+		firstHalf.forward = false;
+		UnpackEntry secondHalf;
+		secondHalf.source = middle;
+		secondHalf.target = entry.forward ? entry.target : entry.source;
+		secondHalf.forward = true;
+		if ( !findShortcutHalves( context, middle, firstHalf.target, secondHalf.target, &firstHalf.edge, &secondHalf.edge ) )
+			return false;
+		stack.push_back( secondHalf );
+		stack.push_back( firstHalf );
+	}
+	return true;
+}
+
+// a route through a via node can contain a detour around it, e.g., leaving the highway to take the next ramp back on
+// the part of the route at least length before and after the via node has to be a shortest path ( T-test )
+bool ContractionHierarchiesClient::locallyOptimal( SearchContext* context, const std::vector< PathEdge >& path, unsigned viaIndex, int length )
+{
+	if ( path.empty() )
+		return true;
+
+	unsigned begin = viaIndex;
+	int before = 0;
+	while ( begin > 0 && before < length ) {
+		begin--;
+		before += path[begin].distance;
+	}
+	unsigned end = viaIndex;
+	int after = 0;
+	while ( end < path.size() && after < length ) {
+		after += path[end].distance;
+		end++;
+	}
+
+	const NodeIterator from = begin < path.size() ? path[begin].from : path.back().to;
+	const NodeIterator to = end < path.size() ? path[end].from : path.back().to;
+	if ( from == to )
+		return before + after == 0;
+
+	if ( context->heapLocalForward == NULL ) {
+		context->heapLocalForward = new Heap( 0 );
+		context->heapLocalBackward = new Heap( 0 );
+	}
+	Heap* heapForward = context->heapLocalForward;
+	Heap* heapBackward = context->heapLocalBackward;
+	heapForward->Clear();
+	heapBackward->Clear();
+	heapForward->Insert( from, 0, from );
+	heapBackward->Insert( to, 0, to );
+
+	// only a strictly shorter path fails the test
+	int distance = before + after;
+	NodeIterator middle = from;
+	AllowForwardEdge forward;
+	AllowBackwardEdge backward;
+	while ( heapForward->Size() + heapBackward->Size() > 0 ) {
+		if ( heapForward->Size() > 0 )
+			computeStep( context, heapForward, heapBackward, forward, backward, &middle, &distance );
+		if ( heapBackward->Size() > 0 )
+			computeStep( context, heapBackward, heapForward, backward, forward, &middle, &distance );
+	}
+	return distance == before + after;
+}
+
+ContractionHierarchiesClient::NodeIterator ContractionHierarchiesClient::wrongWayNode( const RoadEdgeIndex::Entry& edge, const IGPSLookup::Result& source, const IGPSLookup::Result& target )
+{
+	// source and target on the same road edge: the direction leading away from the target only reaches it
+	// after leaving the road edge and coming back, meeting right at its node would skip that loop
+	if ( source.percentage > target.percentage )
+		return edge.forwardNode;
+	if ( source.percentage < target.percentage )
+		return edge.backwardNode;
+	return RoadEdgeIndex::noNode;
+}
+
+void ContractionHierarchiesClient::insertTurns( SearchContext* context, Heap* heap, const RoadEdgeIndex::Entry& edge, NodeIterator node, int distance )
+{
+	// the turns leave the road network's node at the end of the road edge
+	const NodeID roadNode = node == edge.forwardNode ? edge.target : edge.source;
+	std::vector< NodeID >& arcs = context->turnArcs;
+	m_roadEdges.arcsLeaving( roadNode, &arcs );
+	for ( unsigned i = 0; i < arcs.size(); i++ ) {
+		const NodeIterator to = arcs[i];
+		if ( to == node )
+			continue;
+		// the turn is stored at the lower of both nodes, forbidden turns have no edge at all
+		EdgeIterator turn;
+		bool descended = false;
+		if ( !findShortestEdge( context, node, to, true, &turn ) ) {
+			if ( !findShortestEdge( context, to, node, false, &turn ) )
+				continue;
+			descended = true;
+		}
+		const int toDistance = distance + turn.distance();
+		if ( !heap->WasInserted( to ) ) {
+			heap->Insert( to, toDistance, to );
+			heap->GetData( to ).descended = descended;
+		} else if ( toDistance < heap->GetKey( to ) ) {
+			heap->DecreaseKey( to, toDistance );
+			heap->GetData( to ).parent = to;
+			heap->GetData( to ).descended = descended;
+		}
+	}
+}
+
+void ContractionHierarchiesClient::appendRoadEdgePath( const RoadEdgeIndex::Entry& edge, bool forward, unsigned from, unsigned to, QVector< Node >* pathNodes )
+{
+	// positions are given by the amount of coordinates in front of them
+	if ( forward ) {
+		for ( unsigned i = from; i < to; i++ )
+			pathNodes->push_back( m_roadEdges.coordinate( edge, i ) );
+	} else {
+		for ( unsigned i = from; i > to; i-- )
+			pathNodes->push_back( m_roadEdges.coordinate( edge, i - 1 ) );
+	}
+}
+
+int ContractionHierarchiesClient::computeEdgeBasedRoute( SearchContext* context, const IGPSLookup::Result& source, const IGPSLookup::Result& target, QVector< Node>* pathNodes, QVector< Edge >* pathEdges )
+{
+	CompressedGraph& graph = context->graph;
+	Heap* heapForward = context->heapForward;
+	Heap* heapBackward = context->heapBackward;
+	const RoadEdgeIndex::Entry* sourceEdge = m_roadEdges.find( source );
+	const RoadEdgeIndex::Entry* targetEdge = m_roadEdges.find( target );
+	if ( sourceEdge == NULL || targetEdge == NULL ) {
+		qCritical() << "road edge is not part of the edge-based graph";
+		return std::numeric_limits< int >::max();
+	}
+
+	// a route starting in the direction leading away from the target has to begin with one of the turns at its end
+	NodeIterator wrongWay = RoadEdgeIndex::noNode;
+	if ( sourceEdge == targetEdge )
+		wrongWay = wrongWayNode( *sourceEdge, source, target );
+	insertSource( &graph, heapForward, source, wrongWay );
+	if ( wrongWay != RoadEdgeIndex::noNode ) {
+		const unsigned sourceWeight = sourceEdge->distance;
+		const int wrongWayDistance = wrongWay == sourceEdge->forwardNode ? sourceWeight - sourceWeight * source.percentage : sourceWeight * source.percentage;
+		insertTurns( context, heapForward, *sourceEdge, wrongWay, wrongWayDistance );
+	}
+	const int offset = insertTarget( &graph, heapBackward, target );
+
+	int targetDistance = std::numeric_limits< int >::max();
+	NodeIterator middle = ( NodeIterator ) 0;
+	AllowForwardEdge forward;
+	AllowBackwardEdge backward;
+
+	while ( heapForward->Size() + heapBackward->Size() > 0 ) {
+
+		if ( heapForward->Size() > 0 )
+			computeStep( context, heapForward, heapBackward, forward, backward, &middle, &targetDistance );
+
+		if ( heapBackward->Size() > 0 )
+			computeStep( context, heapBackward, heapForward, backward, forward, &middle, &targetDistance );
+
+	}
+
+	context->lastQuery.searchMilliseconds = context->timer.nsecsElapsed() / 1000000.0;
+
+	if ( targetDistance == std::numeric_limits< int >::max() )
+		return std::numeric_limits< int >::max();
+	const int routeDistance = targetDistance - offset;
+
+	// abort early if the path description is not requested
+	if ( pathNodes == NULL || pathEdges == NULL )
+		return routeDistance;
+
+	std::stack< NodeIterator > stack;
+	NodeIterator pathNode = middle;
+	while ( true ) {
+		NodeIterator parent = heapForward->GetData( pathNode ).parent;
+		stack.push( pathNode );
+		if ( parent == pathNode )
+			break;
+		pathNode = parent;
+	}
+	// the search started at a turn leaving the wrong way node instead of a node of the source's road edge
+	const bool turned = pathNode != sourceEdge->forwardNode && pathNode != sourceEdge->backwardNode;
+	const bool sourceForward = ( turned ? wrongWay : pathNode ) == sourceEdge->forwardNode;
+
+	NodeIterator lastNode = middle;
+	while ( heapBackward->GetData( lastNode ).parent != lastNode )
+		lastNode = heapBackward->GetData( lastNode ).parent;
+	const bool targetForward = lastNode == targetEdge->forwardNode;
+
+	pathNodes->push_back( source.nearestPoint );
+
+	// source and target lie on the same road edge
+	if ( !turned && stack.size() == 1 && lastNode == middle ) {
+		appendRoadEdgePath( *sourceEdge, sourceForward, source.previousWayCoordinates, target.previousWayCoordinates, pathNodes );
+		pathNodes->push_back( target.nearestPoint );
+		pathEdges->push_back( m_roadEdges.description( *sourceEdge, pathNodes->size() - 1, ( routeDistance + 5 ) / 10 ) );
+		return routeDistance;
+	}
+
+	// the part of the source's road edge in front of the source
+	appendRoadEdgePath( *sourceEdge, sourceForward, source.previousWayCoordinates, sourceForward ? sourceEdge->pathLength : 0, pathNodes );
+	const double sourceDistance = sourceEdge->distance * ( sourceForward ? 1 - source.percentage : source.percentage );
+	pathEdges->push_back( m_roadEdges.description( *sourceEdge, pathNodes->size() - 1, ( sourceDistance + 5 ) / 10 ) );
+	if ( turned )
+		unpackSearchEdge( context, wrongWay, pathNode, heapForward, true, pathNodes, pathEdges );
+
+	while ( stack.size() > 1 ) {
+		const NodeIterator node = stack.top();
+		stack.pop();
+		unpackEdge( context, node, stack.top(), true, pathNodes, pathEdges );
+	}
+
+	pathNode = middle;
+	while ( true ) {
+		NodeIterator parent = heapBackward->GetData( pathNode ).parent;
+		if ( parent == pathNode )
+			break;
+		unpackEdge( context, parent, pathNode, false, pathNodes, pathEdges );
+		pathNode = parent;
+	}
+
+	// the last turn entered the target's road edge and added all of it
+	const unsigned added = targetEdge->pathLength - 1;
+	const unsigned kept = targetForward ? target.previousWayCoordinates - 1 : targetEdge->pathLength - 1 - target.previousWayCoordinates;
+	pathNodes->resize( pathNodes->size() - ( added - kept ) );
+	pathNodes->push_back( target.nearestPoint );
+	const double behindTarget = targetEdge->distance * ( targetForward ? 1 - target.percentage : target.percentage );
+	const unsigned behindSeconds = ( behindTarget + 5 ) / 10;
+	Edge& lastEdge = pathEdges->back();
+	lastEdge.length = kept + 1;
+	lastEdge.seconds = lastEdge.seconds > behindSeconds ? lastEdge.seconds - behindSeconds : 0;
+
+	return routeDistance;
+}
+
+ContractionHierarchiesClient::EdgeKey ContractionHierarchiesClient::edgeKey( NodeIterator source, const EdgeIterator& edge )
+{
+	EdgeKey key;
+	key.source = source;
+	key.target = edge.target();
+	key.distance = edge.distance();
+	key.shortcut = edge.shortcut();
+	key.id = edge.shortcut() ? edge.middle() : edge.originalID();
+	return key;
+}
+
+// the excluded shortcuts from node are replaced by their first parts leading down to their middle nodes
+// the edges between node and a middle node are stored at the middle node and traversed in the opposite direction
+// the middle nodes are taken from context->excludedMiddles, which is used as the stack of nested exclusions
+template< class StallEdgeAllowed >
+void ContractionHierarchiesClient::relaxExcludedShortcuts( SearchContext* context, Heap* heap, NodeIterator node, int distance, const StallEdgeAllowed& stallEdgeAllowed )
+{
+	CompressedGraph& graph = context->graph;
+	std::vector< NodeIterator >& middles = context->excludedMiddles;
+	while ( !middles.empty() ) {
+		const NodeIterator lower = middles.back();
+		middles.pop_back();
+		for ( EdgeIterator edge = graph.edges( lower ); edge.hasEdgesLeft(); ) {
+			graph.unpackNextEdge( &edge );
+			if ( edge.target() != node || !stallEdgeAllowed( edge.forward(), edge.backward() ) )
+				continue;
+			if ( isExcluded( context, lower, edge ) ) {
+				if ( edge.shortcut() )
+					middles.push_back( edge.middle() );
+				continue;
+			}
+			context->lastQuery.relaxedEdges++;
+			const int toDistance = distance + edge.distance();
+			if ( !heap->WasInserted( lower ) ) {
+				heap->Insert( lower, toDistance, node );
+				heap->GetData( lower ).descended = true;
+			} else if ( toDistance < heap->GetKey( lower ) ) {
+				heap->DecreaseKey( lower, toDistance );
+				heap->GetData( lower ).parent = node;
+				heap->GetData( lower ).stalled = false;
+				heap->GetData( lower ).descended = true;
+			}
+		}
+	}
+}
+
+// checks the edge unpackEdge would choose for the path from source to target for blocked edges
+// every shortcut containing one is excluded from further searches
+bool ContractionHierarchiesClient::excludeBlockedPath( SearchContext* context, NodeIterator source, NodeIterator target, bool forward )
+{
+	// the same traversal as unpackEdge, markers exclude a shortcut once both of its halves are done
+	std::vector< UnpackEntry >& stack = context->unpackStack;
+	stack.clear();
+	UnpackEntry root;
+	root.source = source;
+	root.target = target;
+	root.forward = forward;
+	root.depth = 1;
+	root.store = false;
+	stack.push_back( root );
+
+	// the result of the last entry done
+	bool blocked = false;
+	while ( !stack.empty() ) {
+		const UnpackEntry entry = stack.back();
+		stack.pop_back();
+
+		EdgeIterator edge;
+		if ( entry.store ) {
+			if ( blocked ) {
+				std::vector< EdgeKey >& excludedEdges = context->excludedEdges;
+				excludedEdges.insert( std::lower_bound( excludedEdges.begin(), excludedEdges.end(), entry.key.edge ), entry.key.edge );
+			}
+		} else if ( !findShortestEdge( context, entry.source, entry.target, entry.forward, &edge ) ) {
+			// all edges are excluded already, the caller has to be excluded as well
+			blocked = true;
+		} else if ( !edge.shortcut() ) {
+			blocked = false;
+		} else {
+			UnpackEntry marker;
+			marker.forward = entry.forward;
+			marker.depth = entry.depth;
+			marker.store = true;
+			marker.key.edge = edgeKey( entry.source, edge );
+			marker.key.forward = entry.forward;
+			stack.push_back( marker );
+
+			// both halves are stored at the middle node, the first one is traversed backward
+			const NodeIterator middle = edge.middle();
+			UnpackEntry firstHalf;
+			firstHalf.source = middle;
+			firstHalf.target = entry.forward ? entry.source : entry.target;
+			firstHalf.forward = false;
+			firstHalf.depth = entry.depth + 1;
+			firstHalf.store = false;
+			UnpackEntry secondHalf;
+			secondHalf.source = middle;
+			secondHalf.target = entry.forward ? entry.target : entry.source;
+			secondHalf.forward = true;
+			secondHalf.depth = entry.depth + 1;
+			secondHalf.store = false;
+			stack.push_back( secondHalf );
+			stack.push_back( firstHalf );
+			continue;
+		}
+
+		// a blocked first half blocks its shortcut, the second half on top of the stack is skipped
+		if ( blocked && entry.depth > 1 && !entry.forward )
+			stack.pop_back();
+	}
+	return blocked;
+}
+
+bool ContractionHierarchiesClient::excludeBlockedSearchPath( SearchContext* context, NodeIterator middle )
+{
+	bool blocked = false;
+	Heap* heaps[2] = { context->heapForward, context->heapBackward };
+	for ( int direction = 0; direction < 2; direction++ ) {
+		const bool forward = direction == 0;
+		NodeIterator node = middle;
+		while ( true ) {
+			const HeapData& data = heaps[direction]->GetData( node );
+			if ( data.parent == node )
+				break;
+			// the edges of descents are stored at the lower node, see unpackSearchEdge
+			if ( data.descended )
+				blocked |= excludeBlockedPath( context, node, data.parent, !forward );
+			else
+				blocked |= excludeBlockedPath( context, data.parent, node, forward );
+			node = data.parent;
+		}
+	}
+	return blocked;
 }
 
-bool ContractionHierarchiesClient::unpackEdge( const NodeIterator source, const NodeIterator target, bool forward, QVector< Node >* pathNodes, QVector< Edge >* pathEdges ) {
-	EdgeIterator shortestEdge;
+void ContractionHierarchiesClient::unpackSearchEdge( SearchContext* context, NodeIterator parent, NodeIterator node, Heap* heap, bool forward, QVector< Node>* pathNodes, QVector< Edge >* pathEdges )
+{
+	// descents into excluded shortcuts use edges stored at the lower node
+	if ( heap->GetData( node ).descended )
+		unpackEdge( context, node, parent, !forward, pathNodes, pathEdges );
+	else
+		unpackEdge( context, parent, node, forward, pathNodes, pathEdges );
+}
 
+bool ContractionHierarchiesClient::findShortestEdge( SearchContext* context, NodeIterator source, NodeIterator target, bool forward, EdgeIterator* result )
+{
+	CompressedGraph& graph = context->graph;
+	bool found = false;
 	unsigned distance = std::numeric_limits< unsigned >::max();
-	for ( EdgeIterator edge = m_graph.edges( source ); edge.hasEdgesLeft(); ) {
-		m_graph.unpackNextEdge( &edge );
+	for ( EdgeIterator edge = graph.edges( source ); edge.hasEdgesLeft(); ) {
+		graph.unpackNextEdge( &edge );
 		if ( edge.target() != target )
 			continue;
 		if ( forward && !edge.forward() )
@@ -390,35 +1591,133 @@ bool ContractionHierarchiesClient::unpackEdge( const NodeIterator source, const
 			continue;
 		if ( edge.distance() > distance )
 			continue;
+		if ( isExcluded( context, source, edge ) )
+			continue;
 		distance = edge.distance();
-		shortestEdge = edge;
+		*result = edge;
+		found = true;
 	}
+	return found;
+}
 
-	if ( shortestEdge.unpacked() ) {
-		m_graph.path( shortestEdge, pathNodes, pathEdges, forward );
-		return true;
+bool ContractionHierarchiesClient::findShortcutHalves( SearchContext* context, NodeIterator middle, NodeIterator first, NodeIterator second, EdgeIterator* firstEdge, EdgeIterator* secondEdge )
+{
+	CompressedGraph& graph = context->graph;
+	bool foundFirst = false;
+	bool foundSecond = false;
+	unsigned firstDistance = std::numeric_limits< unsigned >::max();
+	unsigned secondDistance = std::numeric_limits< unsigned >::max();
+	for ( EdgeIterator edge = graph.edges( middle ); edge.hasEdgesLeft(); ) {
+		graph.unpackNextEdge( &edge );
+		if ( edge.target() == first && edge.backward() && edge.distance() <= firstDistance ) {
+			if ( !isExcluded( context, middle, edge ) ) {
+				firstDistance = edge.distance();
+				*firstEdge = edge;
+				foundFirst = true;
+			}
+		}
+		if ( edge.target() == second && edge.forward() && edge.distance() <= secondDistance ) {
+			if ( !isExcluded( context, middle, edge ) ) {
+				secondDistance = edge.distance();
+				*secondEdge = edge;
+				foundSecond = true;
+			}
+		}
 	}
+	return foundFirst && foundSecond;
+}
 
-	if ( !shortestEdge.shortcut() ) {
-		pathEdges->push_back( shortestEdge.description() );
-		if ( forward )
-			pathNodes->push_back( m_graph.node( target ).coordinate );
-		else
-			pathNodes->push_back( m_graph.node( source ).coordinate );
-		return true;
+bool ContractionHierarchiesClient::unpackEdge( SearchContext* context, const NodeIterator source, const NodeIterator target, bool forward, QVector< Node >* pathNodes, QVector< Edge >* pathEdges ) {
+	// shortcuts at least this long are worth caching
+	const int minCachedEdges = 32;
+
+	CompressedGraph& graph = context->graph;
+	QCache< UnpackKey, UnpackedPath >& cache = context->unpackedPaths;
+	// blocked edges change the shortest halves of shortcuts
+	const bool useCache = cache.maxCost() > 0 && context->excludedEdges.empty();
+
+	std::vector< UnpackEntry >& stack = context->unpackStack;
+	stack.clear();
+	UnpackEntry root;
+	if ( !findShortestEdge( context, source, target, forward, &root.edge ) ) {
+		qCritical() << "no edge to unpack between" << source << target;
+		return false;
 	}
+	root.source = source;
+	root.target = target;
+	root.forward = forward;
+	root.depth = 1;
+	root.store = false;
+	stack.push_back( root );
+
+	while ( !stack.empty() ) {
+		const UnpackEntry entry = stack.back();
+		stack.pop_back();
+
+		if ( entry.store ) {
+			const int edges = pathEdges->size() - entry.edgesBegin;
+			if ( edges >= minCachedEdges ) {
+				UnpackedPath* path = new UnpackedPath;
+				path->nodes = pathNodes->mid( entry.pathBegin );
+				path->edges = pathEdges->mid( entry.edgesBegin );
+				cache.insert( entry.key, path, path->nodes.size() * sizeof( Node ) + path->edges.size() * sizeof( Edge ) );
+			}
+			continue;
+		}
 
-	const NodeIterator middle = shortestEdge.middle();
+		if ( entry.depth > context->lastQuery.maxUnpackDepth )
+			context->lastQuery.maxUnpackDepth = entry.depth;
+		const EdgeIterator& edge = entry.edge;
 
-	if ( forward ) {
-		unpackEdge( middle, source, false, pathNodes, pathEdges );
-		unpackEdge( middle, target, true, pathNodes, pathEdges );
-		return true;
-	} else {
-		unpackEdge( middle, target, false, pathNodes, pathEdges );
-		unpackEdge( middle, source, true, pathNodes, pathEdges );
-		return true;
+		if ( edge.unpacked() ) {
+			graph.path( edge, pathNodes, pathEdges, entry.forward );
+			continue;
+		}
+
+		if ( !edge.shortcut() ) {
+			pathEdges->push_back( edge.description() );
+			pathNodes->push_back( graph.node( entry.forward ? entry.target : entry.source ).coordinate );
+			continue;
+		}
+
+		if ( useCache ) {
+			UnpackEntry marker;
+			marker.key.edge = edgeKey( entry.source, edge );
+			marker.key.forward = entry.forward;
+			const UnpackedPath* cached = cache.object( marker.key );
+			if ( cached != NULL ) {
+				*pathNodes += cached->nodes;
+				*pathEdges += cached->edges;
+				continue;
+			}
+			marker.store = true;
+			marker.pathBegin = pathNodes->size();
+			marker.edgesBegin = pathEdges->size();
+			stack.push_back( marker );
+		}
+
+		// both halves are stored at the middle node, the first one is traversed backward
+		const NodeIterator middle = edge.middle();
+		UnpackEntry firstHalf;
+		firstHalf.source = middle;
+		firstHalf.target = entry.forward ? entry.source : entry.target;
+		firstHalf.forward = false;
+		firstHalf.depth = entry.depth + 1;
+		firstHalf.store = false;
+		UnpackEntry secondHalf;
+		secondHalf.source = middle;
+		secondHalf.target = entry.forward ? entry.target : entry.source;
+		secondHalf.forward = true;
+		secondHalf.depth = entry.depth + 1;
+		secondHalf.store = false;
+		if ( !findShortcutHalves( context, middle, firstHalf.target, secondHalf.target, &firstHalf.edge, &secondHalf.edge ) ) {
+			qCritical() << "missing half of the shortcut" << entry.source << entry.target << "via" << middle;
+			return false;
+		}
+		stack.push_back( secondHalf );
+		stack.push_back( firstHalf );
 	}
+	return true;
 }
 
 Q_EXPORT_PLUGIN2( contractionhierarchiesclient, ContractionHierarchiesClient )
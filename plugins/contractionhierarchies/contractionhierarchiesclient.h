@@ -21,11 +21,19 @@ along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
 #define CONTRACTIONHIERARCHIESCLIENT_H
 
 #include <QObject>
+#include <QThread>
+#include <QElapsedTimer>
 #include <QStringList>
+#include <QCache>
 #include "interfaces/irouter.h"
 #include "binaryheap.h"
 #include "compressedgraph.h"
+#include "roadedgeindex.h"
+#include "hublabels.h"
 #include <queue>
+#include <algorithm>
+#include <vector>
+#include <limits>
 
 class ContractionHierarchiesClient : public QObject, public IRouter
 {
@@ -42,6 +50,14 @@ public:
 	virtual bool LoadData();
 	virtual bool UnloadData();
 	virtual bool GetRoute( double* distance, QVector< Node>* pathNodes, QVector< Edge >* pathEdges, const IGPSLookup::Result& source, const IGPSLookup::Result& target );
+	virtual Context* CreateContext();
+	virtual bool GetRoute( Context* context, double* distance, QVector< Node>* pathNodes, QVector< Edge >* pathEdges, const IGPSLookup::Result& source, const IGPSLookup::Result& target );
+	virtual bool GetRoute( Context* context, double* distance, QVector< Node>* pathNodes, QVector< Edge >* pathEdges, const IGPSLookup::Result& source, const IGPSLookup::Result& target, const QVector< IGPSLookup::Result >& blockedEdges );
+	virtual bool GetAlternativeRoutes( Context* context, QVector< double >* distances, QVector< QVector< Node > >* pathNodes, QVector< QVector< Edge > >* pathEdges, const IGPSLookup::Result& source, const IGPSLookup::Result& target, unsigned maxAlternatives );
+	virtual bool GetDistanceTable( Context* context, QVector< double >* result, const QVector< IGPSLookup::Result >& sources, const QVector< IGPSLookup::Result >& targets );
+	virtual bool GetReachableNodes( Context* context, QVector< Node >* nodes, QVector< double >* seconds, const IGPSLookup::Result& source, double maxSeconds );
+	virtual bool GetStatistics( Context* context, Statistics* lastQuery, Statistics* total );
+	virtual bool ResetStatistics( Context* context );
 	virtual bool GetName( QString* result, unsigned name );
 	virtual bool GetNames( QVector< QString >* result, QVector< unsigned > names );
 	virtual bool GetType( QString* result, unsigned type );
@@ -51,9 +67,12 @@ protected:
 	struct HeapData {
 		CompressedGraph::NodeIterator parent;
 		bool stalled: 1;
+		// reached through the first part of an excluded shortcut, i.e., by an edge stored at the node itself
+		bool descended: 1;
 		HeapData( CompressedGraph::NodeIterator p ) {
 			parent = p;
 			stalled = false;
+			descended = false;
 		}
 	};
 
@@ -73,21 +92,248 @@ protected:
 
 	typedef CompressedGraph::NodeIterator NodeIterator;
 	typedef CompressedGraph::EdgeIterator EdgeIterator;
-	typedef BinaryHeap< NodeIterator, int, int, HeapData, MapStorage< NodeIterator, unsigned > > Heap;
 
-	CompressedGraph m_graph;
+	// a node settled by a unidirectional upward search
+	struct SearchSpaceEntry {
+		NodeIterator node;
+		int distance;
+	};
+
+	// the distance from a node to a target, stored while computing distance tables
+	struct BucketEntry {
+		NodeIterator node;
+		unsigned target;
+		int distance;
+
+		bool operator<( const BucketEntry& right ) const {
+			return node < right.node;
+		}
+	};
+
+	// identifies an edge independent of its position in the graph, used to exclude edges from searches
+	struct EdgeKey {
+		NodeIterator source;
+		NodeIterator target;
+		unsigned distance;
+		// the middle node of shortcuts, the path or the name of original edges
+		unsigned id;
+		bool shortcut;
+
+		bool operator<( const EdgeKey& right ) const {
+			if ( source != right.source )
+				return source < right.source;
+			if ( target != right.target )
+				return target < right.target;
+			if ( distance != right.distance )
+				return distance < right.distance;
+			if ( id != right.id )
+				return id < right.id;
+			return shortcut < right.shortcut;
+		}
+		bool operator==( const EdgeKey& right ) const {
+			return source == right.source && target == right.target && distance == right.distance && id == right.id && shortcut == right.shortcut;
+		}
+	};
+
+	// an original edge of a path in travel direction
+	struct PathEdge {
+		NodeIterator from;
+		NodeIterator to;
+		unsigned distance;
+
+		bool operator<( const PathEdge& right ) const {
+			if ( from != right.from )
+				return from < right.from;
+			return to < right.to;
+		}
+	};
+
+	// identifies the unpacking of a shortcut in one direction
+	struct UnpackKey {
+		EdgeKey edge;
+		bool forward;
+
+		bool operator==( const UnpackKey& right ) const {
+			return edge == right.edge && forward == right.forward;
+		}
+		friend uint qHash( const UnpackKey& key ) {
+			return qHash( key.edge.source ) ^ qHash( key.edge.target * 37 ) ^ qHash( key.edge.id * 101 ) ^ ( key.forward ? 1 : 0 );
+		}
+	};
+
+	// the nodes and edge descriptions a shortcut unpacks to, without its first node
+	struct UnpackedPath {
+		QVector< Node > nodes;
+		QVector< Edge > edges;
+	};
+
+	// an edge still to be unpacked, or a marker storing the path unpacked since pathBegin in the cache
+	// excludeBlockedPath uses the markers to exclude their shortcut
+	struct UnpackEntry {
+		EdgeIterator edge;
+		// the node the edge is stored at
+		NodeIterator source;
+		NodeIterator target;
+		bool forward;
+		unsigned depth;
+		bool store;
+		UnpackKey key;
+		int pathBegin;
+		int edgesBegin;
+	};
+
+	typedef BinaryHeap< NodeIterator, int, int, HeapData, GenerationStorage< NodeIterator, unsigned > > Heap;
+
+	// everything a single query modifies
+	// the graph's block caches are private to the context, the files are only read
+	class SearchContext : public Context {
+	public:
+		SearchContext()
+		{
+			heapForward = NULL;
+			heapBackward = NULL;
+			heapLocalForward = NULL;
+			heapLocalBackward = NULL;
+		}
+		virtual ~SearchContext()
+		{
+			if ( heapForward != NULL )
+				delete heapForward;
+			if ( heapBackward != NULL )
+				delete heapBackward;
+			if ( heapLocalForward != NULL )
+				delete heapLocalForward;
+			if ( heapLocalBackward != NULL )
+				delete heapLocalBackward;
+		}
+
+		CompressedGraph graph;
+		Heap* heapForward;
+		Heap* heapBackward;
+		// searches between nodes of an alternative route, which must not disturb the main search spaces
+		// only created when needed and using the sparse index
+		Heap* heapLocalForward;
+		Heap* heapLocalBackward;
+		std::queue< NodeIterator > stallQueue;
+		// distances of the downward sweep, indexed by node id
+		std::vector< int > sweepDistances;
+		// blocked original edges and the shortcuts found to contain them, sorted, only set during a query
+		std::vector< EdgeKey > excludedEdges;
+		std::vector< NodeIterator > excludedMiddles;
+		std::vector< UnpackEntry > unpackStack;
+		// the nodes of an edge-based graph reachable by a turn
+		std::vector< NodeID > turnArcs;
+		// long shortcuts unpacked recently, e.g., the motorway parts of the hierarchy
+		QCache< UnpackKey, UnpackedPath > unpackedPaths;
+
+		Statistics lastQuery;
+		Statistics total;
+		QElapsedTimer timer;
+		// cache counters at the start of the query
+		unsigned long long blockCacheHits;
+		unsigned long long blockCacheMisses;
+		unsigned long long pathCacheHits;
+		unsigned long long pathCacheMisses;
+	};
+
+	// loads the pinned top of the hierarchy in the background
+	class WarmupThread : public QThread {
+	public:
+		WarmupThread( CompressedGraph::PinnedData* data ) :
+				m_data( data )
+		{
+		}
+	protected:
+		virtual void run()
+		{
+			m_data->read();
+		}
+		CompressedGraph::PinnedData* m_data;
+	};
+
 	const char* m_names;
 	QFile m_namesFile;
-	Heap* m_heapForward;
-	Heap* m_heapBackward;
-	std::queue< NodeIterator > m_stallQueue;
+	QString m_graphFilename;
+	SearchContext* m_defaultContext;
 	QString m_directory;
 	QStringList m_types;
+	// dense heap indices are faster but need memory proportional to the node id range
+	bool m_denseHeapIndex;
+	// memory map the graph instead of reading it into a block cache
+	bool m_mapGraph;
+	// memory budget in MB for decoded blocks shared by all contexts, 0 disables decoding
+	int m_decodedCacheSize;
+	CompressedGraph::DecodedCache* m_decodedCache;
+	// memory budget in MB for unpacked long shortcuts per context, 0 disables it
+	int m_unpackCacheSize;
+	// read ahead adjacent blocks in the background
+	bool m_prefetch;
+	// pin up to this many MB of the top of the hierarchy after loading, 0 disables it
+	int m_warmupSize;
+	bool m_warmupInBackground;
+	CompressedGraph::PinnedData* m_pinnedData;
+	// memory budget in MB for a block cache shared by all contexts, 0 gives every context a private cache
+	int m_sharedCacheSize;
+	CompressedGraph::SharedCache* m_sharedCache;
+	WarmupThread* m_warmupThread;
+	// only loaded for edge-based graphs, whose nodes are the directions of the road edges
+	RoadEdgeIndex m_roadEdges;
+	// only loaded if the preprocessing derived hub labels, answers distance queries without a search
+	HubLabels m_hubLabels;
+	// the module's config asks for the uncompressed server layout, no block is decoded while routing
+	bool m_serverLayout;
 
+	SearchContext* createSearchContext();
+	SearchContext* searchContext( Context* context );
+	void beginQuery( SearchContext* context );
+	void endQuery( SearchContext* context );
+	template< class EdgeAllowed, class StallEdgeAllowed >
+	void computeStep( SearchContext* context, Heap* heapForward, Heap* heapBackward, const EdgeAllowed& edgeAllowed, const StallEdgeAllowed& stallEdgeAllowed, NodeIterator* middle, int* targetDistance, double stretch = 0, std::vector< NodeIterator >* meetings = NULL );
 	template< class EdgeAllowed, class StallEdgeAllowed >
-	void computeStep( Heap* heapForward, Heap* heapBackward, const EdgeAllowed& edgeAllowed, const StallEdgeAllowed& stallEdgeAllowed, NodeIterator* middle, int* targetDistance );
-	int computeRoute( const IGPSLookup::Result& source, const IGPSLookup::Result& target, QVector< Node>* pathNodes, QVector< Edge >* pathEdges );
-	bool unpackEdge( const NodeIterator source, const NodeIterator target, bool forward, QVector< Node>* pathNodes, QVector< Edge >* pathEdges );
+	void computeSearchSpace( SearchContext* context, Heap* heap, const EdgeAllowed& edgeAllowed, const StallEdgeAllowed& stallEdgeAllowed, std::vector< SearchSpaceEntry >* searchSpace, int maxDistance = std::numeric_limits< int >::max() );
+	// the road edge of a GPS position, returns false if the graph does not contain it or the road is closed
+	bool findRoadEdge( CompressedGraph* graph, const IGPSLookup::Result& position, EdgeIterator* edge );
+	// returns false and inserts nothing if the source's road edge cannot be routed on
+	// the excluded node of an edge-based graph is not inserted
+	bool insertSource( CompressedGraph* graph, Heap* heap, const IGPSLookup::Result& source, NodeIterator excluded = RoadEdgeIndex::noNode );
+	// returns the offset added to all keys, which has to be subtracted from the distances found
+	// inserts nothing if the target's road edge cannot be routed on
+	int insertTarget( CompressedGraph* graph, Heap* heap, const IGPSLookup::Result& target );
+	// searches until the queues exceed ( 1 + stretch ) times the shortest distance, records all nodes where the searches meet if meetings is set
+	int searchRoute( SearchContext* context, const IGPSLookup::Result& source, const IGPSLookup::Result& target, NodeIterator* middle, double stretch = 0, std::vector< NodeIterator >* meetings = NULL );
+	// the shortest distance according to the hub labels, the heaps are not touched
+	int labelRoute( SearchContext* context, const IGPSLookup::Result& source, const IGPSLookup::Result& target );
+	void describeRoute( SearchContext* context, const IGPSLookup::Result& source, const IGPSLookup::Result& target, NodeIterator middle, QVector< Node>* pathNodes, QVector< Edge >* pathEdges );
+	// the original edges of the route through the via node, viaIndex is set to the number of edges before it
+	// returns false if an edge of the route cannot be unpacked
+	bool viaPath( SearchContext* context, NodeIterator via, std::vector< PathEdge >* path, unsigned* viaIndex );
+	bool unpackPathEdges( SearchContext* context, NodeIterator source, NodeIterator target, bool forward, std::vector< PathEdge >* path );
+	bool locallyOptimal( SearchContext* context, const std::vector< PathEdge >& path, unsigned viaIndex, int length );
+	// if usesBlockedEdge is set, the path found is checked for excluded edges first and not unpacked if it contains one
+	int computeRoute( SearchContext* context, const IGPSLookup::Result& source, const IGPSLookup::Result& target, QVector< Node>* pathNodes, QVector< Edge >* pathEdges, bool* usesBlockedEdge = NULL );
+	static EdgeKey edgeKey( NodeIterator source, const EdgeIterator& edge );
+	bool isExcluded( const SearchContext* context, NodeIterator source, const EdgeIterator& edge ) const
+	{
+		if ( context->excludedEdges.empty() )
+			return false;
+		return std::binary_search( context->excludedEdges.begin(), context->excludedEdges.end(), edgeKey( source, edge ) );
+	}
+	template< class StallEdgeAllowed >
+	void relaxExcludedShortcuts( SearchContext* context, Heap* heap, NodeIterator node, int distance, const StallEdgeAllowed& stallEdgeAllowed );
+	bool excludeBlockedPath( SearchContext* context, NodeIterator source, NodeIterator target, bool forward );
+	bool excludeBlockedSearchPath( SearchContext* context, NodeIterator middle );
+	void unpackSearchEdge( SearchContext* context, NodeIterator parent, NodeIterator node, Heap* heap, bool forward, QVector< Node>* pathNodes, QVector< Edge >* pathEdges );
+	NodeIterator wrongWayNode( const RoadEdgeIndex::Entry& edge, const IGPSLookup::Result& source, const IGPSLookup::Result& target );
+	// inserts the nodes reached by the turns leaving node of the edge-based graph instead of node itself
+	void insertTurns( SearchContext* context, Heap* heap, const RoadEdgeIndex::Entry& edge, NodeIterator node, int distance );
+	void appendRoadEdgePath( const RoadEdgeIndex::Entry& edge, bool forward, unsigned from, unsigned to, QVector< Node >* pathNodes );
+	int computeEdgeBasedRoute( SearchContext* context, const IGPSLookup::Result& source, const IGPSLookup::Result& target, QVector< Node>* pathNodes, QVector< Edge >* pathEdges );
+	// the shortest edge stored at source leading to target, returns false if there is none that is not excluded
+	bool findShortestEdge( SearchContext* context, NodeIterator source, NodeIterator target, bool forward, EdgeIterator* result );
+	// finds both halves of a shortcut with a single scan of the middle node's edges, the first half leads to the middle node
+	// returns false if one of them is missing or excluded
+	bool findShortcutHalves( SearchContext* context, NodeIterator middle, NodeIterator first, NodeIterator second, EdgeIterator* firstEdge, EdgeIterator* secondEdge );
+	bool unpackEdge( SearchContext* context, const NodeIterator source, const NodeIterator target, bool forward, QVector< Node>* pathNodes, QVector< Edge >* pathEdges );
 
 };
 
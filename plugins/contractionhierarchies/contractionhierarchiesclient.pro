@@ -24,6 +24,8 @@ HEADERS += \
 	 ../../interfaces/irouter.h \
 	 contractionhierarchiesclient.h \
 	 compressedgraph.h \
+	 roadedgeindex.h \
+	 hublabels.h \
 	 ../../interfaces/igpslookup.h \
 	 ../../utils/bithelpers.h \
 	 ../../utils/qthelpers.h
@@ -0,0 +1,554 @@
+/*
+Copyright 2010  Christian Vetter veaac.fdirct@gmail.com
+
+This file is part of MoNav.
+
+MoNav is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+MoNav is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CUSTOMIZABLECONTRACTOR_H_INCLUDED
+#define CUSTOMIZABLECONTRACTOR_H_INCLUDED
+
+#include "interfaces/iimporter.h"
+#include "contractioncleanup.h"
+#include "compressedgraph.h"
+#include "utils/qthelpers.h"
+#include <QFile>
+#include <QtDebug>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#ifndef _OPENMP
+#define omp_get_thread_num() (0)
+#define omp_get_max_threads() (1)
+#else
+#include <omp.h>
+#endif
+
+// Contraction in a metric-independent order ( customizable contraction hierarchies ):
+// the order is computed by a geometric nested dissection and every node is contracted without witness searches.
+// The resulting shortcut topology only depends on the road network, so it is computed once and stored.
+// A new metric only requires the customization, which computes the shortcut weights bottom-up in parallel.
+class CustomizableContractor {
+
+public:
+
+	CustomizableContractor( const std::vector< IImporter::RoutingNode >& nodes, const std::vector< IImporter::RoutingEdge >& edges ) :
+			m_nodes( nodes ), m_edges( edges )
+	{
+	}
+
+	// computes the nested dissection order and the shortcut topology
+	void computeTopology()
+	{
+		Timer time;
+		computeOrder();
+		qDebug() << "customizable contraction: computed nested dissection order:" << time.restart() << "ms";
+		computeArcs();
+		qDebug() << "customizable contraction: computed topology:" << time.restart() << "ms";
+		qDebug() << "customizable contraction:" << m_nodes.size() << "nodes," << m_arcTargets.size() << "arcs";
+	}
+
+	// reads a topology computed for the same road network, returns false if it does not match
+	bool loadTopology( const QString& filename )
+	{
+		QFile file( filename );
+		if ( !file.open( QIODevice::ReadOnly ) )
+			return false;
+
+		unsigned numberOfNodes = 0;
+		unsigned numberOfEdges = 0;
+		unsigned checksum = 0;
+		unsigned numberOfArcs = 0;
+		file.read( ( char* ) &numberOfNodes, sizeof( unsigned ) );
+		file.read( ( char* ) &numberOfEdges, sizeof( unsigned ) );
+		file.read( ( char* ) &checksum, sizeof( unsigned ) );
+		file.read( ( char* ) &numberOfArcs, sizeof( unsigned ) );
+		if ( numberOfNodes != m_nodes.size() || numberOfEdges != m_edges.size() || checksum != edgeChecksum() ) {
+			qDebug() << "customizable contraction: stored topology belongs to a different road network";
+			return false;
+		}
+
+		m_rank.resize( numberOfNodes );
+		m_arcBegin.resize( numberOfNodes + 1 );
+		m_arcTargets.resize( numberOfArcs );
+		qint64 expected = ( qint64 ) sizeof( unsigned ) * ( numberOfNodes + numberOfNodes + 1 + numberOfArcs );
+		qint64 read = 0;
+		read += file.read( ( char* ) &m_rank[0], sizeof( unsigned ) * numberOfNodes );
+		read += file.read( ( char* ) &m_arcBegin[0], sizeof( unsigned ) * ( numberOfNodes + 1 ) );
+		if ( numberOfArcs > 0 )
+			read += file.read( ( char* ) &m_arcTargets[0], sizeof( unsigned ) * numberOfArcs );
+		if ( read != expected ) {
+			qCritical() << "customizable contraction: corrupt topology file";
+			return false;
+		}
+
+		m_nodeOfRank.resize( numberOfNodes );
+		for ( unsigned node = 0; node < numberOfNodes; node++ )
+			m_nodeOfRank[m_rank[node]] = node;
+		computeLevels();
+		qDebug() << "customizable contraction: loaded topology with" << numberOfArcs << "arcs";
+		return true;
+	}
+
+	bool saveTopology( const QString& filename ) const
+	{
+		QFile file( filename );
+		if ( !openQFile( &file, QIODevice::WriteOnly ) )
+			return false;
+
+		unsigned numberOfNodes = m_nodes.size();
+		unsigned numberOfEdges = m_edges.size();
+		unsigned checksum = edgeChecksum();
+		unsigned numberOfArcs = m_arcTargets.size();
+		file.write( ( const char* ) &numberOfNodes, sizeof( unsigned ) );
+		file.write( ( const char* ) &numberOfEdges, sizeof( unsigned ) );
+		file.write( ( const char* ) &checksum, sizeof( unsigned ) );
+		file.write( ( const char* ) &numberOfArcs, sizeof( unsigned ) );
+		file.write( ( const char* ) &m_rank[0], sizeof( unsigned ) * numberOfNodes );
+		file.write( ( const char* ) &m_arcBegin[0], sizeof( unsigned ) * ( numberOfNodes + 1 ) );
+		if ( numberOfArcs > 0 )
+			file.write( ( const char* ) &m_arcTargets[0], sizeof( unsigned ) * numberOfArcs );
+		return true;
+	}
+
+	// computes the shortcut weights for the travel times given per road edge in seconds
+	// negative travel times close the road edge
+	void customize( const std::vector< double >& seconds )
+	{
+		assert( seconds.size() == m_edges.size() );
+		Timer time;
+		const unsigned numberOfArcs = m_arcTargets.size();
+		m_forward.assign( numberOfArcs, unsigned( infinity ) );
+		m_backward.assign( numberOfArcs, unsigned( infinity ) );
+		m_forwardMiddle.assign( numberOfArcs, unsigned( noMiddle ) );
+		m_backwardMiddle.assign( numberOfArcs, unsigned( noMiddle ) );
+		m_weights.resize( m_edges.size() );
+
+		// the arcs start out with the best road edge between their nodes
+		for ( unsigned edge = 0; edge < m_edges.size(); edge++ ) {
+			m_weights[edge] = weight( seconds[edge] );
+			const IImporter::RoutingEdge& roadEdge = m_edges[edge];
+			if ( m_weights[edge] == infinity || roadEdge.source == roadEdge.target )
+				continue;
+			const bool sourceIsLower = m_rank[roadEdge.source] < m_rank[roadEdge.target];
+			const unsigned arc = findArc( roadEdge.source, roadEdge.target );
+			// the arc points upwards, the road edge's direction is its forward direction if it starts at the lower node
+			unsigned& along = sourceIsLower ? m_forward[arc] : m_backward[arc];
+			unsigned& against = sourceIsLower ? m_backward[arc] : m_forward[arc];
+			along = std::min( along, m_weights[edge] );
+			if ( roadEdge.bidirectional )
+				against = std::min( against, m_weights[edge] );
+		}
+
+		// lower triangles: the arcs of lower levels are final when a level is processed
+		long long improved = 0;
+		for ( unsigned level = 0; level + 1 < m_levelBegin.size(); level++ ) {
+			const int begin = m_levelBegin[level];
+			const int end = m_levelBegin[level + 1];
+#pragma omp parallel for schedule( guided ) reduction( +: improved )
+			for ( int i = begin; i < end; i++ ) {
+				const unsigned rank = m_levelNodes[i];
+				for ( unsigned arc = m_arcBegin[rank]; arc < m_arcBegin[rank + 1]; arc++ )
+					improved += customizeArc( rank, arc );
+			}
+		}
+
+		qDebug() << "customizable contraction: customized" << numberOfArcs << "arcs in" << time.elapsed() << "ms," << improved << "directions use shortcuts";
+	}
+
+	// the customized hierarchy in the format of the contractor, edges point from the lower to the higher node
+	// every road edge is kept to allow the GPS lookup to address it
+	// closed ones get CompressedGraph::ClosedDistance, which the query graph decodes without a direction
+	void GetEdges( std::vector< ContractionCleanup::Edge >* edges, std::vector< ContractionCleanup::Edge >* loops ) const
+	{
+		unsigned closed = 0;
+		for ( unsigned edge = 0; edge < m_edges.size(); edge++ ) {
+			const IImporter::RoutingEdge& roadEdge = m_edges[edge];
+			const bool sourceIsLower = m_rank[roadEdge.source] <= m_rank[roadEdge.target];
+			ContractionCleanup::Edge newEdge;
+			newEdge.source = sourceIsLower ? roadEdge.source : roadEdge.target;
+			newEdge.target = sourceIsLower ? roadEdge.target : roadEdge.source;
+			newEdge.data.distance = m_weights[edge];
+			if ( m_weights[edge] == infinity ) {
+				newEdge.data.distance = CompressedGraph::ClosedDistance;
+				closed++;
+			}
+			newEdge.data.shortcut = false;
+			newEdge.data.id = edge;
+			newEdge.data.forward = sourceIsLower || roadEdge.bidirectional;
+			newEdge.data.backward = !sourceIsLower || roadEdge.bidirectional;
+			if ( newEdge.source == newEdge.target ) {
+				newEdge.data.forward = true;
+				newEdge.data.backward = roadEdge.bidirectional;
+				loops->push_back( newEdge );
+			} else {
+				edges->push_back( newEdge );
+			}
+		}
+
+		for ( unsigned rank = 0; rank < m_nodes.size(); rank++ ) {
+			for ( unsigned arc = m_arcBegin[rank]; arc < m_arcBegin[rank + 1]; arc++ ) {
+				ContractionCleanup::Edge shortcut;
+				shortcut.source = m_nodeOfRank[rank];
+				shortcut.target = m_nodeOfRank[m_arcTargets[arc]];
+				shortcut.data.shortcut = true;
+				const bool forward = m_forwardMiddle[arc] != noMiddle;
+				const bool backward = m_backwardMiddle[arc] != noMiddle;
+				if ( forward && backward && m_forward[arc] == m_backward[arc] && m_forwardMiddle[arc] == m_backwardMiddle[arc] ) {
+					shortcut.data.distance = m_forward[arc];
+					shortcut.data.middle = m_nodeOfRank[m_forwardMiddle[arc]];
+					shortcut.data.forward = shortcut.data.backward = true;
+					edges->push_back( shortcut );
+					continue;
+				}
+				if ( forward ) {
+					shortcut.data.distance = m_forward[arc];
+					shortcut.data.middle = m_nodeOfRank[m_forwardMiddle[arc]];
+					shortcut.data.forward = true;
+					shortcut.data.backward = false;
+					edges->push_back( shortcut );
+				}
+				if ( backward ) {
+					shortcut.data.distance = m_backward[arc];
+					shortcut.data.middle = m_nodeOfRank[m_backwardMiddle[arc]];
+					shortcut.data.forward = false;
+					shortcut.data.backward = true;
+					edges->push_back( shortcut );
+				}
+			}
+		}
+		if ( closed > 0 )
+			qDebug() << "customizable contraction: kept" << closed << "closed road edges for the GPS lookup";
+	}
+
+protected:
+
+	// shortcut weights have to fit into the cleanup's edge format
+	static const unsigned infinity = ( 1u << 28 ) - 1;
+	static const unsigned noMiddle = ~0u;
+	// cells of at most this many nodes are not dissected any further
+	static const unsigned leafSize = 16;
+
+	class CoordinateOrder {
+	public:
+		CoordinateOrder( const std::vector< IImporter::RoutingNode >& nodes, bool xAxis ) :
+				m_nodes( nodes ), m_xAxis( xAxis )
+		{
+		}
+		bool operator()( NodeID left, NodeID right ) const
+		{
+			if ( m_xAxis )
+				return m_nodes[left].coordinate.x < m_nodes[right].coordinate.x;
+			return m_nodes[left].coordinate.y < m_nodes[right].coordinate.y;
+		}
+	protected:
+		const std::vector< IImporter::RoutingNode >& m_nodes;
+		bool m_xAxis;
+	};
+
+	class SeparatorTest {
+	public:
+		SeparatorTest( const CustomizableContractor& contractor ) :
+				m_contractor( contractor )
+		{
+		}
+		// true for nodes that stay in their cell, false for separator nodes
+		bool operator()( NodeID node ) const
+		{
+			for ( unsigned i = m_contractor.m_adjacencyBegin[node]; i < m_contractor.m_adjacencyBegin[node + 1]; i++ ) {
+				if ( m_contractor.m_mark[m_contractor.m_adjacency[i]] == m_contractor.m_stamp )
+					return false;
+			}
+			return true;
+		}
+	protected:
+		const CustomizableContractor& m_contractor;
+	};
+
+	friend class SeparatorTest;
+
+	static unsigned weight( double seconds )
+	{
+		if ( seconds < 0 )
+			return infinity;
+		// same rounding as the contractor, which also ignores edges longer than a day
+		double distance = std::max( seconds * 10.0 + 0.5, 1.0 );
+		if ( distance > 24 * 60 * 60 * 10 )
+			return infinity;
+		return distance;
+	}
+
+	unsigned edgeChecksum() const
+	{
+		unsigned checksum = 0;
+		for ( unsigned edge = 0; edge < m_edges.size(); edge++ )
+			checksum = checksum * 31 + m_edges[edge].source * 7 + m_edges[edge].target;
+		return checksum;
+	}
+
+	void computeOrder()
+	{
+		const unsigned numberOfNodes = m_nodes.size();
+
+		// undirected adjacency of the road network
+		m_adjacencyBegin.assign( numberOfNodes + 1, 0 );
+		for ( unsigned edge = 0; edge < m_edges.size(); edge++ ) {
+			if ( m_edges[edge].source == m_edges[edge].target )
+				continue;
+			m_adjacencyBegin[m_edges[edge].source + 1]++;
+			m_adjacencyBegin[m_edges[edge].target + 1]++;
+		}
+		for ( unsigned node = 0; node < numberOfNodes; node++ )
+			m_adjacencyBegin[node + 1] += m_adjacencyBegin[node];
+		m_adjacency.resize( m_adjacencyBegin.back() );
+		{
+			std::vector< unsigned > position( m_adjacencyBegin.begin(), m_adjacencyBegin.end() - 1 );
+			for ( unsigned edge = 0; edge < m_edges.size(); edge++ ) {
+				const NodeID source = m_edges[edge].source;
+				const NodeID target = m_edges[edge].target;
+				if ( source == target )
+					continue;
+				m_adjacency[position[source]++] = target;
+				m_adjacency[position[target]++] = source;
+			}
+		}
+
+		m_cell.resize( numberOfNodes );
+		for ( unsigned node = 0; node < numberOfNodes; node++ )
+			m_cell[node] = node;
+		m_mark.assign( numberOfNodes, 0 );
+		m_stamp = 0;
+		m_rank.resize( numberOfNodes );
+		m_nextRank = 0;
+
+		dissect( 0, numberOfNodes );
+		assert( m_nextRank == numberOfNodes );
+
+		m_nodeOfRank.resize( numberOfNodes );
+		for ( unsigned node = 0; node < numberOfNodes; node++ )
+			m_nodeOfRank[m_rank[node]] = node;
+
+		std::vector< unsigned >().swap( m_adjacencyBegin );
+		std::vector< NodeID >().swap( m_adjacency );
+		std::vector< NodeID >().swap( m_cell );
+		std::vector< unsigned >().swap( m_mark );
+	}
+
+	// orders the nodes of m_cell[begin, end): both halves first, the separator between them last
+	void dissect( unsigned begin, unsigned end )
+	{
+		if ( end - begin <= leafSize ) {
+			for ( unsigned i = begin; i < end; i++ )
+				m_rank[m_cell[i]] = m_nextRank++;
+			return;
+		}
+
+		// split at the median of the wider side
+		unsigned minX = std::numeric_limits< unsigned >::max();
+		unsigned minY = std::numeric_limits< unsigned >::max();
+		unsigned maxX = 0;
+		unsigned maxY = 0;
+		for ( unsigned i = begin; i < end; i++ ) {
+			const UnsignedCoordinate& coordinate = m_nodes[m_cell[i]].coordinate;
+			minX = std::min( minX, coordinate.x );
+			minY = std::min( minY, coordinate.y );
+			maxX = std::max( maxX, coordinate.x );
+			maxY = std::max( maxY, coordinate.y );
+		}
+		const unsigned middle = begin + ( end - begin ) / 2;
+		std::nth_element( m_cell.begin() + begin, m_cell.begin() + middle, m_cell.begin() + end, CoordinateOrder( m_nodes, maxX - minX >= maxY - minY ) );
+
+		// nodes of the first half adjacent to the second half separate them
+		m_stamp++;
+		for ( unsigned i = middle; i < end; i++ )
+			m_mark[m_cell[i]] = m_stamp;
+		const unsigned separator = std::stable_partition( m_cell.begin() + begin, m_cell.begin() + middle, SeparatorTest( *this ) ) - m_cell.begin();
+
+		dissect( begin, separator );
+		dissect( middle, end );
+		for ( unsigned i = separator; i < middle; i++ )
+			m_rank[m_cell[i]] = m_nextRank++;
+	}
+
+	// contracts the nodes in rank order, the upward neighbours of a node form a clique afterwards
+	void computeArcs()
+	{
+		const unsigned numberOfNodes = m_nodes.size();
+		std::vector< std::vector< unsigned > > upward( numberOfNodes );
+		for ( unsigned edge = 0; edge < m_edges.size(); edge++ ) {
+			const unsigned sourceRank = m_rank[m_edges[edge].source];
+			const unsigned targetRank = m_rank[m_edges[edge].target];
+			if ( sourceRank == targetRank )
+				continue;
+			upward[std::min( sourceRank, targetRank )].push_back( std::max( sourceRank, targetRank ) );
+		}
+
+		m_arcBegin.assign( numberOfNodes + 1, 0 );
+		m_arcTargets.clear();
+		for ( unsigned rank = 0; rank < numberOfNodes; rank++ ) {
+			std::vector< unsigned >& neighbours = upward[rank];
+			std::sort( neighbours.begin(), neighbours.end() );
+			neighbours.resize( std::unique( neighbours.begin(), neighbours.end() ) - neighbours.begin() );
+			m_arcTargets.insert( m_arcTargets.end(), neighbours.begin(), neighbours.end() );
+			m_arcBegin[rank + 1] = m_arcTargets.size();
+			// the lowest upward neighbour inherits all others ( elimination tree parent )
+			if ( neighbours.size() > 1 ) {
+				std::vector< unsigned >& parent = upward[neighbours.front()];
+				parent.insert( parent.end(), neighbours.begin() + 1, neighbours.end() );
+			}
+			std::vector< unsigned >().swap( neighbours );
+		}
+
+		computeLevels();
+	}
+
+	// groups the nodes into levels that only depend on lower levels, and indexes the downward arcs
+	void computeLevels()
+	{
+		const unsigned numberOfNodes = m_rank.size();
+		std::vector< unsigned > level( numberOfNodes, 0 );
+		unsigned numberOfLevels = numberOfNodes == 0 ? 0 : 1;
+		for ( unsigned rank = 0; rank < numberOfNodes; rank++ ) {
+			for ( unsigned arc = m_arcBegin[rank]; arc < m_arcBegin[rank + 1]; arc++ ) {
+				unsigned& targetLevel = level[m_arcTargets[arc]];
+				targetLevel = std::max( targetLevel, level[rank] + 1 );
+				numberOfLevels = std::max( numberOfLevels, targetLevel + 1 );
+			}
+		}
+		m_levelBegin.assign( numberOfLevels + 1, 0 );
+		for ( unsigned rank = 0; rank < numberOfNodes; rank++ )
+			m_levelBegin[level[rank] + 1]++;
+		for ( unsigned i = 0; i < numberOfLevels; i++ )
+			m_levelBegin[i + 1] += m_levelBegin[i];
+		m_levelNodes.resize( numberOfNodes );
+		{
+			std::vector< unsigned > position( m_levelBegin.begin(), m_levelBegin.end() - 1 );
+			for ( unsigned rank = 0; rank < numberOfNodes; rank++ )
+				m_levelNodes[position[level[rank]]++] = rank;
+		}
+
+		// downward arcs sorted by their lower node
+		m_downBegin.assign( numberOfNodes + 1, 0 );
+		for ( unsigned arc = 0; arc < m_arcTargets.size(); arc++ )
+			m_downBegin[m_arcTargets[arc] + 1]++;
+		for ( unsigned rank = 0; rank < numberOfNodes; rank++ )
+			m_downBegin[rank + 1] += m_downBegin[rank];
+		m_downArcs.resize( m_arcTargets.size() );
+		m_downSources.resize( m_arcTargets.size() );
+		{
+			std::vector< unsigned > position( m_downBegin.begin(), m_downBegin.end() - 1 );
+			for ( unsigned rank = 0; rank < numberOfNodes; rank++ ) {
+				for ( unsigned arc = m_arcBegin[rank]; arc < m_arcBegin[rank + 1]; arc++ ) {
+					const unsigned i = position[m_arcTargets[arc]]++;
+					m_downArcs[i] = arc;
+					m_downSources[i] = rank;
+				}
+			}
+		}
+		qDebug() << "customizable contraction:" << numberOfLevels << "levels";
+	}
+
+	unsigned findArc( NodeID source, NodeID target ) const
+	{
+		unsigned lower = m_rank[source];
+		unsigned upper = m_rank[target];
+		if ( lower > upper )
+			std::swap( lower, upper );
+		const unsigned* begin = &m_arcTargets[0] + m_arcBegin[lower];
+		const unsigned* end = &m_arcTargets[0] + m_arcBegin[lower + 1];
+		const unsigned* arc = std::lower_bound( begin, end, upper );
+		assert( arc != end && *arc == upper );
+		return arc - &m_arcTargets[0];
+	}
+
+	// relaxes the arc rank -> target with all lower triangles rank <- middle -> target
+	int customizeArc( unsigned rank, unsigned arc )
+	{
+		const unsigned target = m_arcTargets[arc];
+		int improved = 0;
+		unsigned i = m_downBegin[rank];
+		unsigned j = m_downBegin[target];
+		const unsigned iEnd = m_downBegin[rank + 1];
+		const unsigned jEnd = m_downBegin[target + 1];
+		while ( i < iEnd && j < jEnd ) {
+			if ( m_downSources[i] < m_downSources[j] ) {
+				i++;
+				continue;
+			}
+			if ( m_downSources[j] < m_downSources[i] ) {
+				j++;
+				continue;
+			}
+			const unsigned middle = m_downSources[i];
+			const unsigned toRank = m_downArcs[i];
+			const unsigned toTarget = m_downArcs[j];
+			// rank -> middle -> target
+			if ( m_backward[toRank] != infinity && m_forward[toTarget] != infinity ) {
+				const unsigned distance = m_backward[toRank] + m_forward[toTarget];
+				if ( distance < m_forward[arc] ) {
+					m_forward[arc] = distance;
+					if ( m_forwardMiddle[arc] == noMiddle )
+						improved++;
+					m_forwardMiddle[arc] = middle;
+				}
+			}
+			// target -> middle -> rank
+			if ( m_backward[toTarget] != infinity && m_forward[toRank] != infinity ) {
+				const unsigned distance = m_backward[toTarget] + m_forward[toRank];
+				if ( distance < m_backward[arc] ) {
+					m_backward[arc] = distance;
+					if ( m_backwardMiddle[arc] == noMiddle )
+						improved++;
+					m_backwardMiddle[arc] = middle;
+				}
+			}
+			i++;
+			j++;
+		}
+		return improved;
+	}
+
+	const std::vector< IImporter::RoutingNode >& m_nodes;
+	const std::vector< IImporter::RoutingEdge >& m_edges;
+
+	// nested dissection
+	std::vector< unsigned > m_adjacencyBegin;
+	std::vector< NodeID > m_adjacency;
+	std::vector< NodeID > m_cell;
+	std::vector< unsigned > m_mark;
+	unsigned m_stamp;
+	unsigned m_nextRank;
+
+	// topology, arcs point from lower to higher ranks and are indexed by their lower node
+	std::vector< unsigned > m_rank;
+	std::vector< NodeID > m_nodeOfRank;
+	std::vector< unsigned > m_arcBegin;
+	std::vector< unsigned > m_arcTargets;
+	std::vector< unsigned > m_levelBegin;
+	std::vector< unsigned > m_levelNodes;
+	std::vector< unsigned > m_downBegin;
+	std::vector< unsigned > m_downArcs;
+	std::vector< unsigned > m_downSources;
+
+	// metric
+	std::vector< unsigned > m_weights;
+	std::vector< unsigned > m_forward;
+	std::vector< unsigned > m_backward;
+	std::vector< unsigned > m_forwardMiddle;
+	std::vector< unsigned > m_backwardMiddle;
+};
+
+#endif // CUSTOMIZABLECONTRACTOR_H_INCLUDED
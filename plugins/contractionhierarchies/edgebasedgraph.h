@@ -0,0 +1,310 @@
+/*
+Copyright 2010  Christian Vetter veaac.fdirct@gmail.com
+
+This file is part of MoNav.
+
+MoNav is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+MoNav is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EDGEBASEDGRAPH_H_INCLUDED
+#define EDGEBASEDGRAPH_H_INCLUDED
+
+#include "interfaces/iimporter.h"
+#include "interfaces/irouter.h"
+#include "roadedgeindex.h"
+#include "utils/qthelpers.h"
+#include <QFile>
+#include <QtDebug>
+#include <algorithm>
+#include <vector>
+
+// turns the road network into an edge-based graph that models turn penalties and restrictions:
+// every direction a road edge can be traversed in becomes a node located at the end of the road edge,
+// every allowed turn becomes an edge carrying the weight of the next road edge plus the turn penalty.
+// the result is contracted and compressed like the road network itself,
+// so the penalty tables end up in the weights of the per-block edges
+class EdgeBasedGraph {
+
+public:
+
+	typedef IImporter::RoutingEdge RoutingEdge;
+
+	EdgeBasedGraph( const std::vector< IImporter::RoutingNode >& nodes, const std::vector< RoutingEdge >& edges, const std::vector< IRouter::Node >& edgePaths ) :
+			m_nodes( nodes ), m_edges( edges ), m_edgePaths( edgePaths )
+	{
+	}
+
+	// the penalty of turning from incoming edge a into outgoing edge b at node is
+	// penalties[begin( node ) + a * outDegree[node] + b], negative penalties forbid the turn
+	bool run( const std::vector< char >& inDegree, const std::vector< char >& outDegree, const std::vector< double >& penalties )
+	{
+		Timer time;
+		const unsigned numberOfNodes = m_nodes.size();
+
+		std::vector< unsigned > tableBegin;
+		bool hasPenalties = inDegree.size() == numberOfNodes && outDegree.size() == numberOfNodes;
+		if ( hasPenalties ) {
+			tableBegin.resize( numberOfNodes + 1, 0 );
+			for ( unsigned node = 0; node < numberOfNodes; node++ )
+				tableBegin[node + 1] = tableBegin[node] + ( unsigned char ) inDegree[node] * ( unsigned char ) outDegree[node];
+			hasPenalties = tableBegin.back() == penalties.size();
+		}
+		if ( !hasPenalties )
+			qCritical() << "edge-based graph: turn penalty tables do not match the road network, all turns are allowed";
+
+		// one node per traversable direction
+		m_arcs.clear();
+		m_forwardArc.assign( m_edges.size(), RoadEdgeIndex::noNode );
+		m_backwardArc.assign( m_edges.size(), RoadEdgeIndex::noNode );
+		for ( unsigned edge = 0; edge < m_edges.size(); edge++ ) {
+			m_forwardArc[edge] = m_arcs.size();
+			m_arcs.push_back( Arc( edge, true ) );
+			if ( m_edges[edge].bidirectional ) {
+				m_backwardArc[edge] = m_arcs.size();
+				m_arcs.push_back( Arc( edge, false ) );
+			}
+		}
+
+		// index the arcs by the node they leave
+		std::vector< unsigned > firstOut( numberOfNodes + 1, 0 );
+		for ( unsigned arc = 0; arc < m_arcs.size(); arc++ )
+			firstOut[tail( m_arcs[arc] ) + 1]++;
+		for ( unsigned node = 0; node < numberOfNodes; node++ )
+			firstOut[node + 1] += firstOut[node];
+		std::vector< unsigned > outArcs( m_arcs.size() );
+		{
+			std::vector< unsigned > position( firstOut.begin(), firstOut.end() - 1 );
+			for ( unsigned arc = 0; arc < m_arcs.size(); arc++ )
+				outArcs[position[tail( m_arcs[arc] )]++] = arc;
+		}
+
+		// backward arcs need their path descriptions in reverse
+		m_arcPaths.assign( m_edgePaths.begin(), m_edgePaths.end() );
+		m_arcPathIDs.resize( m_arcs.size() );
+		for ( unsigned arc = 0; arc < m_arcs.size(); arc++ ) {
+			const RoutingEdge& edge = m_edges[m_arcs[arc].edge];
+			if ( m_arcs[arc].forward || edge.pathLength == 0 ) {
+				m_arcPathIDs[arc] = edge.pathID;
+				continue;
+			}
+			m_arcPathIDs[arc] = m_arcPaths.size();
+			for ( unsigned i = edge.pathID + edge.pathLength; i > edge.pathID; i-- )
+				m_arcPaths.push_back( m_edgePaths[i - 1] );
+		}
+
+		long long forbiddenTurns = 0;
+		long long invalidTurns = 0;
+		m_turns.clear();
+		for ( unsigned from = 0; from < m_arcs.size(); from++ ) {
+			const unsigned node = head( m_arcs[from] );
+			for ( unsigned i = firstOut[node]; i < firstOut[node + 1]; i++ ) {
+				const unsigned to = outArcs[i];
+				if ( to == from )
+					continue;
+
+				double penalty = 0;
+				if ( hasPenalties ) {
+					const unsigned in = incomingID( m_arcs[from] );
+					const unsigned out = outgoingID( m_arcs[to] );
+					const unsigned degree = ( unsigned char ) outDegree[node];
+					if ( in < ( unsigned char ) inDegree[node] && out < degree )
+						penalty = penalties[tableBegin[node] + in * degree + out];
+					else
+						invalidTurns++;
+				}
+				if ( penalty < 0 ) {
+					forbiddenTurns++;
+					continue;
+				}
+
+				RoutingEdge turn = m_edges[m_arcs[to].edge];
+				turn.source = from;
+				turn.target = to;
+				turn.distance += penalty;
+				turn.bidirectional = false;
+				turn.pathID = m_arcPathIDs[to];
+				m_turns.push_back( turn );
+			}
+		}
+
+		qDebug() << "edge-based graph:" << m_arcs.size() << "nodes," << m_turns.size() << "edges";
+		qDebug() << "edge-based graph: forbidden turns:" << forbiddenTurns;
+		if ( invalidTurns > 0 )
+			qDebug() << "edge-based graph: turns without penalty table entry:" << invalidTurns;
+		qDebug() << "edge-based graph: built in" << time.elapsed() << "ms";
+		return true;
+	}
+
+	unsigned numberOfNodes() const
+	{
+		return m_arcs.size();
+	}
+
+	// the coordinates of the edge-based nodes, the end of their road edges
+	void GetNodes( std::vector< IRouter::Node >* nodes ) const
+	{
+		nodes->resize( m_arcs.size() );
+		for ( unsigned arc = 0; arc < m_arcs.size(); arc++ )
+			( *nodes )[arc].coordinate = m_nodes[head( m_arcs[arc] )].coordinate;
+	}
+
+	// the turns in the format of the road network's edges
+	void GetEdges( std::vector< RoutingEdge >* edges )
+	{
+		edges->swap( m_turns );
+		std::vector< RoutingEdge >().swap( m_turns );
+	}
+
+	void GetEdgePaths( std::vector< IRouter::Node >* edgePaths )
+	{
+		edgePaths->swap( m_arcPaths );
+		std::vector< IRouter::Node >().swap( m_arcPaths );
+	}
+
+	// numbers parallel road edges, source + target + edgeID identify a road edge
+	void GetEdgeIDMap( std::vector< unsigned >* edgeIDs ) const
+	{
+		std::vector< unsigned > order;
+		sortedEdges( &order );
+		edgeIDs->assign( m_edges.size(), 0 );
+		for ( unsigned i = 1; i < order.size(); i++ ) {
+			const RoutingEdge& previous = m_edges[order[i - 1]];
+			const RoutingEdge& edge = m_edges[order[i]];
+			if ( edge.source == previous.source && edge.target == previous.target )
+				( *edgeIDs )[order[i]] = ( *edgeIDs )[order[i - 1]] + 1;
+		}
+	}
+
+	// writes the road edge index, map translates the edge-based nodes to the final node ids
+	bool writeRoadEdges( const QString& filename, const std::vector< NodeID >& map ) const
+	{
+		QFile entriesFile( filename + "_road_edges" );
+		QFile pathsFile( filename + "_road_edge_paths" );
+		if ( !openQFile( &entriesFile, QIODevice::WriteOnly ) )
+			return false;
+		if ( !openQFile( &pathsFile, QIODevice::WriteOnly ) )
+			return false;
+
+		std::vector< unsigned > edgeIDs;
+		GetEdgeIDMap( &edgeIDs );
+		std::vector< unsigned > order;
+		sortedEdges( &order );
+
+		unsigned pathID = 0;
+		for ( unsigned i = 0; i < order.size(); i++ ) {
+			const unsigned edge = order[i];
+			const RoutingEdge& roadEdge = m_edges[edge];
+			RoadEdgeIndex::Entry entry;
+			entry.source = roadEdge.source;
+			entry.target = roadEdge.target;
+			entry.edgeID = edgeIDs[edge];
+			entry.forwardNode = map[m_forwardArc[edge]];
+			entry.backwardNode = m_backwardArc[edge] == RoadEdgeIndex::noNode ? RoadEdgeIndex::noNode : map[m_backwardArc[edge]];
+			// same rounding as the contractor applies to edge weights
+			entry.distance = std::max( roadEdge.distance * 10.0 + 0.5, 1.0 );
+			entry.nameID = roadEdge.nameID;
+			entry.pathID = pathID;
+			entry.pathLength = roadEdge.pathLength + 2;
+			entry.type = roadEdge.type;
+			entry.branchingPossible = roadEdge.branchingPossible ? 1 : 0;
+			entriesFile.write( ( const char* ) &entry, sizeof( entry ) );
+
+			writeCoordinate( &pathsFile, m_nodes[roadEdge.source].coordinate );
+			for ( unsigned path = roadEdge.pathID; path < roadEdge.pathID + roadEdge.pathLength; path++ )
+				writeCoordinate( &pathsFile, m_edgePaths[path].coordinate );
+			writeCoordinate( &pathsFile, m_nodes[roadEdge.target].coordinate );
+			pathID += entry.pathLength;
+		}
+
+		qDebug() << "edge-based graph: road edge index:" << ( entriesFile.size() + pathsFile.size() ) / 1024 / 1024 << "MB";
+		return true;
+	}
+
+protected:
+
+	struct Arc {
+		unsigned edge;
+		bool forward;
+		Arc( unsigned e, bool f ) :
+				edge( e ), forward( f )
+		{
+		}
+	};
+
+	class EdgeOrder {
+	public:
+		EdgeOrder( const std::vector< RoutingEdge >& edges ) :
+				m_edges( edges )
+		{
+		}
+		bool operator()( unsigned left, unsigned right ) const
+		{
+			if ( m_edges[left].source != m_edges[right].source )
+				return m_edges[left].source < m_edges[right].source;
+			if ( m_edges[left].target != m_edges[right].target )
+				return m_edges[left].target < m_edges[right].target;
+			return left < right;
+		}
+	protected:
+		const std::vector< RoutingEdge >& m_edges;
+	};
+
+	NodeID tail( const Arc& arc ) const
+	{
+		return arc.forward ? m_edges[arc.edge].source : m_edges[arc.edge].target;
+	}
+
+	NodeID head( const Arc& arc ) const
+	{
+		return arc.forward ? m_edges[arc.edge].target : m_edges[arc.edge].source;
+	}
+
+	// the id among the incoming edges of the head
+	unsigned incomingID( const Arc& arc ) const
+	{
+		return arc.forward ? m_edges[arc.edge].edgeIDAtTarget : m_edges[arc.edge].edgeIDAtSource;
+	}
+
+	// the id among the outgoing edges of the tail
+	unsigned outgoingID( const Arc& arc ) const
+	{
+		return arc.forward ? m_edges[arc.edge].edgeIDAtSource : m_edges[arc.edge].edgeIDAtTarget;
+	}
+
+	void sortedEdges( std::vector< unsigned >* order ) const
+	{
+		order->resize( m_edges.size() );
+		for ( unsigned edge = 0; edge < m_edges.size(); edge++ )
+			( *order )[edge] = edge;
+		std::sort( order->begin(), order->end(), EdgeOrder( m_edges ) );
+	}
+
+	static void writeCoordinate( QFile* file, const UnsignedCoordinate& coordinate )
+	{
+		file->write( ( const char* ) &coordinate.x, sizeof( unsigned ) );
+		file->write( ( const char* ) &coordinate.y, sizeof( unsigned ) );
+	}
+
+	const std::vector< IImporter::RoutingNode >& m_nodes;
+	const std::vector< RoutingEdge >& m_edges;
+	const std::vector< IRouter::Node >& m_edgePaths;
+	std::vector< Arc > m_arcs;
+	std::vector< NodeID > m_forwardArc;
+	std::vector< NodeID > m_backwardArc;
+	std::vector< unsigned > m_arcPathIDs;
+	std::vector< IRouter::Node > m_arcPaths;
+	std::vector< RoutingEdge > m_turns;
+};
+
+#endif // EDGEBASEDGRAPH_H_INCLUDED
@@ -0,0 +1,273 @@
+/*
+Copyright 2010  Christian Vetter veaac.fdirct@gmail.com
+
+This file is part of MoNav.
+
+MoNav is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+MoNav is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HUBLABELBUILDER_H_INCLUDED
+#define HUBLABELBUILDER_H_INCLUDED
+
+#include "compressedgraph.h"
+#include "hublabels.h"
+#include "utils/qthelpers.h"
+#include <QFile>
+#include <QtDebug>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#ifndef _OPENMP
+#define omp_get_thread_num() (0)
+#define omp_get_max_threads() (1)
+#else
+#include <omp.h>
+#endif
+
+// Derives hub labels from the contracted graph ( hierarchical hub labeling ):
+// a node's label is its upward search space, computed top-down from the labels of its upward neighbours.
+// Entries whose distance is not a shortest distance are pruned by querying the partial labels.
+// Expects the node IDs of ContractionCleanup: lower IDs are more important, edges point upwards.
+class HubLabelBuilder {
+
+public:
+
+	typedef CompressedGraph::Edge Edge;
+
+	HubLabelBuilder( unsigned numberOfNodes, const std::vector< Edge >& edges )
+	{
+		m_numberOfNodes = numberOfNodes;
+		for ( int direction = 0; direction < 2; direction++ ) {
+			m_arcBegin[direction].assign( numberOfNodes + 1, 0 );
+			for ( unsigned edge = 0; edge < edges.size(); edge++ ) {
+				if ( allowed( edges[edge], direction ) )
+					m_arcBegin[direction][edges[edge].source + 1]++;
+			}
+			for ( unsigned node = 0; node < numberOfNodes; node++ )
+				m_arcBegin[direction][node + 1] += m_arcBegin[direction][node];
+			m_arcs[direction].resize( m_arcBegin[direction][numberOfNodes] );
+			std::vector< unsigned > position( m_arcBegin[direction].begin(), m_arcBegin[direction].end() - 1 );
+			for ( unsigned edge = 0; edge < edges.size(); edge++ ) {
+				if ( !allowed( edges[edge], direction ) )
+					continue;
+				Entry& arc = m_arcs[direction][position[edges[edge].source]++];
+				arc.hub = edges[edge].target;
+				arc.distance = edges[edge].data.distance;
+			}
+		}
+	}
+
+	void run()
+	{
+		Timer time;
+		computeLevels();
+		for ( int direction = 0; direction < 2; direction++ )
+			m_labels[direction].resize( m_numberOfNodes );
+
+		// the labels of a level only depend on the labels of the levels above
+		for ( unsigned level = 0; level + 1 < m_levelBegin.size(); level++ ) {
+			const int begin = m_levelBegin[level];
+			const int end = m_levelBegin[level + 1];
+#pragma omp parallel for schedule( guided )
+			for ( int i = begin; i < end; i++ ) {
+				const NodeID node = m_levelNodes[i];
+				computeLabel( node, 0 );
+				computeLabel( node, 1 );
+			}
+		}
+
+		unsigned long long entries = 0;
+		for ( int direction = 0; direction < 2; direction++ ) {
+			for ( unsigned node = 0; node < m_numberOfNodes; node++ )
+				entries += m_labels[direction][node].size();
+		}
+		qDebug() << "hub labels: computed in" << time.elapsed() << "ms";
+		qDebug() << "hub labels: average label size:" << ( double ) entries / std::max( 2u * m_numberOfNodes, 1u );
+	}
+
+	// writes the labels using the final node IDs, remap translates the builder's node IDs into them
+	bool write( const QString& filename, const std::vector< NodeID >& remap )
+	{
+		if ( remap.size() != m_numberOfNodes ) {
+			qCritical() << "hub labels: node map does not match the graph";
+			return false;
+		}
+		NodeID numberOfIDs = 0;
+		for ( unsigned node = 0; node < m_numberOfNodes; node++ )
+			numberOfIDs = std::max( numberOfIDs, remap[node] + 1 );
+		std::vector< NodeID > original( numberOfIDs, std::numeric_limits< NodeID >::max() );
+		for ( unsigned node = 0; node < m_numberOfNodes; node++ )
+			original[remap[node]] = node;
+
+		QFile indexFile( filename + "_labels_index" );
+		QFile labelsFile( filename + "_labels" );
+		if ( !openQFile( &indexFile, QIODevice::WriteOnly ) )
+			return false;
+		if ( !openQFile( &labelsFile, QIODevice::WriteOnly ) )
+			return false;
+
+		std::vector< quint64 > index;
+		index.reserve( 2 * numberOfIDs + 1 );
+		std::vector< unsigned char > buffer;
+		std::vector< Entry > label;
+		quint64 position = 0;
+		for ( NodeID id = 0; id < numberOfIDs; id++ ) {
+			for ( int direction = 0; direction < 2; direction++ ) {
+				index.push_back( position );
+				if ( original[id] == std::numeric_limits< NodeID >::max() )
+					continue;
+				label.clear();
+				std::vector< Entry >& entries = m_labels[direction][original[id]];
+				for ( unsigned i = 0; i < entries.size(); i++ ) {
+					Entry entry = entries[i];
+					entry.hub = remap[entry.hub];
+					label.push_back( entry );
+				}
+				std::vector< Entry >().swap( entries );
+				std::sort( label.begin(), label.end() );
+
+				buffer.clear();
+				NodeID lastHub = 0;
+				for ( unsigned i = 0; i < label.size(); i++ ) {
+					HubLabels::writeVarint( &buffer, label[i].hub - lastHub );
+					HubLabels::writeVarint( &buffer, label[i].distance );
+					lastHub = label[i].hub;
+				}
+				if ( labelsFile.write( ( const char* ) &buffer[0], buffer.size() ) != ( qint64 ) buffer.size() ) {
+					qCritical() << "hub labels: failed to write the labels";
+					return false;
+				}
+				position += buffer.size();
+			}
+		}
+		index.push_back( position );
+		if ( indexFile.write( ( const char* ) &index[0], index.size() * sizeof( quint64 ) ) != ( qint64 ) ( index.size() * sizeof( quint64 ) ) ) {
+			qCritical() << "hub labels: failed to write the label index";
+			return false;
+		}
+		qDebug() << "hub labels: wrote" << position / 1024 / 1024 << "MB of labels";
+		return true;
+	}
+
+private:
+
+	struct Entry {
+		NodeID hub;
+		unsigned distance;
+
+		bool operator<( const Entry& right ) const {
+			if ( hub != right.hub )
+				return hub < right.hub;
+			return distance < right.distance;
+		}
+	};
+
+	// direction 0 follows the edges forward, direction 1 backward
+	static bool allowed( const Edge& edge, int direction )
+	{
+		if ( edge.source == edge.target )
+			return false;
+		return direction == 0 ? edge.data.forward : edge.data.backward;
+	}
+
+	// groups the nodes into levels whose upward neighbours all belong to earlier levels
+	void computeLevels()
+	{
+		std::vector< unsigned > level( m_numberOfNodes, 0 );
+		unsigned numberOfLevels = m_numberOfNodes == 0 ? 0 : 1;
+		for ( NodeID node = 0; node < m_numberOfNodes; node++ ) {
+			for ( int direction = 0; direction < 2; direction++ ) {
+				for ( unsigned arc = m_arcBegin[direction][node]; arc < m_arcBegin[direction][node + 1]; arc++ ) {
+					assert( m_arcs[direction][arc].hub < node );
+					level[node] = std::max( level[node], level[m_arcs[direction][arc].hub] + 1 );
+				}
+			}
+			numberOfLevels = std::max( numberOfLevels, level[node] + 1 );
+		}
+		m_levelBegin.assign( numberOfLevels + 1, 0 );
+		for ( NodeID node = 0; node < m_numberOfNodes; node++ )
+			m_levelBegin[level[node] + 1]++;
+		for ( unsigned i = 0; i < numberOfLevels; i++ )
+			m_levelBegin[i + 1] += m_levelBegin[i];
+		m_levelNodes.resize( m_numberOfNodes );
+		std::vector< unsigned > position( m_levelBegin.begin(), m_levelBegin.end() - 1 );
+		for ( NodeID node = 0; node < m_numberOfNodes; node++ )
+			m_levelNodes[position[level[node]]++] = node;
+		qDebug() << "hub labels:" << numberOfLevels << "levels";
+	}
+
+	void computeLabel( NodeID node, int direction )
+	{
+		std::vector< Entry > candidates;
+		Entry self;
+		self.hub = node;
+		self.distance = 0;
+		candidates.push_back( self );
+		for ( unsigned arc = m_arcBegin[direction][node]; arc < m_arcBegin[direction][node + 1]; arc++ ) {
+			const std::vector< Entry >& label = m_labels[direction][m_arcs[direction][arc].hub];
+			for ( unsigned i = 0; i < label.size(); i++ ) {
+				Entry entry = label[i];
+				entry.distance += m_arcs[direction][arc].distance;
+				candidates.push_back( entry );
+			}
+		}
+		// keep the shortest distance per hub
+		std::sort( candidates.begin(), candidates.end() );
+		unsigned size = 0;
+		for ( unsigned i = 0; i < candidates.size(); i++ ) {
+			if ( size != 0 && candidates[size - 1].hub == candidates[i].hub )
+				continue;
+			candidates[size++] = candidates[i];
+		}
+		candidates.resize( size );
+
+		// an entry is superfluous if a different hub already yields a shorter path
+		std::vector< Entry >& result = m_labels[direction][node];
+		for ( unsigned i = 0; i < candidates.size(); i++ ) {
+			if ( candidates[i].hub != node && query( candidates, m_labels[1 - direction][candidates[i].hub] ) < candidates[i].distance )
+				continue;
+			result.push_back( candidates[i] );
+		}
+		std::vector< Entry >( result ).swap( result );
+	}
+
+	static unsigned query( const std::vector< Entry >& first, const std::vector< Entry >& second )
+	{
+		unsigned result = std::numeric_limits< unsigned >::max();
+		std::vector< Entry >::const_iterator i = first.begin(), iend = first.end();
+		std::vector< Entry >::const_iterator j = second.begin(), jend = second.end();
+		while ( i != iend && j != jend ) {
+			if ( i->hub < j->hub ) {
+				++i;
+			} else if ( j->hub < i->hub ) {
+				++j;
+			} else {
+				result = std::min( result, i->distance + j->distance );
+				++i;
+				++j;
+			}
+		}
+		return result;
+	}
+
+	unsigned m_numberOfNodes;
+	std::vector< unsigned > m_arcBegin[2];
+	std::vector< Entry > m_arcs[2];
+	std::vector< unsigned > m_levelBegin;
+	std::vector< NodeID > m_levelNodes;
+	std::vector< std::vector< Entry > > m_labels[2];
+};
+
+#endif // HUBLABELBUILDER_H_INCLUDED
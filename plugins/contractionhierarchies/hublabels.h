@@ -0,0 +1,179 @@
+/*
+Copyright 2010  Christian Vetter veaac.fdirct@gmail.com
+
+This file is part of MoNav.
+
+MoNav is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+MoNav is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HUBLABELS_H_INCLUDED
+#define HUBLABELS_H_INCLUDED
+
+#include "utils/config.h"
+#include "utils/qthelpers.h"
+#include <QFile>
+#include <QtDebug>
+#include <limits>
+#include <vector>
+
+// distance oracle answering queries by merging the hub labels of source and target
+// every node of the contracted graph has a forward and a backward label sorted by hub
+// the labels are stored as a sequence of varint encoded ( hub delta, distance ) pairs
+// and an index holding the offsets of the labels, node n's forward label spans
+// [ index[2n], index[2n + 1] ), its backward label [ index[2n + 1], index[2n + 2] )
+class HubLabels {
+
+public:
+
+	HubLabels()
+	{
+		m_index = NULL;
+		m_labels = NULL;
+		m_numberOfNodes = 0;
+	}
+
+	~HubLabels()
+	{
+		unload();
+	}
+
+	static bool exists( const QString& filename )
+	{
+		return QFile::exists( filename + "_labels_index" );
+	}
+
+	bool load( const QString& filename )
+	{
+		unload();
+		m_indexFile.setFileName( filename + "_labels_index" );
+		m_labelsFile.setFileName( filename + "_labels" );
+		if ( !openQFile( &m_indexFile, QIODevice::ReadOnly ) )
+			return false;
+		if ( !openQFile( &m_labelsFile, QIODevice::ReadOnly ) )
+			return false;
+		unsigned long long entries = m_indexFile.size() / sizeof( quint64 );
+		if ( entries < 3 || entries % 2 != 1 || m_labelsFile.size() == 0 ) {
+			qCritical() << "hub label file is corrupted";
+			return false;
+		}
+		m_numberOfNodes = ( entries - 1 ) / 2;
+		m_index = ( const quint64* ) m_indexFile.map( 0, m_indexFile.size() );
+		m_labels = ( const unsigned char* ) m_labelsFile.map( 0, m_labelsFile.size() );
+		if ( m_index == NULL || m_labels == NULL ) {
+			qCritical() << "failed to map the hub labels";
+			unload();
+			return false;
+		}
+		if ( m_index[2 * m_numberOfNodes] != ( quint64 ) m_labelsFile.size() ) {
+			qCritical() << "hub label index does not match the labels";
+			unload();
+			return false;
+		}
+		return true;
+	}
+
+	void unload()
+	{
+		if ( m_index != NULL )
+			m_indexFile.unmap( ( uchar* ) m_index );
+		if ( m_labels != NULL )
+			m_labelsFile.unmap( ( uchar* ) m_labels );
+		m_index = NULL;
+		m_labels = NULL;
+		m_numberOfNodes = 0;
+		m_indexFile.close();
+		m_labelsFile.close();
+	}
+
+	bool isLoaded() const
+	{
+		return m_index != NULL;
+	}
+
+	// shortest distance from source to target, std::numeric_limits< unsigned >::max() if unreachable
+	unsigned distance( NodeID source, NodeID target ) const
+	{
+		const unsigned infinity = std::numeric_limits< unsigned >::max();
+		if ( source >= m_numberOfNodes || target >= m_numberOfNodes )
+			return infinity;
+		const unsigned char* forward = m_labels + m_index[2 * source];
+		const unsigned char* forwardEnd = m_labels + m_index[2 * source + 1];
+		const unsigned char* backward = m_labels + m_index[2 * target + 1];
+		const unsigned char* backwardEnd = m_labels + m_index[2 * target + 2];
+		if ( forward == forwardEnd || backward == backwardEnd )
+			return infinity;
+
+		unsigned result = infinity;
+		unsigned forwardHub = readVarint( &forward );
+		unsigned forwardDistance = readVarint( &forward );
+		unsigned backwardHub = readVarint( &backward );
+		unsigned backwardDistance = readVarint( &backward );
+		while ( true ) {
+			if ( forwardHub < backwardHub ) {
+				if ( forward == forwardEnd )
+					break;
+				forwardHub += readVarint( &forward );
+				forwardDistance = readVarint( &forward );
+			} else if ( backwardHub < forwardHub ) {
+				if ( backward == backwardEnd )
+					break;
+				backwardHub += readVarint( &backward );
+				backwardDistance = readVarint( &backward );
+			} else {
+				if ( forwardDistance + backwardDistance < result )
+					result = forwardDistance + backwardDistance;
+				if ( forward == forwardEnd || backward == backwardEnd )
+					break;
+				forwardHub += readVarint( &forward );
+				forwardDistance = readVarint( &forward );
+				backwardHub += readVarint( &backward );
+				backwardDistance = readVarint( &backward );
+			}
+		}
+		return result;
+	}
+
+	static void writeVarint( std::vector< unsigned char >* buffer, unsigned value )
+	{
+		while ( value >= 128 ) {
+			buffer->push_back( ( value & 127 ) | 128 );
+			value >>= 7;
+		}
+		buffer->push_back( value );
+	}
+
+	static unsigned readVarint( const unsigned char** buffer )
+	{
+		const unsigned char* data = *buffer;
+		unsigned value = *data & 127;
+		unsigned shift = 7;
+		while ( *data & 128 ) {
+			data++;
+			value |= ( unsigned ) ( *data & 127 ) << shift;
+			shift += 7;
+		}
+		*buffer = data + 1;
+		return value;
+	}
+
+protected:
+
+	QFile m_indexFile;
+	QFile m_labelsFile;
+	const quint64* m_index;
+	const unsigned char* m_labels;
+	unsigned m_numberOfNodes;
+};
+
+#endif // HUBLABELS_H_INCLUDED
@@ -0,0 +1,210 @@
+/*
+Copyright 2010  Christian Vetter veaac.fdirct@gmail.com
+
+This file is part of MoNav.
+
+MoNav is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+MoNav is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ROADEDGEINDEX_H_INCLUDED
+#define ROADEDGEINDEX_H_INCLUDED
+
+#include "utils/config.h"
+#include "utils/coordinates.h"
+#include "utils/qthelpers.h"
+#include "interfaces/igpslookup.h"
+#include "interfaces/irouter.h"
+#include <QFile>
+#include <QtDebug>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+// maps the road edges returned by the GPS lookup to the nodes of an edge-based graph
+// every direction a road edge can be traversed in is a node of the edge-based graph,
+// reaching it means having traversed the road edge completely
+class RoadEdgeIndex {
+
+public:
+
+	struct Entry {
+		// source + target + edgeID as returned by the GPS lookup
+		NodeID source;
+		NodeID target;
+		unsigned edgeID;
+		// the graph's nodes for traversing source -> target and target -> source, noNode if not allowed
+		NodeID forwardNode;
+		NodeID backwardNode;
+		// the weight of the road edge in the graph's units
+		unsigned distance;
+		unsigned nameID;
+		// the road edge's coordinates including source and target
+		unsigned pathID;
+		unsigned pathLength;
+		unsigned short type;
+		unsigned short branchingPossible;
+
+		bool operator<( const Entry& right ) const {
+			if ( source != right.source )
+				return source < right.source;
+			if ( target != right.target )
+				return target < right.target;
+			return edgeID < right.edgeID;
+		}
+	};
+
+	static const NodeID noNode = ~0u;
+
+	RoadEdgeIndex()
+	{
+		m_entries = NULL;
+		m_paths = NULL;
+		m_size = 0;
+	}
+
+	~RoadEdgeIndex()
+	{
+		unload();
+	}
+
+	static bool exists( const QString& filename )
+	{
+		return QFile::exists( filename + "_road_edges" );
+	}
+
+	bool load( const QString& filename )
+	{
+		unload();
+		m_entriesFile.setFileName( filename + "_road_edges" );
+		m_pathsFile.setFileName( filename + "_road_edge_paths" );
+		if ( !openQFile( &m_entriesFile, QIODevice::ReadOnly ) )
+			return false;
+		if ( !openQFile( &m_pathsFile, QIODevice::ReadOnly ) )
+			return false;
+		m_size = m_entriesFile.size() / sizeof( Entry );
+		if ( m_size == 0 || m_pathsFile.size() == 0 ) {
+			qCritical() << "road edge index is empty";
+			return false;
+		}
+		m_entries = ( const Entry* ) m_entriesFile.map( 0, m_entriesFile.size() );
+		m_paths = ( const unsigned* ) m_pathsFile.map( 0, m_pathsFile.size() );
+		if ( m_entries == NULL || m_paths == NULL ) {
+			qCritical() << "failed to map the road edge index";
+			unload();
+			return false;
+		}
+		// the entries are sorted by their source, the arcs ending at a node are found through their targets
+		m_byTarget.resize( m_size );
+		for ( unsigned i = 0; i < m_size; i++ )
+			m_byTarget[i] = i;
+		std::sort( m_byTarget.begin(), m_byTarget.end(), TargetLess( m_entries ) );
+		return true;
+	}
+
+	void unload()
+	{
+		if ( m_entries != NULL )
+			m_entriesFile.unmap( ( uchar* ) m_entries );
+		if ( m_paths != NULL )
+			m_pathsFile.unmap( ( uchar* ) m_paths );
+		m_entries = NULL;
+		m_paths = NULL;
+		m_size = 0;
+		m_byTarget.clear();
+		m_entriesFile.close();
+		m_pathsFile.close();
+	}
+
+	bool isLoaded() const
+	{
+		return m_entries != NULL;
+	}
+
+	// returns NULL if the edge is not part of the graph
+	const Entry* find( const IGPSLookup::Result& position ) const
+	{
+		Entry key;
+		key.source = position.source;
+		key.target = position.target;
+		key.edgeID = position.edgeID;
+		const Entry* entry = std::lower_bound( m_entries, m_entries + m_size, key );
+		if ( entry == m_entries + m_size || key < *entry )
+			return NULL;
+		return entry;
+	}
+
+	// the nodes of the graph that start at the road network's node
+	void arcsLeaving( NodeID node, std::vector< NodeID >* arcs ) const
+	{
+		arcs->clear();
+		Entry key;
+		key.source = node;
+		key.target = 0;
+		key.edgeID = 0;
+		for ( const Entry* entry = std::lower_bound( m_entries, m_entries + m_size, key ); entry != m_entries + m_size && entry->source == node; ++entry ) {
+			if ( entry->forwardNode != noNode )
+				arcs->push_back( entry->forwardNode );
+		}
+		std::vector< unsigned >::const_iterator i = std::lower_bound( m_byTarget.begin(), m_byTarget.end(), node, TargetBelow( m_entries ) );
+		for ( ; i != m_byTarget.end() && m_entries[*i].target == node; ++i ) {
+			if ( m_entries[*i].backwardNode != noNode )
+				arcs->push_back( m_entries[*i].backwardNode );
+		}
+	}
+
+	UnsignedCoordinate coordinate( const Entry& entry, unsigned i ) const
+	{
+		assert( i < entry.pathLength );
+		const unsigned* data = m_paths + 2 * ( entry.pathID + i );
+		return UnsignedCoordinate( data[0], data[1] );
+	}
+
+	IRouter::Edge description( const Entry& entry, unsigned length, unsigned seconds ) const
+	{
+		return IRouter::Edge( entry.nameID, entry.branchingPossible != 0, entry.type, length, seconds );
+	}
+
+protected:
+
+	// orders entry indices by the entries' targets
+	class TargetLess {
+	public:
+		TargetLess( const Entry* entries ) : m_entries( entries ) {}
+		bool operator()( unsigned left, unsigned right ) const {
+			return m_entries[left].target < m_entries[right].target;
+		}
+	private:
+		const Entry* m_entries;
+	};
+
+	// compares an entry index's target with a node
+	class TargetBelow {
+	public:
+		TargetBelow( const Entry* entries ) : m_entries( entries ) {}
+		bool operator()( unsigned entry, NodeID node ) const {
+			return m_entries[entry].target < node;
+		}
+	private:
+		const Entry* m_entries;
+	};
+
+	QFile m_entriesFile;
+	QFile m_pathsFile;
+	const Entry* m_entries;
+	const unsigned* m_paths;
+	unsigned m_size;
+	std::vector< unsigned > m_byTarget;
+};
+
+#endif // ROADEDGEINDEX_H_INCLUDED
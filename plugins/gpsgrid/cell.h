@@ -56,8 +56,46 @@ namespace gg
 			}
 		};
 
+		// the segments of all edges' paths in order as structure of arrays, filled by read
+		// segment s runs from ( x[s], y[s] ) to ( x[s] + dx[s], y[s] + dy[s] )
+		struct Segments {
+			std::vector< double > x;
+			std::vector< double > y;
+			std::vector< double > dx;
+			std::vector< double > dy;
+			// 1 / ( dx^2 + dy^2 ), 0 for segments of length 0
+			std::vector< double > inverseLength2;
+			// atan2( dy, dx ) in 256ths of a full turn
+			std::vector< unsigned char > bearing;
+		};
+
+		enum {
+			// the segment arrays are padded with empty segments to a multiple of this
+			SegmentPadding = 4
+		};
+
 		std::vector< Edge > edges;
 		std::vector< UnsignedCoordinate > coordinates;
+		Segments segments;
+
+		// empties the cell but keeps the memory for the next read
+		void clear()
+		{
+			edges.clear();
+			coordinates.clear();
+			segments.x.clear();
+			segments.y.clear();
+			segments.dx.clear();
+			segments.dy.clear();
+			segments.inverseLength2.clear();
+			segments.bearing.clear();
+		}
+
+		static unsigned char Bearing( UnsignedCoordinate source, UnsignedCoordinate target )
+		{
+			const double direction = atan2( ( double ) target.y - source.y, ( double ) target.x - source.x );
+			return ( int ) floor( direction * 128 / M_PI + 0.5 ) & 255;
+		}
 
 		bool operator==( const Cell& right ) const
 		{
@@ -186,38 +224,43 @@ namespace gg
 				writeCoordinate( &buffer, &offset, i->y, min.y, max.y, yBits);
 			}
 
+			// the bearings of all segments, lookups with a heading do not need atan2 then
+			for ( std::vector< Edge >::const_iterator i = edges.begin(), e = edges.end(); i != e; i++ ) {
+				for ( int pathID = 1; pathID < i->pathLength; pathID++ )
+					write_unaligned_unsigned( &buffer, Bearing( coordinates[pathID + i->pathID - 1], coordinates[pathID + i->pathID] ), 8, &offset );
+			}
+
 			buffer += ( offset + 7 ) / 8;
 
 			return buffer - oldBuffer;
 		}
 
-		size_t  read( const unsigned char* buffer, UnsignedCoordinate min, UnsignedCoordinate max ) {
-			const unsigned char* oldBuffer = buffer;
-
-			int offset = 0;
+		// cells of grid file format versions 1 and 2 do not store the bearings, they are computed instead
+		size_t  read( const unsigned char* buffer, UnsignedCoordinate min, UnsignedCoordinate max, bool storedBearings = true ) {
+			BitReader reader( buffer );
 
 			const char xBits = bits_needed( max.x - min.x );
 			const char yBits = bits_needed( max.y - min.y );
 
-			unsigned numEdges = read_unaligned_unsigned( &buffer, 32, &offset );
-			unsigned minID = read_unaligned_unsigned( &buffer, 32, &offset );
-			unsigned idBits = read_unaligned_unsigned( &buffer, 6, &offset );
-			unsigned edgeIDBits = read_unaligned_unsigned( &buffer, 6, &offset );
-			unsigned pathLengthBits = read_unaligned_unsigned( &buffer, 6, &offset );
+			unsigned numEdges = reader.read( 32 );
+			unsigned minID = reader.read( 32 );
+			unsigned idBits = reader.read( 6 );
+			unsigned edgeIDBits = reader.read( 6 );
+			unsigned pathLengthBits = reader.read( 6 );
 
 			std::vector< NodeID > nodes;
 			NodeID lastTarget = std::numeric_limits< NodeID >::max();
 			for ( unsigned i = 0; i < numEdges; i++ ) {
 				Edge edge;
-				bool reuse = read_unaligned_unsigned( &buffer, 1, &offset ) == 1;
+				bool reuse = reader.readBit();
 				if ( reuse )
 					edge.source = lastTarget;
 				else
-					edge.source = read_unaligned_unsigned( &buffer, idBits, &offset ) + minID;
-				edge.target = read_unaligned_unsigned( &buffer, idBits, &offset ) + minID;
-				edge.edgeID = read_unaligned_unsigned( &buffer, edgeIDBits, &offset );
-				edge.bidirectional = read_unaligned_unsigned( &buffer, 1, &offset ) == 1;
-				edge.pathLength = read_unaligned_unsigned( &buffer, pathLengthBits, &offset );
+					edge.source = reader.read( idBits ) + minID;
+				edge.target = reader.read( idBits ) + minID;
+				edge.edgeID = reader.read( edgeIDBits );
+				edge.bidirectional = reader.readBit();
+				edge.pathLength = reader.read( pathLengthBits );
 
 				edges.push_back( edge );
 
@@ -233,8 +276,8 @@ namespace gg
 
 			std::vector< UnsignedCoordinate > nodeCoordinates( nodes.size() );
 			for ( std::vector< UnsignedCoordinate >::iterator i = nodeCoordinates.begin(), iend = nodeCoordinates.end(); i != iend; i++ ) {
-				readCoordinate( &buffer, &offset, &i->x, min.x, max.x, xBits);
-				readCoordinate( &buffer, &offset, &i->y, min.y, max.y, yBits);
+				readCoordinate( &reader, &i->x, min.x, max.x, xBits);
+				readCoordinate( &reader, &i->y, min.y, max.y, yBits);
 			}
 
 			for ( std::vector< Edge >::iterator i = edges.begin(), iend = edges.end(); i != iend; i++ ) {
@@ -245,8 +288,8 @@ namespace gg
 				i->pathID = coordinates.size() - 1;
 				for ( int path = 0; path < i->pathLength; path++ ) {
 					UnsignedCoordinate coordinate;
-					readCoordinate( &buffer, &offset, &coordinate.x, min.x, max.x, xBits);
-					readCoordinate( &buffer, &offset, &coordinate.y, min.y, max.y, yBits);
+					readCoordinate( &reader, &coordinate.x, min.x, max.x, xBits);
+					readCoordinate( &reader, &coordinate.y, min.y, max.y, yBits);
 					coordinates.push_back( coordinate );
 				}
 				coordinates.push_back( nodeCoordinates[targetPos] );
@@ -254,9 +297,31 @@ namespace gg
 				i->pathLength += 2;
 			}
 
-			buffer += ( offset + 7 ) / 8;
+			for ( std::vector< Edge >::const_iterator i = edges.begin(), iend = edges.end(); i != iend; i++ ) {
+				for ( int path = 1; path < i->pathLength; path++ ) {
+					const UnsignedCoordinate& source = coordinates[path + i->pathID - 1];
+					const UnsignedCoordinate& target = coordinates[path + i->pathID];
+					const double dx = ( double ) target.x - source.x;
+					const double dy = ( double ) target.y - source.y;
+					const double length2 = dx * dx + dy * dy;
+					segments.x.push_back( source.x );
+					segments.y.push_back( source.y );
+					segments.dx.push_back( dx );
+					segments.dy.push_back( dy );
+					segments.inverseLength2.push_back( length2 == 0 ? 0 : 1 / length2 );
+					segments.bearing.push_back( storedBearings ? reader.read( 8 ) : Bearing( source, target ) );
+				}
+			}
+			while ( segments.x.size() % SegmentPadding != 0 ) {
+				segments.x.push_back( 0 );
+				segments.y.push_back( 0 );
+				segments.dx.push_back( 0 );
+				segments.dy.push_back( 0 );
+				segments.inverseLength2.push_back( 0 );
+				segments.bearing.push_back( 0 );
+			}
 
-			return buffer - oldBuffer;
+			return ( reader.position() + 7 ) / 8;
 		}
 
 	protected:
@@ -271,13 +336,13 @@ namespace gg
 				write_unaligned_unsigned( buffer, value, 32, offset );
 		}
 
-		void readCoordinate( const unsigned char** buffer, int* offset, unsigned* value, unsigned min, unsigned /*max*/, char bits )
+		void readCoordinate( BitReader* reader, unsigned* value, unsigned min, unsigned /*max*/, char bits )
 		{
-			bool inside = read_unaligned_unsigned( buffer, 1, offset ) == 1;
+			bool inside = reader->readBit();
 			if ( inside )
-				*value = read_unaligned_unsigned( buffer, bits, offset ) + min;
+				*value = reader->read( bits ) + min;
 			else
-				*value = read_unaligned_unsigned( buffer, 32, offset );
+				*value = reader->read( 32 );
 		}
 
 	};
@@ -23,7 +23,6 @@ along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
 #endif
 #include "gpsgrid.h"
 #include "cell.h"
-#include "table.h"
 #include "utils/intersection.h"
 #include "utils/qthelpers.h"
 #include <vector>
@@ -46,7 +45,9 @@ QString GPSGrid::GetName()
 
 int GPSGrid::GetFileFormatVersion()
 {
-	return 1;
+	// version 2 replaces the fixed grid with an adaptive quadtree
+	// version 3 stores the bearings of the cells' segments
+	return 3;
 }
 
 GPSGrid::Type GPSGrid::GetType()
@@ -68,6 +69,15 @@ bool GPSGrid::Preprocess( IImporter* importer, QString dir )
 {
 	QString filename = fileInDirectory( dir, "GPSGrid" );
 
+	// running clients keep their mapping of the old files
+	QFile::remove( filename + "_grid" );
+	QFile::remove( filename + "_config" );
+	QFile::remove( filename + "_tree" );
+	// the fixed grid's index is not used any more
+	QFile::remove( filename + "_index_1" );
+	QFile::remove( filename + "_index_2" );
+	QFile::remove( filename + "_index_3" );
+
 	QFile gridFile( filename + "_grid" );
 	QFile configFile( filename + "_config" );
 
@@ -93,121 +103,152 @@ bool GPSGrid::Preprocess( IImporter* importer, QString dir )
 	if ( !importer->GetRoutingEdgePaths( &edgePaths ) )
 		return false;
 
-	static const int width = 32 * 32 * 32;
-
-	std::vector< GridImportEdge > grid;
-
+	// clients tell the grid formats apart by the version stored in the config
+	qint32 version = GetFileFormatVersion();
+	if ( configFile.write( ( const char* ) &version, sizeof( version ) ) != sizeof( version ) ) {
+		qCritical() << "GPS Grid: failed to write the config";
+		return false;
+	}
 	Timer time;
+	TreeBuilder tree;
+	tree.inputNodes = &inputNodes;
+	tree.inputEdges = &inputEdges;
+	tree.edgePaths = &edgePaths;
+	tree.nodeIDs = &nodeIDs;
+	tree.edgeIDs = &edgeIDs;
+	tree.gridFile = &gridFile;
+	tree.position = 0;
+	tree.cellEdges = 0;
+	tree.leaves = 0;
+	tree.maxLeafEdges = 0;
 	for ( std::vector< IImporter::RoutingEdge >::const_iterator i = inputEdges.begin(); i != inputEdges.end(); ++i ) {
-		std::vector< UnsignedCoordinate > path;
-		path.push_back( inputNodes[i->source].coordinate );
+		tree.firstCoordinate.push_back( tree.coordinates.size() );
+		tree.coordinates.push_back( inputNodes[i->source].coordinate );
 		for ( unsigned pathID = 0; pathID < i->pathLength; pathID++ )
-			path.push_back( edgePaths[pathID + i->pathID].coordinate );
-		path.push_back( inputNodes[i->target].coordinate );
-
-		std::vector< std::pair< unsigned, unsigned > > gridCells;
-		for ( unsigned segment = 1; segment < path.size(); segment++ ) {
-			ProjectedCoordinate sourceCoordinate = path[segment - 1].ToProjectedCoordinate();
-			ProjectedCoordinate targetCoordinate = path[segment].ToProjectedCoordinate();
-			sourceCoordinate.x *= width;
-			sourceCoordinate.y *= width;
-			targetCoordinate.x *= width;
-			targetCoordinate.y *= width;
-
-			NodeID minYGrid = floor( sourceCoordinate.y );
-			NodeID minXGrid = floor( sourceCoordinate.x );
-			NodeID maxYGrid = floor( targetCoordinate.y );
-			NodeID maxXGrid = floor( targetCoordinate.x );
-
-			if ( minYGrid > maxYGrid )
-				std::swap( minYGrid, maxYGrid );
-			if ( minXGrid > maxXGrid )
-				std::swap( minXGrid, maxXGrid );
-
-			for ( NodeID yGrid = minYGrid; yGrid <= maxYGrid; ++yGrid ) {
-				for ( NodeID xGrid = minXGrid; xGrid <= maxXGrid; ++xGrid ) {
-					if ( !clipEdge( sourceCoordinate, targetCoordinate, ProjectedCoordinate( xGrid, yGrid ), ProjectedCoordinate( xGrid + 1, yGrid + 1 ) ) )
-						continue;
-
-					gridCells.push_back( std::pair< unsigned, unsigned >( xGrid, yGrid ) );
-				}
-			}
-		}
-		std::sort( gridCells.begin(), gridCells.end() );
-		gridCells.resize( std::unique( gridCells.begin(), gridCells.end() ) - gridCells.begin() );
+			tree.coordinates.push_back( edgePaths[pathID + i->pathID].coordinate );
+		tree.coordinates.push_back( inputNodes[i->target].coordinate );
+	}
+	tree.firstCoordinate.push_back( tree.coordinates.size() );
 
-		GridImportEdge clippedEdge;
-		clippedEdge.edge = i - inputEdges.begin();
+	std::vector< unsigned > edges( inputEdges.size() );
+	for ( unsigned edge = 0; edge < edges.size(); edge++ )
+		edges[edge] = edge;
+	tree.nodes.resize( 1 );
+	if ( !buildNode( &tree, 0, 0, 0, 0, edges ) )
+		return false;
+	qDebug() << "GPS Grid: built tree:" << time.restart() << "ms";
+	qDebug() << "GPS Grid: tree nodes:" << tree.nodes.size();
+	qDebug() << "GPS Grid: leaf cells:" << tree.leaves;
+	qDebug() << "GPS Grid: max leaf edges:" << tree.maxLeafEdges;
+	qDebug() << "GPS Grid: overhead:" << tree.cellEdges - inputEdges.size() << "duplicated edges";
+	if ( !inputEdges.empty() )
+		qDebug() << "GPS Grid: overhead:" << ( tree.cellEdges - inputEdges.size() ) * 100 / inputEdges.size() << "% duplicated edges";
+
+	if ( !gg::QuadTree::Write( filename + "_tree", tree.nodes ) )
+		return false;
 
-		for ( unsigned cell = 0; cell < gridCells.size(); cell++ ) {
-			clippedEdge.x = gridCells[cell].first;
-			clippedEdge.y = gridCells[cell].second;
-			grid.push_back( clippedEdge );
+	return true;
+}
+
+// splits the node into four children until it holds few enough edges to become a leaf
+bool GPSGrid::buildNode( TreeBuilder* tree, unsigned node, unsigned level, unsigned x, unsigned y, const std::vector< unsigned >& edges )
+{
+	tree->nodes[node].position = -1;
+	tree->nodes[node].firstChild = 0;
+	tree->nodes[node].padding = 0;
+	if ( edges.empty() )
+		return true;
+
+	UnsignedCoordinate min;
+	UnsignedCoordinate max;
+	gg::QuadTree::Bounds( level, x, y, &min, &max );
+	if ( edges.size() <= gg::QuadTree::MaxLeafEdges || level == gg::QuadTree::MaxLevel )
+		return writeCell( tree, node, edges, min, max );
+
+	// the children are appended, references into the nodes do not survive this
+	const unsigned firstChild = tree->nodes.size();
+	tree->nodes[node].firstChild = firstChild;
+	tree->nodes.resize( firstChild + 4 );
+
+	std::vector< unsigned > childEdges;
+	for ( unsigned child = 0; child < 4; child++ ) {
+		const unsigned childX = 2 * x + ( child & 1 );
+		const unsigned childY = 2 * y + ( child >> 1 );
+		UnsignedCoordinate childMin;
+		UnsignedCoordinate childMax;
+		gg::QuadTree::Bounds( level + 1, childX, childY, &childMin, &childMax );
+		childEdges.clear();
+		for ( unsigned i = 0; i < edges.size(); i++ ) {
+			if ( intersects( *tree, edges[i], childMin, childMax ) )
+				childEdges.push_back( edges[i] );
 		}
+		if ( !buildNode( tree, firstChild + child, level + 1, childX, childY, childEdges ) )
+			return false;
 	}
-	qDebug() << "GPS Grid: distributed edges:" << time.restart() << "ms";
-	qDebug() << "GPS Grid: overhead:" << grid.size() - inputEdges.size() << "duplicated edges";
-	qDebug() << "GPS Grid: overhead:" << ( grid.size() - inputEdges.size() ) * 100 / inputEdges.size() << "% duplicated edges";
-
-	std::sort( grid.begin(), grid.end() );
-	qDebug() << "GPS Grid: sorted edges:" << time.restart() << "ms";
-
-	std::vector< gg::GridIndex > tempIndex;
-	qint64 position = 0;
-	for ( std::vector< GridImportEdge >::const_iterator edge = grid.begin(); edge != grid.end(); ) {
-		gg::Cell cell;
-		gg::GridIndex entry;
-		entry.x = edge->x;
-		entry.y = edge->y;
-		entry.position = position;
-
-		tempIndex.push_back( entry );
-		do {
-			const IImporter::RoutingEdge& originalEdge = inputEdges[edge->edge];
-			gg::Cell::Edge newEdge;
-			newEdge.source = nodeIDs[originalEdge.source];
-			newEdge.target = nodeIDs[originalEdge.target];
-			newEdge.edgeID = edgeIDs[edge->edge];
-			newEdge.bidirectional = originalEdge.bidirectional;
-			newEdge.pathID = cell.coordinates.size();
-			newEdge.pathLength = 2 + originalEdge.pathLength;
-			cell.coordinates.push_back( inputNodes[originalEdge.source].coordinate );
-			for ( unsigned pathID = 0; pathID < originalEdge.pathLength; pathID++ )
-				cell.coordinates.push_back( edgePaths[pathID + originalEdge.pathID].coordinate );
-			cell.coordinates.push_back( inputNodes[originalEdge.target].coordinate );
-			cell.edges.push_back( newEdge );
-			edge++;
-		} while ( edge != grid.end() && edge->x == entry.x && edge->y == entry.y );
-
-		ProjectedCoordinate min( ( double ) entry.x / width, ( double ) entry.y / width );
-		ProjectedCoordinate max( ( double ) ( entry.x + 1 ) / width, ( double ) ( entry.y + 1 ) / width );
-
-		unsigned maxSize = cell.edges.size() * sizeof( gg::Cell::Edge ) * 2 + cell.coordinates.size() * sizeof( UnsignedCoordinate ) * 2 + 100;
-		unsigned char* buffer = new unsigned char[maxSize];
-		memset( buffer, 0, maxSize );
-		int size = cell.write( buffer, UnsignedCoordinate( min ), UnsignedCoordinate( max ) );
-		assert( size < ( int ) maxSize );
+	return true;
+}
+
+bool GPSGrid::writeCell( TreeBuilder* tree, unsigned node, const std::vector< unsigned >& edges, UnsignedCoordinate min, UnsignedCoordinate max )
+{
+	const std::vector< IImporter::RoutingEdge >& inputEdges = *tree->inputEdges;
+	gg::Cell cell;
+	for ( unsigned i = 0; i < edges.size(); i++ ) {
+		const IImporter::RoutingEdge& originalEdge = inputEdges[edges[i]];
+		gg::Cell::Edge newEdge;
+		newEdge.source = ( *tree->nodeIDs )[originalEdge.source];
+		newEdge.target = ( *tree->nodeIDs )[originalEdge.target];
+		newEdge.edgeID = ( *tree->edgeIDs )[edges[i]];
+		newEdge.bidirectional = originalEdge.bidirectional;
+		newEdge.pathID = cell.coordinates.size();
+		newEdge.pathLength = 2 + originalEdge.pathLength;
+		cell.coordinates.insert( cell.coordinates.end(), tree->coordinates.begin() + tree->firstCoordinate[edges[i]], tree->coordinates.begin() + tree->firstCoordinate[edges[i] + 1] );
+		cell.edges.push_back( newEdge );
+	}
+
+	unsigned maxSize = cell.edges.size() * sizeof( gg::Cell::Edge ) * 2 + cell.coordinates.size() * sizeof( UnsignedCoordinate ) * 2 + 100;
+	unsigned char* buffer = new unsigned char[maxSize];
+	memset( buffer, 0, maxSize );
+	int size = cell.write( buffer, min, max );
+	assert( size < ( int ) maxSize );
 
 #ifndef NDEBUG
-		gg::Cell unpackCell;
-		unpackCell.read( buffer, UnsignedCoordinate( min ), UnsignedCoordinate( max ) );
-		assert( unpackCell == cell );
+	gg::Cell unpackCell;
+	unpackCell.read( buffer, min, max );
+	assert( unpackCell == cell );
 #endif
 
-		gridFile.write( ( const char* ) &size, sizeof( size ) );
-		gridFile.write( ( const char* ) buffer, size );
-
-		delete[] buffer;
-		position += size + sizeof( size );
+	bool written = tree->gridFile->write( ( const char* ) &size, sizeof( size ) ) == sizeof( size );
+	written &= tree->gridFile->write( ( const char* ) buffer, size ) == size;
+	delete[] buffer;
+	if ( !written ) {
+		qCritical() << "GPS Grid: failed to write a cell";
+		return false;
 	}
-	qDebug() << "GPS Grid: wrote cells:" << time.restart() << "ms";
-
-	gg::Index::Create( filename + "_index", tempIndex );
-	qDebug() << "GPS Grid: created index:" << time.restart() << "ms";
 
+	tree->nodes[node].position = tree->position;
+	tree->position += size + sizeof( size );
+	tree->cellEdges += edges.size();
+	tree->leaves++;
+	tree->maxLeafEdges = std::max( tree->maxLeafEdges, ( unsigned ) edges.size() );
 	return true;
 }
 
+// whether a segment of the edge's path touches the box
+bool GPSGrid::intersects( const TreeBuilder& tree, unsigned edge, UnsignedCoordinate min, UnsignedCoordinate max )
+{
+	for ( unsigned i = tree.firstCoordinate[edge] + 1; i < tree.firstCoordinate[edge + 1]; i++ ) {
+		const UnsignedCoordinate& source = tree.coordinates[i - 1];
+		const UnsignedCoordinate& target = tree.coordinates[i];
+		if ( std::max( source.x, target.x ) < min.x || std::min( source.x, target.x ) > max.x )
+			continue;
+		if ( std::max( source.y, target.y ) < min.y || std::min( source.y, target.y ) > max.y )
+			continue;
+		if ( clipEdge( ProjectedCoordinate( source.x, source.y ), ProjectedCoordinate( target.x, target.y ), ProjectedCoordinate( min.x, min.y ), ProjectedCoordinate( max.x, max.y ) ) )
+			return true;
+	}
+	return false;
+}
+
 bool GPSGrid::clipHelper( double directedProjection, double directedDistance, double* tMinimum, double* tMaximum ) {
 	if ( directedProjection == 0 ) {
 		if ( directedDistance < 0 )
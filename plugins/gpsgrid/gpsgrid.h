@@ -22,7 +22,11 @@ along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "interfaces/ipreprocessor.h"
 #include "interfaces/iguisettings.h"
+#include "interfaces/iimporter.h"
 #include "utils/coordinates.h"
+#include "quadtree.h"
+#include <QFile>
+#include <vector>
 
 class GPSGrid :
 		public QObject,
@@ -59,17 +63,26 @@ public:
 
 protected:
 
-	struct GridImportEdge {
-		unsigned edge;
-		int x;
-		int y;
-		bool operator<( const GridImportEdge& right ) const {
-			if ( x != right.x )
-				return x < right.x;
-			return y < right.y;
-		}
+	struct TreeBuilder {
+		const std::vector< IImporter::RoutingNode >* inputNodes;
+		const std::vector< IImporter::RoutingEdge >* inputEdges;
+		const std::vector< IImporter::RoutingNode >* edgePaths;
+		const std::vector< unsigned >* nodeIDs;
+		const std::vector< unsigned >* edgeIDs;
+		// path coordinates of all edges, edge e spans [ firstCoordinate[e], firstCoordinate[e + 1] )
+		std::vector< UnsignedCoordinate > coordinates;
+		std::vector< unsigned > firstCoordinate;
+		std::vector< gg::QuadTree::Node > nodes;
+		QFile* gridFile;
+		qint64 position;
+		unsigned long long cellEdges;
+		unsigned leaves;
+		unsigned maxLeafEdges;
 	};
 
+	bool buildNode( TreeBuilder* tree, unsigned node, unsigned level, unsigned x, unsigned y, const std::vector< unsigned >& edges );
+	bool writeCell( TreeBuilder* tree, unsigned node, const std::vector< unsigned >& edges, UnsignedCoordinate min, UnsignedCoordinate max );
+	bool intersects( const TreeBuilder& tree, unsigned edge, UnsignedCoordinate min, UnsignedCoordinate max );
 	bool clipHelper( double directedProjection, double directedDistance, double* tMinimum, double* tMaximum );
 	bool clipEdge( ProjectedCoordinate source, ProjectedCoordinate target, ProjectedCoordinate min, ProjectedCoordinate max );
 };
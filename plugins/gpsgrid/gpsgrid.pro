@@ -20,6 +20,7 @@ HEADERS += ../../interfaces/ipreprocessor.h \
 	 gpsgrid.h \
 	 cell.h \
 	 table.h \
+	 quadtree.h \
 	 ../../utils/bithelpers.h \
 	 ../../utils/intersection.h \
 	 ../../utils/qthelpers.h \
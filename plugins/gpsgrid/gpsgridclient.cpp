@@ -18,12 +18,15 @@ along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "gpsgridclient.h"
+#include "segmentkernel.h"
 #include <QtDebug>
 #include <QHash>
 #include <algorithm>
+#include <queue>
 #include "utils/qthelpers.h"
 #ifndef NOGUI
 	#include <QInputDialog>
+	#include <QMessageBox>
 #endif
 #include <QSettings>
 
@@ -31,9 +34,13 @@ GPSGridClient::GPSGridClient()
 {
 	index = NULL;
 	gridFile = NULL;
+	gridData = NULL;
+	batch = false;
+	storedBearings = false;
 	QSettings settings( "MoNavClient" );
 	settings.beginGroup( "GPS Grid" );
 	cacheSize = settings.value( "cacheSize", 1 ).toInt();
+	mapFiles = settings.value( "mapFiles", false ).toBool();
 	cache.setMaxCost( 1024 * 1024 * 3 * cacheSize / 4 );
 }
 
@@ -42,6 +49,7 @@ GPSGridClient::~GPSGridClient()
 	QSettings settings( "MoNavClient" );
 	settings.beginGroup( "GPS Grid" );
 	settings.setValue( "cacheSize", cacheSize );
+	settings.setValue( "mapFiles", mapFiles );
 	UnloadData();
 }
 
@@ -58,6 +66,9 @@ void GPSGridClient::SetInputDirectory( const QString& dir )
 void GPSGridClient::ShowSettings()
 {
 #ifndef NOGUI
+	QMessageBox::StandardButton defaultButton = mapFiles ? QMessageBox::Yes : QMessageBox::No;
+	QMessageBox::StandardButton mapResult = QMessageBox::question( NULL, "Settings", "Memory map the GPS grid?\nCells are decoded straight from the mapping instead of being read and cached. Takes effect after reloading the map.", QMessageBox::Yes | QMessageBox::No, defaultButton );
+	mapFiles = mapResult == QMessageBox::Yes;
 	bool ok = false;
 	int result = QInputDialog::getInt( NULL, "Settings", "Enter Cache Size [MB]", cacheSize, 1, 1024, 1, &ok );
 	if ( !ok )
@@ -71,7 +82,8 @@ void GPSGridClient::ShowSettings()
 
 bool GPSGridClient::IsCompatible( int fileFormatVersion )
 {
-	if ( fileFormatVersion == 1 )
+	// version 2 stores an adaptive quadtree instead of the fixed grid, version 3 adds the segments' bearings
+	if ( fileFormatVersion >= 1 && fileFormatVersion <= 3 )
 		return true;
 	return false;
 }
@@ -83,9 +95,19 @@ bool GPSGridClient::LoadData()
 	QFile configFile( filename + "_config" );
 	if ( !openQFile( &configFile, QIODevice::ReadOnly ) )
 		return false;
-
-	index = new gg::Index( filename + "_index" );
-	index->SetCacheSize( 1024 * 1024 * cacheSize / 4 );
+	// the fixed grid wrote an empty config
+	qint32 version = 1;
+	if ( configFile.size() >= ( qint64 ) sizeof( version ) )
+		configFile.read( ( char* ) &version, sizeof( version ) );
+
+	storedBearings = version >= 3;
+	if ( version >= 2 ) {
+		if ( !tree.Load( filename + "_tree", mapFiles ) )
+			return false;
+	} else {
+		index = new gg::Index( filename + "_index", mapFiles );
+		index->SetCacheSize( 1024 * 1024 * cacheSize / 4 );
+	}
 
 	gridFile = new QFile( filename + "_grid" );
 	if ( !gridFile->open( QIODevice::ReadOnly ) ) {
@@ -93,6 +115,12 @@ bool GPSGridClient::LoadData()
 		return false;
 	}
 
+	if ( mapFiles ) {
+		gridData = gridFile->map( 0, gridFile->size() );
+		if ( gridData == NULL )
+			qDebug() << "GPS Grid: failed to map the grid, reading it instead";
+	}
+
 	return true;
 }
 
@@ -101,9 +129,12 @@ bool GPSGridClient::UnloadData()
 	if ( index != NULL )
 		delete index;
 	index = NULL;
+	tree.Unload();
+	// deleting the file unmaps the grid
 	if ( gridFile != NULL )
 		delete gridFile;
 	gridFile = NULL;
+	gridData = NULL;
 	cache.clear();
 
 	return true;
@@ -111,6 +142,19 @@ bool GPSGridClient::UnloadData()
 
 bool GPSGridClient::GetNearestEdge( Result* result, const UnsignedCoordinate& coordinate, double radius, double headingPenalty, double heading )
 {
+	QVector< Result > results;
+	if ( !GetNearestEdges( &results, coordinate, radius, 1, headingPenalty, heading ) )
+		return false;
+	*result = results.front();
+	return true;
+}
+
+bool GPSGridClient::GetNearestEdges( QVector< Result >* result, const UnsignedCoordinate& coordinate, double radius, unsigned k, double headingPenalty, double heading )
+{
+	result->clear();
+	if ( k == 0 )
+		return false;
+
 	const GPSCoordinate gps = coordinate.ToProjectedCoordinate().ToGPSCoordinate();
 
 	const GPSCoordinate gpsMoved( gps.latitude, gps.longitude + 1 );
@@ -127,32 +171,86 @@ bool GPSGridClient::GetNearestEdge( Result* result, const UnsignedCoordinate& co
 	// (clockwise, 	[0, 0] is topleft corner, [1, 1] is bottomright corner).
 	heading = fmod( ( heading + 270 ) * 2.0 * M_PI / 360.0, 2 * M_PI );
 
-	static const int width = 32 * 32 * 32;
-
-	ProjectedCoordinate position = coordinate.ToProjectedCoordinate();
-	NodeID yGrid = floor( position.y * width );
-	NodeID xGrid = floor( position.x * width );
+	Candidates candidates;
+	candidates.k = k;
 
-	// Set the distance to the nearest edge initially to infinity.
-	result->gridDistance2 = 1e20;
+	if ( tree.IsLoaded() ) {
+		searchTree( &candidates, coordinate, gridRadius2, gridHeadingPenalty2, heading );
+	} else {
+		// the fixed grid only covers the cells around the coordinate
+		static const int width = 32 * 32 * 32;
 
-	QVector< UnsignedCoordinate > path;
+		ProjectedCoordinate position = coordinate.ToProjectedCoordinate();
+		NodeID yGrid = floor( position.y * width );
+		NodeID xGrid = floor( position.x * width );
 
-	checkCell( result, &path, xGrid - 1, yGrid - 1, coordinate, gridRadius2, gridHeadingPenalty2, heading );
-	checkCell( result, &path, xGrid - 1, yGrid, coordinate, gridRadius2, gridHeadingPenalty2, heading );
-	checkCell( result, &path, xGrid - 1, yGrid + 1, coordinate, gridRadius2, gridHeadingPenalty2, heading );
+		checkCell( &candidates, xGrid - 1, yGrid - 1, coordinate, gridRadius2, gridHeadingPenalty2, heading );
+		checkCell( &candidates, xGrid - 1, yGrid, coordinate, gridRadius2, gridHeadingPenalty2, heading );
+		checkCell( &candidates, xGrid - 1, yGrid + 1, coordinate, gridRadius2, gridHeadingPenalty2, heading );
 
-	checkCell( result, &path, xGrid, yGrid - 1, coordinate, gridRadius2, gridHeadingPenalty2, heading );
-	checkCell( result, &path, xGrid, yGrid, coordinate, gridRadius2, gridHeadingPenalty2, heading );
-	checkCell( result, &path, xGrid, yGrid + 1, coordinate, gridRadius2, gridHeadingPenalty2, heading );
+		checkCell( &candidates, xGrid, yGrid - 1, coordinate, gridRadius2, gridHeadingPenalty2, heading );
+		checkCell( &candidates, xGrid, yGrid, coordinate, gridRadius2, gridHeadingPenalty2, heading );
+		checkCell( &candidates, xGrid, yGrid + 1, coordinate, gridRadius2, gridHeadingPenalty2, heading );
 
-	checkCell( result, &path, xGrid + 1, yGrid - 1, coordinate, gridRadius2, gridHeadingPenalty2, heading );
-	checkCell( result, &path, xGrid + 1, yGrid, coordinate, gridRadius2, gridHeadingPenalty2, heading );
-	checkCell( result, &path, xGrid + 1, yGrid + 1, coordinate, gridRadius2, gridHeadingPenalty2, heading );
+		checkCell( &candidates, xGrid + 1, yGrid - 1, coordinate, gridRadius2, gridHeadingPenalty2, heading );
+		checkCell( &candidates, xGrid + 1, yGrid, coordinate, gridRadius2, gridHeadingPenalty2, heading );
+		checkCell( &candidates, xGrid + 1, yGrid + 1, coordinate, gridRadius2, gridHeadingPenalty2, heading );
+	}
 
-	if ( path.empty() )
+	if ( candidates.entries.empty() )
 		return false;
 
+	for ( unsigned i = 0; i < candidates.entries.size(); i++ ) {
+		computePercentage( &candidates.entries[i].result, candidates.entries[i].path );
+		result->push_back( candidates.entries[i].result );
+	}
+	return true;
+}
+
+bool GPSGridClient::GetNearestEdges( QVector< Result >* result, QVector< bool >* found, const QVector< Position >& positions, double radius )
+{
+	result->clear();
+	found->clear();
+	result->resize( positions.size() );
+	found->resize( positions.size() );
+	found->fill( false );
+
+	// neighbouring positions share cells, visiting them along a space filling curve
+	// decodes each cell once and keeps it cached while it is needed
+	std::vector< std::pair< unsigned long long, int > > order( positions.size() );
+	for ( int i = 0; i < positions.size(); i++ )
+		order[i] = std::make_pair( zOrder( positions[i].coordinate ), i );
+	std::sort( order.begin(), order.end() );
+
+	batch = true;
+	bool foundAll = true;
+	for ( unsigned i = 0; i < order.size(); i++ ) {
+		const int position = order[i].second;
+		const Position& query = positions[position];
+		( *found )[position] = GetNearestEdge( &( *result )[position], query.coordinate, radius, query.headingPenalty, query.heading );
+		foundAll &= ( *found )[position];
+	}
+	batch = false;
+	// a mapped grid does not keep cells around between lookups
+	if ( gridData != NULL )
+		cache.clear();
+	return foundAll;
+}
+
+// interleaves the coordinate's bits, the order of the quadtree's children
+unsigned long long GPSGridClient::zOrder( const UnsignedCoordinate& coordinate )
+{
+	unsigned long long result = 0;
+	for ( int bit = 31; bit >= 0; bit-- ) {
+		result = ( result << 1 ) | ( ( coordinate.y >> bit ) & 1 );
+		result = ( result << 1 ) | ( ( coordinate.x >> bit ) & 1 );
+	}
+	return result;
+}
+
+// turns the position on the nearest segment into the position on the whole way
+void GPSGridClient::computePercentage( Result* result, const QVector< UnsignedCoordinate >& path )
+{
 	double length = 0;
 	double lengthToNearest = 0;
 	for ( int pathID = 1; pathID < path.size(); pathID++ ) {
@@ -172,60 +270,107 @@ bool GPSGridClient::GetNearestEdge( Result* result, const UnsignedCoordinate& co
 		result->percentage = 0;
 	else
 		result->percentage = lengthToNearest / length;
-	return true;
 }
 
-bool GPSGridClient::checkCell( Result* result, QVector< UnsignedCoordinate >* path, NodeID gridX, NodeID gridY, const UnsignedCoordinate& coordinate, double gridRadius2, double gridHeadingPenalty2, double heading ) {
+bool GPSGridClient::checkCell( Candidates* candidates, NodeID gridX, NodeID gridY, const UnsignedCoordinate& coordinate, double gridRadius2, double gridHeadingPenalty2, double heading ) {
 	static const int width = 32 * 32 * 32;
 	ProjectedCoordinate minPos( ( double ) gridX / width, ( double ) gridY / width );
 	ProjectedCoordinate maxPos( ( double ) ( gridX + 1 ) / width, ( double ) ( gridY + 1 ) / width );
 	UnsignedCoordinate min( minPos );
 	UnsignedCoordinate max( maxPos );
-	if ( gridDistance2( min, max, coordinate ) >= result->gridDistance2 )
+	if ( gridDistance2( min, max, coordinate ) >= candidates->bound() )
 		return false;
 
-	qint64 cellNumber = ( qint64( gridX ) << 32 ) + gridY;
-	if ( !cache.contains( cellNumber ) ) {
-		qint64 position = index->GetIndex( gridX, gridY );
-		if ( position == -1 )
-			return true;
-		gridFile->seek( position );
-		int size;
-		gridFile->read( (char* ) &size, sizeof( size ) );
-		unsigned char* buffer = new unsigned char[size + 8]; // reading buffer + 4 bytes
-
-		gridFile->read( ( char* ) buffer, size );
-		gg::Cell* cell = new gg::Cell();
-		cell->read( buffer, min, max );
-		cache.insert( cellNumber, cell, cell->edges.size() * sizeof( gg::Cell::Edge ) );
-		delete[] buffer;
-	}
-	gg::Cell* cell = cache.object( cellNumber );
+	qint64 position = index->GetIndex( gridX, gridY );
+	if ( position == -1 )
+		return true;
+	const gg::Cell* cell = readCell( position, min, max );
 	if ( cell == NULL )
 		return true;
 
-	UnsignedCoordinate nearestPoint;
-	for ( std::vector< gg::Cell::Edge >::const_iterator i = cell->edges.begin(), e = cell->edges.end(); i != e; ++i ) {
-		bool found = false;
+	checkEdges( candidates, *cell, coordinate, gridRadius2, gridHeadingPenalty2, heading );
+	return true;
+}
+
+// best-first search visiting the tree's boxes by increasing distance until none can contain a closer candidate
+void GPSGridClient::searchTree( Candidates* candidates, const UnsignedCoordinate& coordinate, double gridRadius2, double gridHeadingPenalty2, double heading )
+{
+	std::priority_queue< TreeEntry > queue;
+	UnsignedCoordinate min;
+	UnsignedCoordinate max;
+
+	TreeEntry root;
+	root.node = 0;
+	root.level = 0;
+	root.x = 0;
+	root.y = 0;
+	gg::QuadTree::Bounds( root.level, root.x, root.y, &min, &max );
+	root.distance2 = gridDistance2( min, max, coordinate );
+	queue.push( root );
+
+	while ( !queue.empty() ) {
+		const TreeEntry entry = queue.top();
+		queue.pop();
+		// the heading penalty only increases distances, the box distance stays a lower bound
+		if ( entry.distance2 > gridRadius2 || entry.distance2 >= candidates->bound() )
+			break;
+
+		const gg::QuadTree::Node& node = tree.GetNode( entry.node );
+		if ( node.firstChild == 0 ) {
+			if ( node.position == -1 )
+				continue;
+			gg::QuadTree::Bounds( entry.level, entry.x, entry.y, &min, &max );
+			const gg::Cell* cell = readCell( node.position, min, max );
+			if ( cell != NULL )
+				checkEdges( candidates, *cell, coordinate, gridRadius2, gridHeadingPenalty2, heading );
+			continue;
+		}
 
-		for ( int pathID = 1; pathID < i->pathLength; pathID++ ) {
-			UnsignedCoordinate sourceCoord = cell->coordinates[pathID + i->pathID - 1];
-			UnsignedCoordinate targetCoord = cell->coordinates[pathID + i->pathID];
-			double percentage = 0;
+		for ( unsigned child = 0; child < 4; child++ ) {
+			const gg::QuadTree::Node& childNode = tree.GetNode( node.firstChild + child );
+			if ( childNode.firstChild == 0 && childNode.position == -1 )
+				continue;
+			TreeEntry next;
+			next.node = node.firstChild + child;
+			next.level = entry.level + 1;
+			next.x = 2 * entry.x + ( child & 1 );
+			next.y = 2 * entry.y + ( child >> 1 );
+			gg::QuadTree::Bounds( next.level, next.x, next.y, &min, &max );
+			next.distance2 = gridDistance2( min, max, coordinate );
+			if ( next.distance2 > gridRadius2 || next.distance2 >= candidates->bound() )
+				continue;
+			queue.push( next );
+		}
+	}
+}
 
-			double gd2 = gridDistance2( &nearestPoint, &percentage, sourceCoord, targetCoord, coordinate );
+void GPSGridClient::checkEdges( Candidates* candidates, const gg::Cell& cell, const UnsignedCoordinate& coordinate, double gridRadius2, double gridHeadingPenalty2, double heading )
+{
+	const gg::Cell::Segments& segments = cell.segments;
+	segmentDistance2.resize( segments.x.size() );
+	segmentRatio.resize( segments.x.size() );
+	if ( segments.x.empty() )
+		return;
+	gg::SegmentDistances( &segmentDistance2[0], &segmentRatio[0], segments, coordinate.x, coordinate.y );
+
+	Result best;
+	unsigned segment = 0;
+	for ( std::vector< gg::Cell::Edge >::const_iterator i = cell.edges.begin(), e = cell.edges.end(); i != e; ++i ) {
+		bool found = false;
+		best.gridDistance2 = candidates->bound();
+
+		for ( int pathID = 1; pathID < i->pathLength; pathID++, segment++ ) {
+			double gd2 = segmentDistance2[segment];
 
 			// Do 2 independent checks:
 			//  * gd2 with gridRadius
-			//  * gd2 (+ gridHeadingPenalty2) with result->gridDistance2
-			if ( gd2 > gridRadius2 || gd2 > result->gridDistance2 ) {
+			//  * gd2 (+ gridHeadingPenalty2) with the edge's best segment and the worst candidate
+			if ( gd2 > gridRadius2 || gd2 > best.gridDistance2 ) {
 				continue;
 			}
 
 			if ( gridHeadingPenalty2 > 0 ) {
-				double xDiff = ( double ) targetCoord.x - sourceCoord.x;
-				double yDiff = ( double ) targetCoord.y - sourceCoord.y;
-				double direction = fmod( atan2( yDiff, xDiff ), 2 * M_PI );
+				double direction = segments.bearing[segment] * M_PI / 128;
 				double penalty = fmod( fabs( direction - heading ), 2 * M_PI );
 				if ( penalty > M_PI )
 					penalty = 2 * M_PI - penalty;
@@ -235,59 +380,98 @@ bool GPSGridClient::checkCell( Result* result, QVector< UnsignedCoordinate >* pa
 				gd2 += penalty;
 			}
 
-			if ( gd2 < result->gridDistance2 ) {
-				result->nearestPoint = nearestPoint;
-				result->gridDistance2 = gd2;
-				result->previousWayCoordinates = pathID;
-				result->percentage = percentage;
+			if ( gd2 < best.gridDistance2 ) {
+				const double ratio = segmentRatio[segment];
+				best.nearestPoint.x = segments.x[segment] + ratio * segments.dx[segment];
+				best.nearestPoint.y = segments.y[segment] + ratio * segments.dy[segment];
+				best.gridDistance2 = gd2;
+				best.previousWayCoordinates = pathID;
+				best.percentage = ratio;
 				found = true;
 			}
 		}
 
 		if ( found ) {
-			result->source = i->source;
-			result->target = i->target;
-			result->edgeID = i->edgeID;
-			path->clear();
-			for ( int pathID = 0; pathID < i->pathLength; pathID++ )
-				path->push_back( cell->coordinates[pathID + i->pathID] );
+			best.source = i->source;
+			best.target = i->target;
+			best.edgeID = i->edgeID;
+			addCandidate( candidates, best, cell, *i );
 		}
 	}
-
-	return true;
 }
 
-double GPSGridClient::gridDistance2( UnsignedCoordinate* nearestPoint, double* percentage, const UnsignedCoordinate source, const UnsignedCoordinate target, const UnsignedCoordinate& coordinate ) {
-	const double vY = ( double ) target.y - source.y;
-	const double vX = ( double ) target.x - source.x;
-	const double wY = ( double ) coordinate.y - source.y;
-	const double wX = ( double ) coordinate.x - source.x;
-	const double vLengthSquared = vY * vY + vX * vX;
-
-	double r = 0;
-	if ( vLengthSquared != 0 )
-		r = ( vX * wX + vY * wY ) / vLengthSquared;
-	*percentage = r;
-
-	if ( r <= 0 ) {
-		*nearestPoint = source;
-		*percentage = 0;
-		return wY * wY + wX * wX;
-	} else if ( r >= 1 ) {
-		*nearestPoint = target;
-		*percentage = 1;
-		const double dY = ( double ) coordinate.y - target.y;
-		const double dX = ( double ) coordinate.x - target.x;
-		return dY * dY + dX * dX;
+void GPSGridClient::addCandidate( Candidates* candidates, const Result& result, const gg::Cell& cell, const gg::Cell::Edge& edge )
+{
+	std::vector< Candidate >& entries = candidates->entries;
+	// edges crossing several cells are found once per cell, only their nearest point is kept
+	unsigned position = 0;
+	while ( position < entries.size() ) {
+		const Result& entry = entries[position].result;
+		if ( entry.source == result.source && entry.target == result.target && entry.edgeID == result.edgeID )
+			break;
+		position++;
+	}
+	if ( position < entries.size() ) {
+		if ( entries[position].result.gridDistance2 <= result.gridDistance2 )
+			return;
+	} else {
+		if ( result.gridDistance2 >= candidates->bound() )
+			return;
+		if ( entries.size() < candidates->k )
+			entries.push_back( Candidate() );
+		// a full list drops its worst candidate
+		position = entries.size() - 1;
 	}
 
-	nearestPoint->x = source.x + r * vX;
-	nearestPoint->y = source.y + r * vY;
+	entries[position].result = result;
+	entries[position].path.clear();
+	for ( int pathID = 0; pathID < edge.pathLength; pathID++ )
+		entries[position].path.push_back( cell.coordinates[pathID + edge.pathID] );
+	// the distance only decreased, move the candidate towards the front
+	while ( position > 0 && entries[position - 1].result.gridDistance2 > entries[position].result.gridDistance2 ) {
+		std::swap( entries[position - 1], entries[position] );
+		position--;
+	}
+}
 
-	const double dX = ( double ) nearestPoint->x - coordinate.x;
-	const double dY = ( double ) nearestPoint->y - coordinate.y;
+// the cell stays valid until the next call
+const gg::Cell* GPSGridClient::readCell( qint64 position, const UnsignedCoordinate& min, const UnsignedCoordinate& max )
+{
+	const unsigned char* mapped = NULL;
+	if ( gridData != NULL ) {
+		int size = readUnaligned< int >( ( const char* ) gridData + position );
+		mapped = gridData + position + sizeof( size );
+		// the decoder reads up to 8 bytes ahead, which must not leave the mapping
+		if ( position + ( qint64 ) sizeof( size ) + size + 8 > gridFile->size() ) {
+			scratchBuffer.assign( mapped, mapped + size );
+			scratchBuffer.resize( size + 8 );
+			mapped = &scratchBuffer[0];
+		}
+		if ( !batch ) {
+			scratchCell.clear();
+			scratchCell.read( mapped, min, max, storedBearings );
+			return &scratchCell;
+		}
+	}
 
-	return dY * dY + dX * dX;
+	if ( !cache.contains( position ) ) {
+		gg::Cell* cell = new gg::Cell();
+		if ( mapped != NULL ) {
+			cell->read( mapped, min, max, storedBearings );
+		} else {
+			gridFile->seek( position );
+			int size;
+			gridFile->read( (char* ) &size, sizeof( size ) );
+			unsigned char* buffer = new unsigned char[size + 8]; // reading buffer + 4 bytes
+
+			gridFile->read( ( char* ) buffer, size );
+			cell->read( buffer, min, max, storedBearings );
+			delete[] buffer;
+		}
+		const unsigned segmentSize = 5 * sizeof( double ) + sizeof( unsigned char );
+		cache.insert( position, cell, cell->edges.size() * sizeof( gg::Cell::Edge ) + cell->segments.x.size() * segmentSize );
+	}
+	return cache.object( position );
 }
 
 double GPSGridClient::gridDistance2( const UnsignedCoordinate& min, const UnsignedCoordinate& max, const UnsignedCoordinate& coordinate ) {
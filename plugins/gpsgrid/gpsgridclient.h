@@ -25,7 +25,9 @@ along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
 #include "interfaces/igpslookup.h"
 #include "cell.h"
 #include "table.h"
+#include "quadtree.h"
 #include <QCache>
+#include <vector>
 
 class GPSGridClient : public QObject, public IGPSLookup
 {
@@ -42,6 +44,8 @@ public:
 	virtual bool LoadData();
 	virtual bool UnloadData();
 	virtual bool GetNearestEdge( Result* result, const UnsignedCoordinate& coordinate, double radius, double headingPenalty, double heading );
+	virtual bool GetNearestEdges( QVector< Result >* result, const UnsignedCoordinate& coordinate, double radius, unsigned k, double headingPenalty, double heading );
+	virtual bool GetNearestEdges( QVector< Result >* result, QVector< bool >* found, const QVector< Position >& positions, double radius );
 
 signals:
 
@@ -49,15 +53,68 @@ public slots:
 
 protected:
 
-	double gridDistance2( UnsignedCoordinate* nearestPoint, double* percentage, const UnsignedCoordinate source, const UnsignedCoordinate target, const UnsignedCoordinate& coordinate );
+	// an entry of the best-first search's queue, ordered by increasing distance
+	struct TreeEntry {
+		double distance2;
+		unsigned node;
+		unsigned level;
+		unsigned x;
+		unsigned y;
+		bool operator<( const TreeEntry& right ) const {
+			return distance2 > right.distance2;
+		}
+	};
+
+	struct Candidate {
+		Result result;
+		QVector< UnsignedCoordinate > path;
+	};
+
+	// the k best distinct edges found so far, sorted by increasing distance
+	struct Candidates {
+		unsigned k;
+		std::vector< Candidate > entries;
+		// edges at least this far away cannot become candidates any more
+		double bound() const
+		{
+			if ( entries.size() < k )
+				return 1e20;
+			return entries.back().result.gridDistance2;
+		}
+	};
+
+	static unsigned long long zOrder( const UnsignedCoordinate& coordinate );
 	double gridDistance2( const UnsignedCoordinate& min, const UnsignedCoordinate& max, const UnsignedCoordinate& coordinate );
-	bool checkCell( Result* result, QVector< UnsignedCoordinate >* path, NodeID gridX, NodeID gridY, const UnsignedCoordinate& coordinate, double gridRadius2, double gridHeadingPenalty2 = 0, double heading = 0);
+	bool checkCell( Candidates* candidates, NodeID gridX, NodeID gridY, const UnsignedCoordinate& coordinate, double gridRadius2, double gridHeadingPenalty2 = 0, double heading = 0);
+	void searchTree( Candidates* candidates, const UnsignedCoordinate& coordinate, double gridRadius2, double gridHeadingPenalty2, double heading );
+	void checkEdges( Candidates* candidates, const gg::Cell& cell, const UnsignedCoordinate& coordinate, double gridRadius2, double gridHeadingPenalty2, double heading );
+	void addCandidate( Candidates* candidates, const Result& result, const gg::Cell& cell, const gg::Cell::Edge& edge );
+	void computePercentage( Result* result, const QVector< UnsignedCoordinate >& path );
+	const gg::Cell* readCell( qint64 position, const UnsignedCoordinate& min, const UnsignedCoordinate& max );
 
 	long long cacheSize;
+	// memory map the grid and its index instead of reading cells into the cache
+	bool mapFiles;
 	QString directory;
 	QFile* gridFile;
+	// NULL unless the grid is mapped
+	const unsigned char* gridData;
+	// cells of a mapped grid are decoded on every access, reusing the memory of the last one
+	gg::Cell scratchCell;
+	std::vector< unsigned char > scratchBuffer;
+	// output of the distance kernel for the segments of the current cell
+	std::vector< double > segmentDistance2;
+	std::vector< double > segmentRatio;
+	// cells store their segments' bearings since file format version 3
+	bool storedBearings;
+	// set during batch lookups, cells of a mapped grid are decoded into the cache as well
+	bool batch;
+	// cells are cached by their position in the grid file
 	QCache< qint64, gg::Cell > cache;
+	// index of the fixed grid, file format version 1
 	gg::Index* index;
+	// adaptive quadtree, file format version 2
+	gg::QuadTree tree;
 };
 
 #endif // GPSGRIDCLIENT_H
@@ -23,6 +23,8 @@ HEADERS += \
 	 ../../interfaces/igpslookup.h \
 	 gpsgridclient.h \
 	 table.h \
+	 quadtree.h \
+	 segmentkernel.h \
 	 ../../utils/bithelpers.h \
 	 ../../utils/qthelpers.h
 
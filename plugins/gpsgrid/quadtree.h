@@ -0,0 +1,145 @@
+/*
+Copyright 2010  Christian Vetter veaac.fdirct@gmail.com
+
+This file is part of MoNav.
+
+MoNav is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+MoNav is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef QUADTREE_H
+#define QUADTREE_H
+
+#include "utils/coordinates.h"
+#include "utils/qthelpers.h"
+#include <QFile>
+#include <QtDebug>
+#include <vector>
+
+namespace gg {
+
+	// Adaptive quadtree over the unsigned coordinate space, used by grid format version 2.
+	// A node at level l covers a square of 2^( 30 - l ) units. Nodes are split until their
+	// leaves hold at most MaxLeafEdges edges, leaves reference a cell in the grid file.
+	class QuadTree {
+
+	public:
+
+		enum {
+			MaxLeafEdges = 64,
+			// leaves at this level are about 2.4 meters wide and are not split any further
+			MaxLevel = 24
+		};
+
+		struct Node {
+			// position of a leaf's cell in the grid file, -1 for empty leaves and inner nodes
+			qint64 position;
+			// index of the first of four consecutive children, 0 for leaves as the root is nobody's child
+			unsigned firstChild;
+			unsigned padding;
+		};
+
+		// child c of node ( x, y ) is ( 2 * x + ( c & 1 ), 2 * y + ( c >> 1 ) ) on the next level
+		static void Bounds( unsigned level, unsigned x, unsigned y, UnsignedCoordinate* min, UnsignedCoordinate* max )
+		{
+			const unsigned shift = 30 - level;
+			min->x = x << shift;
+			min->y = y << shift;
+			max->x = ( x + 1 ) << shift;
+			max->y = ( y + 1 ) << shift;
+		}
+
+		QuadTree()
+		{
+			nodes = NULL;
+			numberOfNodes = 0;
+		}
+
+		~QuadTree()
+		{
+			Unload();
+		}
+
+		// mapFile memory maps the nodes instead of reading them
+		bool Load( QString filename, bool mapFile )
+		{
+			Unload();
+			file.setFileName( filename );
+			if ( !openQFile( &file, QIODevice::ReadOnly ) )
+				return false;
+			if ( file.size() == 0 || file.size() % sizeof( Node ) != 0 ) {
+				qCritical() << "GPS Grid: tree file is corrupted";
+				return false;
+			}
+			numberOfNodes = file.size() / sizeof( Node );
+			if ( mapFile )
+				nodes = ( const Node* ) file.map( 0, file.size() );
+			if ( nodes == NULL ) {
+				buffer.resize( numberOfNodes );
+				if ( file.read( ( char* ) &buffer[0], file.size() ) != file.size() ) {
+					qCritical() << "GPS Grid: failed to read the tree";
+					Unload();
+					return false;
+				}
+				nodes = &buffer[0];
+				file.close();
+			}
+			return true;
+		}
+
+		void Unload()
+		{
+			if ( nodes != NULL && buffer.empty() )
+				file.unmap( ( uchar* ) nodes );
+			nodes = NULL;
+			numberOfNodes = 0;
+			std::vector< Node >().swap( buffer );
+			file.close();
+		}
+
+		bool IsLoaded() const
+		{
+			return nodes != NULL;
+		}
+
+		const Node& GetNode( unsigned node ) const
+		{
+			assert( node < numberOfNodes );
+			return nodes[node];
+		}
+
+		static bool Write( QString filename, const std::vector< Node >& data )
+		{
+			// mapped files of running clients must not be truncated
+			QFile::remove( filename );
+			QFile out( filename );
+			if ( !openQFile( &out, QIODevice::WriteOnly ) )
+				return false;
+			qint64 size = data.size() * sizeof( Node );
+			if ( out.write( ( const char* ) &data[0], size ) != size ) {
+				qCritical() << "GPS Grid: failed to write the tree";
+				return false;
+			}
+			return true;
+		}
+
+	private:
+
+		QFile file;
+		const Node* nodes;
+		std::vector< Node > buffer;
+		unsigned numberOfNodes;
+	};
+}
+
+#endif // QUADTREE_H
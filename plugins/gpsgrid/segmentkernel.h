@@ -0,0 +1,107 @@
+/*
+Copyright 2010  Christian Vetter veaac.fdirct@gmail.com
+
+This file is part of MoNav.
+
+MoNav is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+MoNav is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SEGMENTKERNEL_H
+#define SEGMENTKERNEL_H
+
+#include "cell.h"
+#ifdef __AVX__
+	#include <immintrin.h>
+#elif defined( __SSE2__ )
+	#include <emmintrin.h>
+#endif
+
+namespace gg {
+
+	// computes the squared distance between the point ( x, y ) and every segment of the cell
+	// and the position of the nearest point on the segment, 0 at its start and 1 at its end
+	// processes four segments at a time with AVX or SSE2 if the compiler targets them,
+	// the segments have to be padded to a multiple of Cell::SegmentPadding as done by Cell::read
+	static inline void SegmentDistances( double* distance2, double* ratio, const Cell::Segments& segments, double x, double y )
+	{
+		const unsigned count = segments.x.size();
+		if ( count == 0 )
+			return;
+		const double* sourceX = &segments.x[0];
+		const double* sourceY = &segments.y[0];
+		const double* vectorX = &segments.dx[0];
+		const double* vectorY = &segments.dy[0];
+		const double* inverseLength2 = &segments.inverseLength2[0];
+
+#ifdef __AVX__
+		const __m256d pointX = _mm256_set1_pd( x );
+		const __m256d pointY = _mm256_set1_pd( y );
+		const __m256d zero = _mm256_setzero_pd();
+		const __m256d one = _mm256_set1_pd( 1 );
+		for ( unsigned i = 0; i < count; i += 4 ) {
+			const __m256d dx = _mm256_loadu_pd( vectorX + i );
+			const __m256d dy = _mm256_loadu_pd( vectorY + i );
+			const __m256d wx = _mm256_sub_pd( pointX, _mm256_loadu_pd( sourceX + i ) );
+			const __m256d wy = _mm256_sub_pd( pointY, _mm256_loadu_pd( sourceY + i ) );
+			__m256d r = _mm256_mul_pd( _mm256_add_pd( _mm256_mul_pd( dx, wx ), _mm256_mul_pd( dy, wy ) ), _mm256_loadu_pd( inverseLength2 + i ) );
+			r = _mm256_min_pd( _mm256_max_pd( r, zero ), one );
+			const __m256d ex = _mm256_sub_pd( wx, _mm256_mul_pd( r, dx ) );
+			const __m256d ey = _mm256_sub_pd( wy, _mm256_mul_pd( r, dy ) );
+			_mm256_storeu_pd( distance2 + i, _mm256_add_pd( _mm256_mul_pd( ex, ex ), _mm256_mul_pd( ey, ey ) ) );
+			_mm256_storeu_pd( ratio + i, r );
+		}
+#elif defined( __SSE2__ )
+		const __m128d pointX = _mm_set1_pd( x );
+		const __m128d pointY = _mm_set1_pd( y );
+		const __m128d zero = _mm_setzero_pd();
+		const __m128d one = _mm_set1_pd( 1 );
+		// two independent halves per iteration hide the latency of the multiplications
+		for ( unsigned i = 0; i < count; i += 4 ) {
+			const __m128d dx0 = _mm_loadu_pd( vectorX + i );
+			const __m128d dx1 = _mm_loadu_pd( vectorX + i + 2 );
+			const __m128d dy0 = _mm_loadu_pd( vectorY + i );
+			const __m128d dy1 = _mm_loadu_pd( vectorY + i + 2 );
+			const __m128d wx0 = _mm_sub_pd( pointX, _mm_loadu_pd( sourceX + i ) );
+			const __m128d wx1 = _mm_sub_pd( pointX, _mm_loadu_pd( sourceX + i + 2 ) );
+			const __m128d wy0 = _mm_sub_pd( pointY, _mm_loadu_pd( sourceY + i ) );
+			const __m128d wy1 = _mm_sub_pd( pointY, _mm_loadu_pd( sourceY + i + 2 ) );
+			__m128d r0 = _mm_mul_pd( _mm_add_pd( _mm_mul_pd( dx0, wx0 ), _mm_mul_pd( dy0, wy0 ) ), _mm_loadu_pd( inverseLength2 + i ) );
+			__m128d r1 = _mm_mul_pd( _mm_add_pd( _mm_mul_pd( dx1, wx1 ), _mm_mul_pd( dy1, wy1 ) ), _mm_loadu_pd( inverseLength2 + i + 2 ) );
+			r0 = _mm_min_pd( _mm_max_pd( r0, zero ), one );
+			r1 = _mm_min_pd( _mm_max_pd( r1, zero ), one );
+			const __m128d ex0 = _mm_sub_pd( wx0, _mm_mul_pd( r0, dx0 ) );
+			const __m128d ex1 = _mm_sub_pd( wx1, _mm_mul_pd( r1, dx1 ) );
+			const __m128d ey0 = _mm_sub_pd( wy0, _mm_mul_pd( r0, dy0 ) );
+			const __m128d ey1 = _mm_sub_pd( wy1, _mm_mul_pd( r1, dy1 ) );
+			_mm_storeu_pd( distance2 + i, _mm_add_pd( _mm_mul_pd( ex0, ex0 ), _mm_mul_pd( ey0, ey0 ) ) );
+			_mm_storeu_pd( distance2 + i + 2, _mm_add_pd( _mm_mul_pd( ex1, ex1 ), _mm_mul_pd( ey1, ey1 ) ) );
+			_mm_storeu_pd( ratio + i, r0 );
+			_mm_storeu_pd( ratio + i + 2, r1 );
+		}
+#else
+		for ( unsigned i = 0; i < count; i++ ) {
+			const double wx = x - sourceX[i];
+			const double wy = y - sourceY[i];
+			double r = ( vectorX[i] * wx + vectorY[i] * wy ) * inverseLength2[i];
+			r = std::min( std::max( r, 0.0 ), 1.0 );
+			const double ex = wx - r * vectorX[i];
+			const double ey = wy - r * vectorY[i];
+			distance2[i] = ex * ex + ey * ey;
+			ratio[i] = r;
+		}
+#endif
+	}
+}
+
+#endif // SEGMENTKERNEL_H
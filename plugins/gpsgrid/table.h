@@ -96,7 +96,8 @@ namespace gg {
 	class Index {
 
 	public:
-		Index( QString filename ) :
+		// mapFiles memory maps the second and third level instead of reading their tables into a cache
+		Index( QString filename, bool mapFiles = false ) :
 				file2( filename + "_2" ), file3( filename + "_3" )
 		{
 			QFile file1( filename + "_1" );
@@ -104,6 +105,22 @@ namespace gg {
 			top.Read( file1.read( top.Size() ).constData() );
 			file2.open( QIODevice::ReadOnly );
 			file3.open( QIODevice::ReadOnly );
+			map2 = NULL;
+			map3 = NULL;
+			if ( mapFiles ) {
+				// the tables only consist of their index arrays
+				map2 = ( const IndexTable< int, 32 >* ) file2.map( 0, file2.size() );
+				map3 = ( const IndexTable< qint64, 32 >* ) file3.map( 0, file3.size() );
+				if ( map2 == NULL || map3 == NULL ) {
+					qDebug() << "GPS Grid: failed to map the index, reading it instead";
+					if ( map2 != NULL )
+						file2.unmap( ( uchar* ) map2 );
+					if ( map3 != NULL )
+						file3.unmap( ( uchar* ) map3 );
+					map2 = NULL;
+					map3 = NULL;
+				}
+			}
 		}
 
 		qint64 GetIndex( int x, int y ) {
@@ -115,30 +132,40 @@ namespace gg {
 
 			int middlex = ( x / 32 ) % 32;
 			int middley = ( y / 32 ) % 32;
-			if ( !cache2.contains( middle ) ) {
-				IndexTable< int, 32 >* newEntry;
-				file2.seek( middle * newEntry->Size() );
-				newEntry = new IndexTable< int, 32 >( file2.read( newEntry->Size() ) );
-				cache2.insert( middle, newEntry, newEntry->Size() );
+			const IndexTable< int, 32 >* middleTable;
+			if ( map2 != NULL ) {
+				middleTable = map2 + middle;
+			} else {
+				if ( !cache2.contains( middle ) ) {
+					IndexTable< int, 32 >* newEntry;
+					file2.seek( middle * newEntry->Size() );
+					newEntry = new IndexTable< int, 32 >( file2.read( newEntry->Size() ) );
+					cache2.insert( middle, newEntry, newEntry->Size() );
+				}
+				if ( !cache2.contains( middle ) )
+					return -1;
+				middleTable = cache2.object( middle );
 			}
-			if ( !cache2.contains( middle ) )
-				return -1;
-			IndexTable< int, 32 >* middleTable = cache2.object( middle );
 			int bottom = middleTable->GetIndex( middlex, middley );
 			if ( bottom == -1 )
 				return -1;
 
 			int bottomx = x % 32;
 			int bottomy = y % 32;
-			if ( !cache3.contains( bottom ) ) {
-				IndexTable< qint64, 32 >* newEntry;
-				file3.seek( bottom * newEntry->Size() );
-				newEntry = new IndexTable< qint64, 32 >( file3.read( newEntry->Size() ) );
-				cache3.insert( bottom, newEntry, newEntry->Size() );
+			const IndexTable< qint64, 32 >* bottomTable;
+			if ( map3 != NULL ) {
+				bottomTable = map3 + bottom;
+			} else {
+				if ( !cache3.contains( bottom ) ) {
+					IndexTable< qint64, 32 >* newEntry;
+					file3.seek( bottom * newEntry->Size() );
+					newEntry = new IndexTable< qint64, 32 >( file3.read( newEntry->Size() ) );
+					cache3.insert( bottom, newEntry, newEntry->Size() );
+				}
+				if ( !cache3.contains( bottom ) )
+					return -1;
+				bottomTable = cache3.object( bottom );
 			}
-			if ( !cache3.contains( bottom ) )
-				return -1;
-			IndexTable< qint64, 32 >* bottomTable = cache3.object( bottom );
 			qint64 position = bottomTable->GetIndex( bottomx, bottomy );
 			return position;
 		}
@@ -187,6 +214,10 @@ namespace gg {
 			qDebug() << "GPS Grid: bottom index filled: " << ( double ) data.size() * 100 / bottom.size() / 32 / 32 << "%";
 			qDebug() << "GPS Grid: grid cells: " << data.size();
 
+			// mapped files of running clients must not be truncated
+			QFile::remove( filename + "_1" );
+			QFile::remove( filename + "_2" );
+			QFile::remove( filename + "_3" );
 			QFile file1( filename + "_1" );
 			QFile file2( filename + "_2" );
 			QFile file3( filename + "_3" );
@@ -216,6 +247,8 @@ namespace gg {
 		QFile file2;
 		QFile file3;
 		IndexTable< int, 32 > top;
+		const IndexTable< int, 32 >* map2;
+		const IndexTable< qint64, 32 >* map3;
 		QCache< int, IndexTable< int, 32 > > cache2;
 		QCache< int, IndexTable< qint64, 32 > > cache3;
 	};
@@ -32,6 +32,7 @@ along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
 #include <QtConcurrentRun>
 #include <QtDebug>
 #include <QSettings>
+#include <QDateTime>
 
 struct PluginManager::PrivateImplementation {
 
@@ -429,6 +430,11 @@ bool runRouting( QString directory, IImporter* importer, IPreprocessor* router,
 		qCritical() << "GPS Lookup failed";
 		return false;
 	}
+	{
+		// running routing daemons reload the module once it is complete
+		QSettings settings( fileInDirectory( directory, "Module.ini" ), QSettings::IniFormat );
+		settings.setValue( "revision", QDateTime::currentDateTime().toString( "yyyy-MM-dd hh:mm:ss.zzz" ) );
+	}
 	if ( info.enabled ) {
 		DirectoryPacker packer( directory );
 		if ( !packer.compress( info.dict, info.block ) ) {
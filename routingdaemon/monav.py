@@ -25,6 +25,8 @@ import socket
 import struct
 
 from signals_pb2 import CommandType, VersionCommand, VersionResult, RoutingCommand, RoutingResult
+from signals_pb2 import IsochroneCommand, IsochroneResult
+from signals_pb2 import StatisticsCommand, StatisticsResult
 from signals_pb2 import Node as Waypoint
 
 
@@ -101,7 +103,7 @@ def get_version(connection=None):
     return result.version
 
 
-def get_route(data_directory, waypoints, lookup_radius=10000, lookup_edge_names=True, connection=None):
+def get_route(data_directory, waypoints, lookup_radius=10000, lookup_edge_names=True, connection=None, closed_roads=(), closed_road_radius=50):
     """Get the shortest route between a list of waypoints using MoNav.
 
     * connection should be a TcpConnection object.
@@ -109,6 +111,10 @@ def get_route(data_directory, waypoints, lookup_radius=10000, lookup_edge_names=
     * data_directory should be the path to the directory called routing_
       created by the MoNav preprocessor.
 
+    * closed_roads is a list of (latitude, longitude) tuples, the roads
+      nearest to them are not used. Points further than closed_road_radius
+      meters away from any road are ignored.
+
     * Return type RoutingResult:
         seconds
         nodes
@@ -138,6 +144,11 @@ def get_route(data_directory, waypoints, lookup_radius=10000, lookup_edge_names=
             assert len(latlon) == 2
             waypoint = command.waypoints.add(latitude=latlon[0], longitude=latlon[1])
 
+    command.closed_road_radius = closed_road_radius
+    for latlon in closed_roads:
+        assert len(latlon) == 2
+        command.closed_roads.add(latitude=latlon[0], longitude=latlon[1])
+
     # Write the command.
     connection.write(command)
 
@@ -163,3 +174,98 @@ def get_route(data_directory, waypoints, lookup_radius=10000, lookup_edge_names=
     else:
         raise Exception(str(result.type) + ": return value not recognized")
 
+
+def get_isochrone(data_directory, source, max_seconds, lookup_radius=10000, connection=None):
+    """Get all nodes reachable from source within max_seconds using MoNav.
+
+    * connection should be a TcpConnection object.
+
+    * data_directory should be the path to the directory called routing_
+      created by the MoNav preprocessor.
+
+    * source is either a Node or a (latitude, longitude) tuple.
+
+    * Return type IsochroneResult:
+        nodes
+        seconds
+
+    * First start the monav-server.
+
+    """
+    if not connection:
+        connection = TcpConnection()
+
+    # Generate and write the command type.
+    connection.write(CommandType(value=CommandType.ISOCHRONE_COMMAND))
+
+    # Generate the command.
+    command = IsochroneCommand()
+    command.data_directory = data_directory
+    command.lookup_radius = lookup_radius
+    command.max_seconds = max_seconds
+
+    if hasattr(source, 'latitude'):
+        command.source.CopyFrom(source)
+    else:
+        assert len(source) == 2
+        command.source.latitude = source[0]
+        command.source.longitude = source[1]
+
+    # Write the command.
+    connection.write(command)
+
+    # Read result.
+    result = IsochroneResult()
+    connection.read(result)
+
+    # Close the connection (just in case)
+    connection.close()
+
+    if result.type == IsochroneResult.SUCCESS:
+        return result
+    elif result.type == IsochroneResult.LOAD_FAILED:
+        raise Exception(str(result.type) + ": failed to load data directory")
+    elif result.type == IsochroneResult.LOOKUP_FAILED:
+        raise Exception(str(result.type) + ": failed to lookup nearest edge")
+    elif result.type == IsochroneResult.ROUTE_FAILED:
+        raise Exception(str(result.type) + ": failed to compute reachable nodes")
+    else:
+        raise Exception(str(result.type) + ": return value not recognized")
+
+
+def get_statistics(reset=False, connection=None):
+    """Get the router statistics aggregated by the monav daemon or server
+    on the other side of the connection.
+
+    * Return type StatisticsResult:
+        queries
+        settled_nodes_forward
+        settled_nodes_backward
+        stalled_nodes
+        relaxed_edges
+        block_cache_hits
+        block_cache_misses
+        path_cache_hits
+        path_cache_misses
+        max_unpack_depth
+        search_milliseconds
+        unpack_milliseconds
+
+    * Set reset to restart counting after this call.
+
+    """
+    if not connection:
+        connection = TcpConnection()
+
+    # Generate and write the command type.
+    connection.write(CommandType(value=CommandType.STATISTICS_COMMAND))
+    connection.write(StatisticsCommand(reset=reset))
+
+    # Read result.
+    result = StatisticsResult()
+    connection.read(result)
+
+    # Close the connection (just in case)
+    connection.close()
+
+    return result
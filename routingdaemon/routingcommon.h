@@ -68,6 +68,10 @@ protected:
 			handleConnection<MoNav::UnpackCommand, MoNav::UnpackResult>( connection );
 		} else if ( type.value() == MoNav::CommandType::ROUTING_COMMAND ) {
 			handleConnection<MoNav::RoutingCommand, MoNav::RoutingResult>( connection );
+		} else if ( type.value() == MoNav::CommandType::ISOCHRONE_COMMAND ) {
+			handleConnection<MoNav::IsochroneCommand, MoNav::IsochroneResult>( connection );
+		} else if ( type.value() == MoNav::CommandType::STATISTICS_COMMAND ) {
+			handleConnection<MoNav::StatisticsCommand, MoNav::StatisticsResult>( connection );
 		}
 	}
 
@@ -127,14 +131,38 @@ protected:
 
 		result.set_type( MoNav::RoutingResult::SUCCESS );
 
-		QString dataDirectory = command.data_directory().c_str();
-		if ( !m_loaded || dataDirectory != m_dataDirectory ) {
-			unloadPlugins();
-			m_loaded = loadPlugins( dataDirectory );
-			m_dataDirectory = dataDirectory;
-		}
+		if ( loadDataDirectory( command.data_directory().c_str() ) ) {
+			QVector< IGPSLookup::Position > closedRoads;
+			for ( int i = 0; i < command.closed_roads_size(); i++ ) {
+				const MoNav::Node& closed = command.closed_roads( i );
+				closedRoads.push_back( UnsignedCoordinate( GPSCoordinate( closed.latitude(), closed.longitude() ) ) );
+			}
+			QVector< IGPSLookup::Result > blockedEdges;
+			if ( !closedRoads.empty() ) {
+				QVector< IGPSLookup::Result > blocked;
+				QVector< bool > found;
+				m_gpsLookup->GetNearestEdges( &blocked, &found, closedRoads, command.closed_road_radius() );
+				for ( int i = 0; i < closedRoads.size(); i++ ) {
+					if ( found[i] )
+						blockedEdges.push_back( blocked[i] );
+					else
+						qDebug() << "no road near closed road point" << i << "found";
+				}
+			}
+
+			// all waypoints are snapped at once, inner waypoints are shared by two segments
+			QVector< IGPSLookup::Position > waypoints;
+			for ( int i = 0; i < command.waypoints_size(); i++ ) {
+				const MoNav::Node& waypoint = command.waypoints( i );
+				waypoints.push_back( IGPSLookup::Position( UnsignedCoordinate( GPSCoordinate( waypoint.latitude(), waypoint.longitude() ) ), waypoint.heading_penalty(), waypoint.heading() ) );
+			}
+			QVector< IGPSLookup::Result > positions;
+			QVector< bool > found;
+			QTime time;
+			time.start();
+			m_gpsLookup->GetNearestEdges( &positions, &found, waypoints, command.lookup_radius() );
+			qDebug() << "GPS Lookup:" << time.elapsed() << "ms";
 
-		if ( m_loaded ) {
 			QVector< IRouter::Node > pathNodes;
 			QVector< IRouter::Edge > pathEdges;
 			double distance = 0;
@@ -147,7 +175,13 @@ protected:
 				double segmentDistance;
 				pathNodes.clear();
 				pathEdges.clear();
-				result.set_type( computeRoute( &segmentDistance, &pathNodes, &pathEdges, command.waypoints( i - 1 ), command.waypoints( i ), command.lookup_radius() ) );
+				if ( !found[i - 1] || !found[i] ) {
+					qDebug() << "no edge near waypoint" << ( found[i - 1] ? i : i - 1 ) << "found";
+					result.set_type( MoNav::RoutingResult::LOOKUP_FAILED );
+					success = false;
+					break;
+				}
+				result.set_type( computeRoute( &segmentDistance, &pathNodes, &pathEdges, positions[i - 1], positions[i], blockedEdges ) );
 				if ( result.type() != MoNav::RoutingResult::SUCCESS ) {
 					success = false;
 					break;
@@ -207,32 +241,121 @@ protected:
 		return result;
 	}
 
-	MoNav::RoutingResult::Type computeRoute( double* resultDistance, QVector< IRouter::Node >* resultNodes, QVector< IRouter::Edge >* resultEdge, MoNav::Node source, MoNav::Node target, double lookupRadius )
+	// Execute isochrone command.
+	MoNav::IsochroneResult execute( const MoNav::IsochroneCommand command )
 	{
-		if ( m_gpsLookup == NULL || m_router == NULL ) {
-			qCritical() << "tried to query route before setting valid data directory";
-			return MoNav::RoutingResult::LOAD_FAILED;
+		MoNav::IsochroneResult result;
+
+		if ( !loadDataDirectory( command.data_directory().c_str() ) ) {
+			result.set_type( MoNav::IsochroneResult::LOAD_FAILED );
+			return result;
 		}
-		UnsignedCoordinate sourceCoordinate( GPSCoordinate( source.latitude(), source.longitude() ) );
-		UnsignedCoordinate targetCoordinate( GPSCoordinate( target.latitude(), target.longitude() ) );
+
+		UnsignedCoordinate sourceCoordinate( GPSCoordinate( command.source().latitude(), command.source().longitude() ) );
 		IGPSLookup::Result sourcePosition;
 		QTime time;
 		time.start();
-		bool found = m_gpsLookup->GetNearestEdge( &sourcePosition, sourceCoordinate, lookupRadius, source.heading_penalty(), source.heading() );
+		bool found = m_gpsLookup->GetNearestEdge( &sourcePosition, sourceCoordinate, command.lookup_radius(), command.source().heading_penalty(), command.source().heading() );
 		qDebug() << "GPS Lookup:" << time.restart() << "ms";
 		if ( !found ) {
 			qDebug() << "no edge near source found";
-			return MoNav::RoutingResult::LOOKUP_FAILED;
+			result.set_type( MoNav::IsochroneResult::LOOKUP_FAILED );
+			return result;
 		}
-		IGPSLookup::Result targetPosition;
-		found = m_gpsLookup->GetNearestEdge( &targetPosition, targetCoordinate, lookupRadius, target.heading_penalty(), target.heading() );
-		qDebug() << "GPS Lookup:" << time.restart() << "ms";
+
+		QVector< IRouter::Node > nodes;
+		QVector< double > seconds;
+		found = m_router->GetReachableNodes( NULL, &nodes, &seconds, sourcePosition, command.max_seconds() );
+		qDebug() << "Isochrone:" << time.restart() << "ms";
+		collectStatistics();
 		if ( !found ) {
-			qDebug() << "no edge near target found";
-			return MoNav::RoutingResult::LOOKUP_FAILED;
+			result.set_type( MoNav::IsochroneResult::ROUTE_FAILED );
+			return result;
 		}
-		found = m_router->GetRoute( resultDistance, resultNodes, resultEdge, sourcePosition, targetPosition );
+
+		for ( int i = 0; i < nodes.size(); i++ ) {
+			GPSCoordinate gps = nodes[i].coordinate.ToGPSCoordinate();
+			MoNav::Node* node = result.add_nodes();
+			node->set_latitude( gps.latitude );
+			node->set_longitude( gps.longitude );
+			result.add_seconds( seconds[i] );
+		}
+
+		result.set_type( MoNav::IsochroneResult::SUCCESS );
+		return result;
+	}
+
+	// Execute statistics command.
+	MoNav::StatisticsResult execute( const MoNav::StatisticsCommand command )
+	{
+		MoNav::StatisticsResult result;
+
+		result.set_queries( m_statistics.queries );
+		result.set_settled_nodes_forward( m_statistics.settledNodesForward );
+		result.set_settled_nodes_backward( m_statistics.settledNodesBackward );
+		result.set_stalled_nodes( m_statistics.stalledNodes );
+		result.set_relaxed_edges( m_statistics.relaxedEdges );
+		result.set_block_cache_hits( m_statistics.blockCacheHits );
+		result.set_block_cache_misses( m_statistics.blockCacheMisses );
+		result.set_path_cache_hits( m_statistics.pathCacheHits );
+		result.set_path_cache_misses( m_statistics.pathCacheMisses );
+		result.set_max_unpack_depth( m_statistics.maxUnpackDepth );
+		result.set_search_milliseconds( m_statistics.searchMilliseconds );
+		result.set_unpack_milliseconds( m_statistics.unpackMilliseconds );
+
+		if ( command.reset() )
+			m_statistics = IRouter::Statistics();
+
+		return result;
+	}
+
+	// Adds the router's statistics of the last query to the daemon's totals.
+	void collectStatistics()
+	{
+		IRouter::Statistics lastQuery;
+		if ( !m_router->GetStatistics( NULL, &lastQuery, NULL ) )
+			return;
+		qDebug() << "settled nodes:" << lastQuery.settledNodesForward + lastQuery.settledNodesBackward << "block cache misses:" << lastQuery.blockCacheMisses;
+		m_statistics += lastQuery;
+	}
+
+	// Loads the plugins for a data directory unless it is already loaded.
+	// A finished preprocessor run changes the module's revision, e.g., after a metric update, and the data is reloaded.
+	bool loadDataDirectory( const QString& dataDirectory )
+	{
+		QString revision = moduleRevision( dataDirectory );
+		if ( !m_loaded || dataDirectory != m_dataDirectory || revision != m_moduleRevision ) {
+			unloadPlugins();
+			m_loaded = loadPlugins( dataDirectory );
+			m_dataDirectory = dataDirectory;
+			m_moduleRevision = revision;
+		}
+		return m_loaded;
+	}
+
+	// Only rereads Module.ini when it was modified.
+	QString moduleRevision( const QString& dataDirectory )
+	{
+		QFileInfo config( QDir( dataDirectory ).filePath( "Module.ini" ) );
+		QDateTime modified = config.lastModified();
+		if ( dataDirectory == m_dataDirectory && modified == m_moduleModified )
+			return m_moduleRevision;
+		m_moduleModified = modified;
+		QSettings pluginSettings( config.filePath(), QSettings::IniFormat );
+		return pluginSettings.value( "revision" ).toString();
+	}
+
+	MoNav::RoutingResult::Type computeRoute( double* resultDistance, QVector< IRouter::Node >* resultNodes, QVector< IRouter::Edge >* resultEdge, const IGPSLookup::Result& sourcePosition, const IGPSLookup::Result& targetPosition, const QVector< IGPSLookup::Result >& blockedEdges )
+	{
+		if ( m_gpsLookup == NULL || m_router == NULL ) {
+			qCritical() << "tried to query route before setting valid data directory";
+			return MoNav::RoutingResult::LOAD_FAILED;
+		}
+		QTime time;
+		time.start();
+		bool found = m_router->GetRoute( NULL, resultDistance, resultNodes, resultEdge, sourcePosition, targetPosition, blockedEdges );
 		qDebug() << "Routing:" << time.restart() << "ms";
+		collectStatistics();
 
 		if ( !found ) {
 			return MoNav::RoutingResult::ROUTE_FAILED;
@@ -326,8 +449,12 @@ protected:
 
 	bool m_loaded;
 	QString m_dataDirectory;
+	QString m_moduleRevision;
+	QDateTime m_moduleModified;
 	IGPSLookup* m_gpsLookup;
 	IRouter* m_router;
+	// summed up over all queries, kept when switching data directories
+	IRouter::Statistics m_statistics;
 };
 
 #endif // ROUTINGCOMMON_H
@@ -0,0 +1,460 @@
+/*
+Copyright 2010  Christian Vetter veaac.fdirct@gmail.com
+
+This file is part of MoNav.
+
+MoNav is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+MoNav is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "interfaces/irouter.h"
+#include "interfaces/igpslookup.h"
+#include "utils/qthelpers.h"
+#include "utils/bithelpers.h"
+#include "plugins/contractionhierarchies/compressedgraph.h"
+#include "stdio.h"
+
+#include <QtCore/QCoreApplication>
+#include <QString>
+#include <QStringList>
+#include <QSettings>
+#include <QDir>
+#include <QFile>
+#include <QPluginLoader>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+Q_IMPORT_PLUGIN( contractionhierarchiesclient );
+Q_IMPORT_PLUGIN( gpsgridclient );
+
+namespace {
+
+struct Query {
+	IGPSLookup::Result source;
+	IGPSLookup::Result target;
+	// Dijkstra rank of the target, 0 for random queries
+	unsigned rank;
+};
+
+// small deterministic generator, query sets must not depend on the platform's rand()
+class Random {
+public:
+	Random( unsigned seed )
+	{
+		m_state = seed * 2654435761u + 1;
+	}
+
+	unsigned next()
+	{
+		m_state ^= m_state << 13;
+		m_state ^= m_state >> 17;
+		m_state ^= m_state << 5;
+		return m_state;
+	}
+
+	unsigned next( unsigned min, unsigned max )
+	{
+		if ( max <= min )
+			return min;
+		return min + next() % ( max - min );
+	}
+
+private:
+	unsigned m_state;
+};
+
+struct Options {
+	QString directory;
+	int queries;
+	unsigned seed;
+	bool dijkstraRank;
+	bool decode;
+	double lookupRadius;
+};
+
+IRouter* g_router = NULL;
+IGPSLookup* g_gpsLookup = NULL;
+UnsignedCoordinate g_min;
+UnsignedCoordinate g_max;
+
+void printHelp()
+{
+	printf( "Usage:\n" );
+	printf( "\tmonav-bench-router routing-module-dir [--queries n] [--seed s] [--dijkstra-rank] [--decode]\n" );
+	printf( "\t--queries n: number of queries per run, default 1000\n" );
+	printf( "\t--seed s: seed of the query generator, default 1\n" );
+	printf( "\t--dijkstra-rank: choose targets by their Dijkstra rank instead of randomly\n" );
+	printf( "\t--decode: also measure the throughput of decoding the contraction hierarchy's edges\n" );
+}
+
+bool parseArguments( const QStringList& args, Options* options )
+{
+	if ( args.size() < 2 )
+		return false;
+	options->directory = args[1];
+	options->queries = 1000;
+	options->seed = 1;
+	options->dijkstraRank = false;
+	options->decode = false;
+	options->lookupRadius = 10000;
+	for ( int i = 2; i < args.size(); i++ ) {
+		bool ok = true;
+		if ( args[i] == "--queries" && i + 1 < args.size() )
+			options->queries = args[++i].toInt( &ok );
+		else if ( args[i] == "--seed" && i + 1 < args.size() )
+			options->seed = args[++i].toUInt( &ok );
+		else if ( args[i] == "--dijkstra-rank" )
+			options->dijkstraRank = true;
+		else if ( args[i] == "--decode" )
+			options->decode = true;
+		else
+			return false;
+		if ( !ok )
+			return false;
+	}
+	return options->queries > 0;
+}
+
+bool loadModule( const QString& directory )
+{
+	QDir dir( directory );
+	QSettings pluginSettings( dir.filePath( "Module.ini" ), QSettings::IniFormat );
+	if ( pluginSettings.value( "configVersion" ).toInt() != 2 ) {
+		qCritical() << "Not a valid routing module directory:" << directory;
+		return false;
+	}
+	QString routerName = pluginSettings.value( "router" ).toString();
+	QString gpsLookupName = pluginSettings.value( "gpsLookup" ).toString();
+
+	foreach ( QObject *plugin, QPluginLoader::staticInstances() ) {
+		if ( IGPSLookup *interface = qobject_cast< IGPSLookup* >( plugin ) ) {
+			if ( interface->GetName() == gpsLookupName )
+				g_gpsLookup = interface;
+		}
+		if ( IRouter *interface = qobject_cast< IRouter* >( plugin ) ) {
+			if ( interface->GetName() == routerName )
+				g_router = interface;
+		}
+	}
+	if ( g_gpsLookup == NULL || g_router == NULL ) {
+		qCritical() << "plugins not found:" << routerName << gpsLookupName;
+		return false;
+	}
+
+	g_gpsLookup->SetInputDirectory( directory );
+	if ( !g_gpsLookup->IsCompatible( pluginSettings.value( "gpsLookupFileFormatVersion" ).toInt() ) || !g_gpsLookup->LoadData() ) {
+		qCritical() << "could not load GPSLookup data";
+		return false;
+	}
+	g_router->SetInputDirectory( directory );
+	if ( !g_router->IsCompatible( pluginSettings.value( "routerFileFormatVersion" ).toInt() ) || !g_router->LoadData() ) {
+		qCritical() << "could not load router data";
+		return false;
+	}
+
+	// the map package's bounding box is stored one level up
+	dir.cdUp();
+	QSettings packageSettings( dir.filePath( "MoNav.ini" ), QSettings::IniFormat );
+	g_min.x = packageSettings.value( "minX" ).toUInt();
+	g_min.y = packageSettings.value( "minY" ).toUInt();
+	g_max.x = packageSettings.value( "maxX" ).toUInt();
+	g_max.y = packageSettings.value( "maxY" ).toUInt();
+	if ( g_max.x <= g_min.x || g_max.y <= g_min.y ) {
+		qCritical() << "could not read the bounding box from:" << dir.filePath( "MoNav.ini" );
+		return false;
+	}
+
+	return true;
+}
+
+bool randomPosition( Random* random, double radius, IGPSLookup::Result* result )
+{
+	// most random points of a bounding box are near a road, give up eventually if none is
+	for ( int attempt = 0; attempt < 100; attempt++ ) {
+		UnsignedCoordinate coordinate;
+		coordinate.x = random->next( g_min.x, g_max.x );
+		coordinate.y = random->next( g_min.y, g_max.y );
+		if ( g_gpsLookup->GetNearestEdge( result, coordinate, radius ) )
+			return true;
+	}
+	qCritical() << "failed to find a random position near a road";
+	return false;
+}
+
+bool generateRandomQueries( const Options& options, std::vector< Query >* queries )
+{
+	Random random( options.seed );
+	for ( int i = 0; i < options.queries; i++ ) {
+		Query query;
+		query.rank = 0;
+		if ( !randomPosition( &random, options.lookupRadius, &query.source ) )
+			return false;
+		if ( !randomPosition( &random, options.lookupRadius, &query.target ) )
+			return false;
+		queries->push_back( query );
+	}
+	return true;
+}
+
+struct RankedNode {
+	double seconds;
+	UnsignedCoordinate coordinate;
+
+	bool operator<( const RankedNode& right ) const {
+		return seconds < right.seconds;
+	}
+};
+
+// for each source the targets of rank 2^1, 2^2, ... are determined by a one-to-all search
+bool generateDijkstraRankQueries( const Options& options, std::vector< Query >* queries )
+{
+	Random random( options.seed );
+	// sources in small components may reach too few nodes to add any query
+	const int maxSources = 10 * options.queries;
+	for ( int sources = 0; ( int ) queries->size() < options.queries; sources++ ) {
+		if ( sources == maxSources ) {
+			qCritical() << "failed to generate" << options.queries << "Dijkstra rank queries from" << maxSources << "sources, got" << queries->size();
+			return false;
+		}
+		IGPSLookup::Result source;
+		if ( !randomPosition( &random, options.lookupRadius, &source ) )
+			return false;
+
+		QVector< IRouter::Node > nodes;
+		QVector< double > seconds;
+		if ( !g_router->GetReachableNodes( NULL, &nodes, &seconds, source, std::numeric_limits< int >::max() / 10 ) )
+			return false;
+		std::vector< RankedNode > ranked( nodes.size() );
+		for ( int i = 0; i < nodes.size(); i++ ) {
+			ranked[i].seconds = seconds[i];
+			ranked[i].coordinate = nodes[i].coordinate;
+		}
+		std::sort( ranked.begin(), ranked.end() );
+
+		for ( unsigned rank = 2; rank < ranked.size() && ( int ) queries->size() < options.queries; rank *= 2 ) {
+			Query query;
+			query.source = source;
+			query.rank = rank;
+			// nodes are always close to their own edges
+			if ( !g_gpsLookup->GetNearestEdge( &query.target, ranked[rank].coordinate, 100 ) )
+				continue;
+			queries->push_back( query );
+		}
+	}
+	return true;
+}
+
+double percentile( const std::vector< double >& sorted, double p )
+{
+	if ( sorted.empty() )
+		return 0;
+	unsigned index = std::min( ( unsigned ) sorted.size() - 1, ( unsigned ) ( p * sorted.size() ) );
+	return sorted[index];
+}
+
+double hitRate( unsigned long long hits, unsigned long long misses )
+{
+	if ( hits + misses == 0 )
+		return 0;
+	return 100.0 * hits / ( hits + misses );
+}
+
+void printLatencies( const char* name, std::vector< double > latencies, double totalMilliseconds )
+{
+	std::sort( latencies.begin(), latencies.end() );
+	printf( "%-32s %8.3f %8.3f %8.3f %8.3f %10.1f", name, percentile( latencies, 0.5 ), percentile( latencies, 0.9 ), percentile( latencies, 0.99 ), latencies.empty() ? 0 : latencies.back(), totalMilliseconds > 0 ? 1000.0 * latencies.size() / totalMilliseconds : 0 );
+}
+
+// runs all queries on the context and prints one line of results
+void runQueries( const char* name, IRouter::Context* context, const std::vector< Query >& queries, bool unpack )
+{
+	std::vector< double > latencies;
+	latencies.reserve( queries.size() );
+	QVector< IRouter::Node > pathNodes;
+	QVector< IRouter::Edge > pathEdges;
+	unsigned failed = 0;
+	g_router->ResetStatistics( context );
+
+	QElapsedTimer total;
+	total.start();
+	for ( unsigned i = 0; i < queries.size(); i++ ) {
+		pathNodes.clear();
+		pathEdges.clear();
+		double distance;
+		QElapsedTimer time;
+		time.start();
+		bool found = g_router->GetRoute( context, &distance, unpack ? &pathNodes : NULL, unpack ? &pathEdges : NULL, queries[i].source, queries[i].target );
+		latencies.push_back( time.nsecsElapsed() / 1000000.0 );
+		if ( !found )
+			failed++;
+	}
+	double totalMilliseconds = total.nsecsElapsed() / 1000000.0;
+
+	IRouter::Statistics statistics;
+	g_router->GetStatistics( context, NULL, &statistics );
+	printLatencies( name, latencies, totalMilliseconds );
+	printf( " %8.1f %8.1f %7u\n", hitRate( statistics.blockCacheHits, statistics.blockCacheMisses ), hitRate( statistics.pathCacheHits, statistics.pathCacheMisses ), failed );
+}
+
+void runRanks( IRouter::Context* context, const std::vector< Query >& queries )
+{
+	printf( "\nwarm, distance only, by Dijkstra rank\n" );
+	printf( "%-32s %8s %8s %8s %8s %10s\n", "rank", "p50[ms]", "p90[ms]", "p99[ms]", "max[ms]", "queries/s" );
+	for ( unsigned rank = 2; ; rank *= 2 ) {
+		std::vector< double > latencies;
+		double totalMilliseconds = 0;
+		for ( unsigned i = 0; i < queries.size(); i++ ) {
+			if ( queries[i].rank != rank )
+				continue;
+			double distance;
+			QElapsedTimer time;
+			time.start();
+			g_router->GetRoute( context, &distance, NULL, NULL, queries[i].source, queries[i].target );
+			latencies.push_back( time.nsecsElapsed() / 1000000.0 );
+			totalMilliseconds += latencies.back();
+		}
+		if ( latencies.empty() )
+			break;
+		printLatencies( qPrintable( QString::number( rank ) ), latencies, totalMilliseconds );
+		printf( "\n" );
+	}
+}
+
+// extracts fields of all widths from the raw edge blocks with both bit readers, read_unaligned_unsigned serves as the baseline
+bool runFieldDecode( const QString& filename )
+{
+	QFile file( filename );
+	if ( !file.open( QIODevice::ReadOnly ) ) {
+		qCritical() << "failed to open file:" << file.fileName();
+		return false;
+	}
+	// BitReader addresses bits with an unsigned position
+	const qint64 size = std::min( file.size(), ( qint64 ) 1 << 28 );
+	// both readers load up to 8 bytes from a field's first byte
+	std::vector< unsigned char > buffer( size + 8, 0 );
+	if ( file.read( ( char* ) &buffer[0], size ) != size ) {
+		qCritical() << "failed to read file:" << file.fileName();
+		return false;
+	}
+	const unsigned endBit = size * 8;
+
+	unsigned long long checksums[2];
+	for ( int reader = 0; reader < 2; reader++ ) {
+		unsigned long long fields = 0;
+		unsigned long long checksum = 0;
+		QElapsedTimer time;
+		time.start();
+		if ( reader == 0 ) {
+			const unsigned char* position = &buffer[0];
+			int offset = 0;
+			for ( unsigned bit = 0, bits = 1; bit + bits <= endBit; bit += bits, bits = bits % 32 + 1 ) {
+				checksum += read_unaligned_unsigned( &position, bits, &offset );
+				fields++;
+			}
+		} else {
+			BitReader bitReader( &buffer[0] );
+			for ( unsigned bit = 0, bits = 1; bit + bits <= endBit; bit += bits, bits = bits % 32 + 1 ) {
+				checksum += bitReader.read( bits );
+				fields++;
+			}
+		}
+		double milliseconds = time.nsecsElapsed() / 1000000.0;
+		printf( "%-32s %10.1f %12llu %12.0f\n", reader == 0 ? "fields, read_unaligned_unsigned" : "fields, BitReader", milliseconds, fields, milliseconds > 0 ? 1000.0 * fields / milliseconds : 0 );
+		checksums[reader] = checksum;
+	}
+	if ( checksums[0] != checksums[1] ) {
+		qCritical() << "bit readers disagree:" << checksums[0] << checksums[1];
+		return false;
+	}
+	return true;
+}
+
+// decodes every edge of the graph twice, the first pass includes reading the blocks
+bool runDecode( const QString& directory )
+{
+	CompressedGraph graph;
+	if ( !graph.loadGraph( fileInDirectory( directory, "Contraction Hierarchies" ), 1024 * 1024 * 4, true ) )
+		return false;
+	printf( "\n%-32s %10s %12s %12s\n", "decode", "[ms]", "count", "count/s" );
+	if ( !runFieldDecode( fileInDirectory( directory, "Contraction Hierarchies" ) + "_edges" ) )
+		return false;
+	for ( int pass = 0; pass < 2; pass++ ) {
+		unsigned long long edges = 0;
+		unsigned long long checksum = 0;
+		QElapsedTimer time;
+		time.start();
+		for ( unsigned block = 0; block < graph.numberOfBlocks(); block++ ) {
+			const unsigned nodes = graph.blockNodeCount( block );
+			for ( unsigned internal = 0; internal < nodes; internal++ ) {
+				for ( CompressedGraph::EdgeIterator edge = graph.edges( graph.blockNode( block, internal ) ); edge.hasEdgesLeft(); ) {
+					graph.unpackNextEdge( &edge );
+					checksum += edge.target() + edge.distance();
+					edges++;
+				}
+			}
+		}
+		double milliseconds = time.nsecsElapsed() / 1000000.0;
+		printf( "%-32s %10.1f %12llu %12.0f\n", pass == 0 ? "cold, all edges" : "warm, all edges", milliseconds, edges, milliseconds > 0 ? 1000.0 * edges / milliseconds : 0 );
+		// keeps the decoding from being optimized away
+		if ( checksum == 0 && edges != 0 )
+			printf( "checksum is zero\n" );
+	}
+	graph.unloadGraph();
+	return true;
+}
+
+}
+
+int main( int argc, char *argv[] )
+{
+	QCoreApplication a( argc, argv );
+
+	Options options;
+	if ( !parseArguments( a.arguments(), &options ) ) {
+		printHelp();
+		return -1;
+	}
+
+	if ( !loadModule( options.directory ) )
+		return -1;
+
+	Timer time;
+	std::vector< Query > queries;
+	bool generated = options.dijkstraRank ? generateDijkstraRankQueries( options, &queries ) : generateRandomQueries( options, &queries );
+	if ( !generated )
+		return -1;
+	printf( "generated %u %s queries with seed %u in %d ms\n\n", ( unsigned ) queries.size(), options.dijkstraRank ? "Dijkstra rank" : "random", options.seed, time.elapsed() );
+
+	printf( "%-32s %8s %8s %8s %8s %10s %8s %8s %7s\n", "run", "p50[ms]", "p90[ms]", "p99[ms]", "max[ms]", "queries/s", "edges[%]", "paths[%]", "failed" );
+	// a fresh context starts with empty caches, the operating system's page cache is not affected though
+	IRouter::Context* distanceContext = g_router->CreateContext();
+	IRouter::Context* unpackContext = g_router->CreateContext();
+	if ( distanceContext == NULL || unpackContext == NULL )
+		return -1;
+	runQueries( "cold, distance only", distanceContext, queries, false );
+	runQueries( "warm, distance only", distanceContext, queries, false );
+	runQueries( "cold, with unpacking", unpackContext, queries, true );
+	runQueries( "warm, with unpacking", unpackContext, queries, true );
+	if ( options.dijkstraRank )
+		runRanks( distanceContext, queries );
+	if ( options.decode && !runDecode( options.directory ) )
+		return -1;
+	delete distanceContext;
+	delete unpackContext;
+
+	g_router->UnloadData();
+	g_gpsLookup->UnloadData();
+	return 0;
+}
@@ -0,0 +1,32 @@
+QT       += core
+
+QT       -= gui
+
+INCLUDEPATH += ../..
+DESTDIR = ../../bin
+
+TARGET = monav-bench-router
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+unix {
+	QMAKE_CXXFLAGS_RELEASE -= -O2
+	QMAKE_CXXFLAGS_RELEASE += -O3 \
+		 -Wno-unused-function
+	QMAKE_CXXFLAGS_DEBUG += -Wno-unused-function
+}
+
+LIBS += -L../../bin/plugins_client -lcontractionhierarchiesclient -lgpsgridclient
+
+SOURCES += main.cpp
+
+HEADERS += \
+	 ../../interfaces/irouter.h \
+	 ../../interfaces/igpslookup.h \
+	 ../../utils/coordinates.h \
+	 ../../utils/bithelpers.h \
+	 ../../utils/qthelpers.h \
+	 ../../plugins/contractionhierarchies/compressedgraph.h \
+	 ../../plugins/contractionhierarchies/blockcache.h
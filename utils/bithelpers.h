@@ -23,6 +23,9 @@ along with MoNav.  If not, see <http://www.gnu.org/licenses/>.
 #include <cstring>
 #include <algorithm>
 #include <vector>
+#ifdef __BMI2__
+	#include <immintrin.h>
+#endif
 
 template< class T >
 static inline T readUnaligned( const char* buffer ) {
@@ -92,6 +95,57 @@ static inline unsigned read_unaligned_unsigned( const unsigned char* buffer, int
 	return result & ( ( 1u << bits ) - 1 );
 }
 
+// reads consecutive fields of up to 32 bits from a bit position
+// every field is extracted from a single unaligned 64 bit load instead of being assembled from bytes
+// may read up to 8 bytes starting at the first byte of a field, the buffer has to be padded accordingly
+// uses BMI2's bzhi for the extraction if the compiler targets it
+class BitReader {
+
+public:
+
+	BitReader( const unsigned char* buffer, unsigned position = 0 ) :
+			m_buffer( buffer ), m_position( position )
+	{
+	}
+
+	unsigned read( int bits )
+	{
+		unsigned result = read( m_buffer, m_position, bits );
+		m_position += bits;
+		return result;
+	}
+
+	bool readBit()
+	{
+		bool result = ( ( m_buffer[m_position >> 3] >> ( m_position & 7 ) ) & 1 ) != 0;
+		m_position++;
+		return result;
+	}
+
+	// the bit position relative to the buffer
+	unsigned position() const
+	{
+		return m_position;
+	}
+
+	// reads a single field at a bit position
+	static unsigned read( const unsigned char* buffer, unsigned position, int bits )
+	{
+		assert( bits <= 32 );
+		unsigned long long window = readUnaligned< unsigned long long >( ( const char* ) buffer + ( position >> 3 ) ) >> ( position & 7 );
+#ifdef __BMI2__
+		return _bzhi_u64( window, bits );
+#else
+		return window & ( ( 1ull << bits ) - 1 );
+#endif
+	}
+
+private:
+
+	const unsigned char* m_buffer;
+	unsigned m_position;
+};
+
 // writes #bits bits of data into the buffer at the offset
 // offset has to be <8, **buffer has to be zeroed
 // modifies buffer and offset to point after the inserted data